@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+//! takes a chunk of at least size bytes off the spare list, or mallocs one
+static struct arena_chunk *new_chunk(struct arena *arena, size_t size)
+{
+    struct arena_chunk **at;
+    struct arena_chunk *chunk;
+
+    for (at = &arena->spare; *at; at = &(*at)->next) {
+        if ((*at)->size >= size) {
+            chunk = *at;
+            *at = chunk->next;
+            return chunk;
+        }
+    }
+
+    if ((chunk = malloc(sizeof(struct arena_chunk) + size)) == NULL) {
+        return NULL;
+    }
+    chunk->size = size;
+    return chunk;
+}
+
+//! size bytes aligned to ARENA_ALIGN, or NULL if malloc says no
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    size_t chunk_size = arena->chunk_size ? arena->chunk_size :
+                        ARENA_CHUNK_DEFAULT;
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // the rest of a chunk too small for this is just left there
+    if (!chunk || chunk->size - chunk->used < size) {
+        if ((chunk = new_chunk(arena, size > chunk_size ? size :
+                               chunk_size)) == NULL) {
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->next = arena->chunk;
+        arena->chunk = chunk;
+    }
+
+    ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char *arena_strdup(struct arena *arena, const char *string)
+{
+    size_t len = strlen(string) + 1;
+    char *copy = arena_alloc(arena, len);
+
+    if (copy) {
+        memcpy(copy, string, len);
+    }
+    return copy;
+}
+
+struct arena_mark arena_mark(struct arena *arena)
+{
+    struct arena_mark mark;
+
+    mark.chunk = arena->chunk;
+    mark.used = arena->chunk ? arena->chunk->used : 0;
+    return mark;
+}
+
+//! frees everything allocated since the mark was taken, marks have to be
+//! released newest first (like a stack)
+
+void arena_release(struct arena *arena, struct arena_mark mark)
+{
+    struct arena_chunk *chunk;
+
+    while (arena->chunk != mark.chunk) {
+        chunk = arena->chunk;
+        arena->chunk = chunk->next;
+        chunk->next = arena->spare;
+        arena->spare = chunk;
+    }
+    if (arena->chunk) {
+        arena->chunk->used = mark.used;
+    }
+}
+
+//! frees everything, but keeps the memory for the next round
+void arena_reset(struct arena *arena)
+{
+    struct arena_mark start = { NULL, 0 };
+
+    arena_release(arena, start);
+}
+
+//! gives all the memory back, the arena can still be used after
+void arena_free(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    arena_reset(arena);
+    while ((chunk = arena->spare) != NULL) {
+        arena->spare = chunk->next;
+        free(chunk);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator for things that all die at the same time. Allocating
+ * is a pointer bump in the current chunk, there is no per object free,
+ * and a reset (or a release back to a mark) hands every chunk back to be
+ * carved up again, so a tool that does the same thing over and over stops
+ * calling malloc once the first round has grown the arena big enough.
+ *
+ * An arena that is all zeros is ready to use. One arena is not safe to
+ * use from two threads at once.
+ */
+
+//macros
+#define ARENA_CHUNK_DEFAULT 4096
+#define ARENA_ALIGN 16
+
+/* Structures */
+struct arena_chunk {
+    struct arena_chunk *next;   // the chunk before this one
+    size_t size;
+    size_t used;
+    unsigned char data[] __attribute__ ((aligned (ARENA_ALIGN)));
+};
+
+struct arena {
+    struct arena_chunk *chunk;  // the one being carved up, newest first
+    struct arena_chunk *spare;  // handed back by a reset, used first
+    size_t chunk_size;          // 0 for ARENA_CHUNK_DEFAULT
+};
+
+// where an arena was up to, releasing back to it frees everything after
+struct arena_mark {
+    struct arena_chunk *chunk;
+    size_t used;
+};
+
+//functions
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *string);
+struct arena_mark arena_mark(struct arena *arena);
+void arena_release(struct arena *arena, struct arena_mark mark);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+
+#endif
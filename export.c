@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "helper.h"
+#include "export.h"
+
+// tar header layout (ustar), the offsets of every field in the 512 bytes
+#define TAR_NAME 0
+#define TAR_NAME_LEN 100
+#define TAR_MODE 100
+#define TAR_UID 108
+#define TAR_GID 116
+#define TAR_SIZE 124
+#define TAR_MTIME 136
+#define TAR_CHKSUM 148
+#define TAR_TYPE 156
+#define TAR_LINKNAME 157
+#define TAR_MAGIC 257
+#define TAR_VERSION 263
+#define TAR_DEVMAJOR 329
+#define TAR_DEVMINOR 337
+#define TAR_PREFIX 345
+#define TAR_PREFIX_LEN 155
+
+#define CPIO_MAGIC "070701"
+#define CPIO_TRAILER "TRAILER!!!"
+#define CPIO_ALIGN 4
+
+// the other file types, minfunc.h only has the ones minls needs
+#define FIFO_TYPE 0010000
+#define CHAR_TYPE 0020000
+#define BLOCK_TYPE 0060000
+
+/* Structures */
+
+// a run of a file that has data, everything between runs is a hole
+struct region {
+    uint64_t off;
+    uint64_t len;
+};
+
+struct region_list {
+    struct region *regions;
+    size_t count;
+    size_t cap;
+    uint64_t data;      // bytes in all the regions together
+};
+
+struct export_state {
+    minfs_t *fs;
+    FILE *out;
+    int format;
+    size_t strip;       // how much of each walk path isnt in the archive
+    int skip_holes;     // sparse tar bodies only have the data runs
+    char **first_name;  // tar: where each hardlinked inode went first
+    uint64_t written;   // for padding the archive out at the end
+};
+
+static const uint8_t zeros[TAR_BLOCK];
+
+int export_format_from_name(const char *name) {
+    if (!strcmp(name, "tar")) {
+        return EXPORT_TAR;
+    }
+    if (!strcmp(name, "cpio")) {
+        return EXPORT_CPIO;
+    }
+    return EXPORT_NONE;
+}
+
+static void put(struct export_state *st, const void *data, size_t len) {
+    fwrite(data, 1, len, st->out);
+    st->written += len;
+}
+
+static void put_zeros(struct export_state *st, uint64_t len) {
+    size_t chunk;
+
+    while (len > 0) {
+        chunk = MIN(len, sizeof(zeros));
+        put(st, zeros, chunk);
+        len -= chunk;
+    }
+}
+
+//! pads what has been written so far out to a multiple of align
+static void pad_to(struct export_state *st, uint64_t align) {
+    if (st->written % align) {
+        put_zeros(st, align - st->written % align);
+    }
+}
+
+/* extents */
+
+static int add_region(struct region_list *list, uint64_t off,
+                      uint64_t len) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 8;
+        list->regions = realloc(list->regions,
+                                sizeof(struct region) * list->cap);
+        if (!list->regions) {
+            return -ENOMEM;
+        }
+    }
+    list->regions[list->count].off = off;
+    list->regions[list->count].len = len;
+    list->count++;
+    return SUCCESS;
+}
+
+//! builds the data runs of a file from where its zones are
+static int add_zone(const uint8_t *data, size_t len, uint64_t off,
+                    uint32_t zone, void *arg) {
+    struct region_list *list = arg;
+    struct region *last;
+
+    if (zone == 0) {
+        return SUCCESS;
+    }
+    list->data += len;
+
+    // zones that follow on from the last run just make it longer
+    last = list->count ? &list->regions[list->count - 1] : NULL;
+    if (last && last->off + last->len == off) {
+        last->len += len;
+        return SUCCESS;
+    }
+    return add_region(list, off, len);
+}
+
+/* file bodies */
+
+//! writes the zones out as they come, holes as zeros unless skip_holes
+static int body_zone(const uint8_t *data, size_t len, uint64_t off,
+                     uint32_t zone, void *arg) {
+    struct export_state *st = arg;
+
+    if (data) {
+        put(st, data, len);
+    }
+    else if (!st->skip_holes) {
+        put_zeros(st, len);
+    }
+    return SUCCESS;
+}
+
+//! streams a regular file straight from the image, a zone at a time
+static int write_body(struct export_state *st, uint32_t ino, int sparse) {
+    st->skip_holes = sparse;
+    return minfs_read_zones(st->fs, ino, body_zone, st);
+}
+
+//! reads a symlinks target
+static char *read_link(struct export_state *st, uint32_t ino,
+                       const struct inode *node) {
+    char *target = malloc(node->size + 1);
+    ssize_t got;
+
+    if (!target) {
+        return NULL;
+    }
+    if ((got = minfs_readlink(st->fs, ino, target, node->size)) < 0) {
+        free(target);
+        return NULL;
+    }
+    target[MIN(got, node->size)] = '\0';
+    return target;
+}
+
+/* tar */
+
+static void tar_octal(uint8_t *header, int field, int len, uint64_t value) {
+    char buf[24];
+
+    // len - 1 digits and the terminator
+    snprintf(buf, sizeof(buf), "%0*llo", len - 1, (unsigned long long)value);
+    memcpy(header + field, buf, len);
+}
+
+//! puts name in the ustar name field, splitting it at a slash into the
+//! prefix field if it has to. FALSE if it wont fit either way
+
+static int tar_name(uint8_t *header, const char *name) {
+    size_t len = strlen(name);
+    const char *slash;
+
+    if (len <= TAR_NAME_LEN) {
+        memcpy(header + TAR_NAME, name, len);
+        return TRUE;
+    }
+
+    // the prefix gets everything before some slash, the name the rest
+    for (slash = name + len - 1; slash > name; slash--) {
+        if (*slash != '/') {
+            continue;
+        }
+        if (slash - name <= TAR_PREFIX_LEN &&
+            len - (slash - name) - 1 <= TAR_NAME_LEN) {
+            memcpy(header + TAR_PREFIX, name, slash - name);
+            memcpy(header + TAR_NAME, slash + 1, len - (slash - name) - 1);
+            return TRUE;
+        }
+    }
+
+    // whatever fits, a pax header has the real name
+    memcpy(header + TAR_NAME, name, TAR_NAME_LEN);
+    return FALSE;
+}
+
+static size_t digits(size_t value) {
+    return snprintf(NULL, 0, "%zu", value);
+}
+
+//! adds "len key=value\n" to a pax header, len counts its own digits
+static void pax_record(char **buf, size_t *used, const char *key,
+                       const char *value) {
+    size_t body = strlen(key) + strlen(value) + 3; // space, = and newline
+    size_t len = body + 1;
+
+    // adding the digits can make it a digit longer
+    while (len != body + digits(len)) {
+        len = body + digits(len);
+    }
+
+    *buf = realloc(*buf, *used + len + 1);
+    if (!*buf) {
+        perror("realloc");
+        exit(ERROR);
+    }
+    sprintf(*buf + *used, "%zu %s=%s\n", len, key, value);
+    *used += len;
+}
+
+static void tar_checksum(uint8_t *header) {
+    unsigned sum = 0;
+    int i;
+
+    memset(header + TAR_CHKSUM, ' ', 8);
+    for (i = 0; i < TAR_BLOCK; i++) {
+        sum += header[i];
+    }
+    snprintf((char *)header + TAR_CHKSUM, 8, "%06o", sum);
+    header[TAR_CHKSUM + 7] = ' ';
+}
+
+//! writes one ustar header (and a pax header first if one is needed).
+//! pax has any records the caller wants in it already and is freed here
+
+static void tar_header(struct export_state *st, const char *name,
+                       uint32_t ino, const struct inode *node, char type,
+                       uint64_t size, const char *linkname, char *pax,
+                       size_t pax_len) {
+    uint8_t header[TAR_BLOCK];
+    uint8_t pax_header[TAR_BLOCK];
+    char pax_name[TAR_NAME_LEN + 1];
+
+    memset(header, 0, sizeof(header));
+
+    if (!tar_name(header, name)) {
+        pax_record(&pax, &pax_len, "path", name);
+    }
+    if (linkname) {
+        if (strlen(linkname) > TAR_NAME_LEN) {
+            pax_record(&pax, &pax_len, "linkpath", linkname);
+        }
+        memcpy(header + TAR_LINKNAME, linkname,
+               MIN(strlen(linkname), TAR_NAME_LEN));
+    }
+
+    // the pax header is an entry of its own just before this one
+    if (pax_len) {
+        memset(pax_header, 0, sizeof(pax_header));
+        snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%u", ino);
+        memcpy(pax_header + TAR_NAME, pax_name, strlen(pax_name));
+        tar_octal(pax_header, TAR_MODE, 8, 0644);
+        tar_octal(pax_header, TAR_UID, 8, 0);
+        tar_octal(pax_header, TAR_GID, 8, 0);
+        tar_octal(pax_header, TAR_SIZE, 12, pax_len);
+        tar_octal(pax_header, TAR_MTIME, 12, (uint32_t)node->mtime);
+        pax_header[TAR_TYPE] = 'x';
+        memcpy(pax_header + TAR_MAGIC, "ustar", 6);
+        memcpy(pax_header + TAR_VERSION, "00", 2);
+        tar_checksum(pax_header);
+
+        put(st, pax_header, TAR_BLOCK);
+        put(st, pax, pax_len);
+        pad_to(st, TAR_BLOCK);
+    }
+    free(pax);
+
+    tar_octal(header, TAR_MODE, 8, node->mode & 07777);
+    tar_octal(header, TAR_UID, 8, node->uid);
+    tar_octal(header, TAR_GID, 8, node->gid);
+    tar_octal(header, TAR_SIZE, 12, size);
+    tar_octal(header, TAR_MTIME, 12, (uint32_t)node->mtime);
+    header[TAR_TYPE] = type;
+    memcpy(header + TAR_MAGIC, "ustar", 6);
+    memcpy(header + TAR_VERSION, "00", 2);
+
+    // devices keep their number where the first zone would be
+    if (type == '3' || type == '4') {
+        tar_octal(header, TAR_DEVMAJOR, 8, (node->zone[0] >> 8) & 0xff);
+        tar_octal(header, TAR_DEVMINOR, 8, node->zone[0] & 0xff);
+    }
+
+    tar_checksum(header);
+    put(st, header, TAR_BLOCK);
+}
+
+//! a file with holes, as a GNU 1.0 sparse entry: the pax header says how
+//! big the file really is, and the body is a map of the data runs
+//! followed by only the data in them
+
+static int tar_sparse(struct export_state *st, uint32_t ino,
+                      const struct inode *node, const char *name,
+                      struct region_list *list) {
+    char number[24];
+    char *pax = NULL;
+    size_t pax_len = 0;
+    char *map = NULL;
+    size_t map_len = 0;
+    char *fake_name;
+    const char *base;
+    size_t i;
+    int err;
+
+    // GNU tar wants the file to end with a run, even an empty one
+    if (!list->count || list->regions[list->count - 1].off +
+        list->regions[list->count - 1].len < node->size) {
+        if ((err = add_region(list, node->size, 0)) < 0) {
+            return err;
+        }
+    }
+
+    // count, then offset and length of each run, a number per line
+    map = malloc(24 * (list->count * 2 + 1));
+    if (!map) {
+        return -ENOMEM;
+    }
+    map_len = sprintf(map, "%zu\n", list->count);
+    for (i = 0; i < list->count; i++) {
+        map_len += sprintf(map + map_len, "%llu\n%llu\n",
+                           (unsigned long long)list->regions[i].off,
+                           (unsigned long long)list->regions[i].len);
+    }
+
+    pax_record(&pax, &pax_len, "GNU.sparse.major", "1");
+    pax_record(&pax, &pax_len, "GNU.sparse.minor", "0");
+    pax_record(&pax, &pax_len, "GNU.sparse.name", name);
+    snprintf(number, sizeof(number), "%u", node->size);
+    pax_record(&pax, &pax_len, "GNU.sparse.realsize", number);
+
+    // the ustar name is only for tars that dont know the sparse format
+    if ((fake_name = malloc(strlen(name) + 20)) == NULL) {
+        free(map);
+        free(pax);
+        return -ENOMEM;
+    }
+    base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    sprintf(fake_name, "%.*sGNUSparseFile.0/%s", (int)(base - name), name,
+            base);
+
+    // the real name is in the pax header, so the fake one can be cut short
+    if (strlen(fake_name) > TAR_NAME_LEN) {
+        fake_name[TAR_NAME_LEN] = '\0';
+    }
+    tar_header(st, fake_name, ino, node, '0',
+               (map_len + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK +
+               list->data, NULL, pax, pax_len);
+    free(fake_name);
+
+    put(st, map, map_len);
+    pad_to(st, TAR_BLOCK);
+    free(map);
+
+    if ((err = write_body(st, ino, TRUE)) < 0) {
+        return err;
+    }
+    pad_to(st, TAR_BLOCK);
+    return SUCCESS;
+}
+
+static int tar_entry(struct export_state *st, uint32_t ino,
+                     const struct inode *node, const char *name) {
+    struct region_list list;
+    uint16_t type = node->mode & FILE_TYPE;
+    char *target;
+    char *dir_name;
+    int err;
+
+    if (type == MASK_DIR) {
+        if ((dir_name = malloc(strlen(name) + 2)) == NULL) {
+            return -ENOMEM;
+        }
+        sprintf(dir_name, "%s/", name);
+        tar_header(st, dir_name, ino, node, '5', 0, NULL, NULL, 0);
+        free(dir_name);
+        return SUCCESS;
+    }
+
+    // every link after the first is just a pointer back to it
+    if (node->links > 1 && type != MASK_DIR) {
+        if (st->first_name[ino]) {
+            tar_header(st, name, ino, node, '1', 0, st->first_name[ino],
+                       NULL, 0);
+            return SUCCESS;
+        }
+        if ((st->first_name[ino] = strdup(name)) == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    switch (type) {
+        case SYM_LINK_TYPE:
+            if ((target = read_link(st, ino, node)) == NULL) {
+                return -MINFS_ECORRUPT;
+            }
+            tar_header(st, name, ino, node, '2', 0, target, NULL, 0);
+            free(target);
+            return SUCCESS;
+        case CHAR_TYPE:
+            tar_header(st, name, ino, node, '3', 0, NULL, NULL, 0);
+            return SUCCESS;
+        case BLOCK_TYPE:
+            tar_header(st, name, ino, node, '4', 0, NULL, NULL, 0);
+            return SUCCESS;
+        case FIFO_TYPE:
+            tar_header(st, name, ino, node, '6', 0, NULL, NULL, 0);
+            return SUCCESS;
+        case REGULAR_FILE:
+            break;
+        default:
+            fprintf(stderr, "%s: can't be put in a tar, skipped\n", name);
+            return SUCCESS;
+    }
+
+    // work out where the holes are before anything is written
+    memset(&list, 0, sizeof(list));
+    if ((err = minfs_map_zones(st->fs, ino, add_zone, &list)) < 0) {
+        free(list.regions);
+        return err;
+    }
+
+    if (list.data < node->size) {
+        err = tar_sparse(st, ino, node, name, &list);
+    }
+    else {
+        tar_header(st, name, ino, node, '0', node->size, NULL, NULL, 0);
+        if ((err = write_body(st, ino, FALSE)) == SUCCESS) {
+            pad_to(st, TAR_BLOCK);
+        }
+    }
+    free(list.regions);
+    return err;
+}
+
+/* cpio */
+
+static void cpio_header(struct export_state *st, const char *name,
+                        uint32_t ino, const struct inode *node,
+                        uint32_t nlink, uint32_t size) {
+    char header[111];
+    uint32_t rdev = 0;
+
+    if (node && ((node->mode & FILE_TYPE) == CHAR_TYPE ||
+                 (node->mode & FILE_TYPE) == BLOCK_TYPE)) {
+        rdev = node->zone[0];
+    }
+
+    sprintf(header, "%s%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X"
+            "%08X", CPIO_MAGIC, ino,
+            node ? node->mode : 0, node ? node->uid : 0,
+            node ? node->gid : 0, nlink,
+            node ? (uint32_t)node->mtime : 0, size, 0, 0,
+            (rdev >> 8) & 0xff, rdev & 0xff,
+            (unsigned)strlen(name) + 1, 0);
+
+    put(st, header, strlen(header));
+    put(st, name, strlen(name) + 1);
+    pad_to(st, CPIO_ALIGN);
+}
+
+//! every link gets its own copy of the data, newc can share it but only
+//! if all the links are in the archive and we cant know that up front
+
+static int cpio_entry(struct export_state *st, uint32_t ino,
+                      const struct inode *node, const char *name) {
+    uint16_t type = node->mode & FILE_TYPE;
+    char *target;
+    int err;
+
+    if (type == MASK_DIR) {
+        cpio_header(st, name, ino, node, node->links, 0);
+        return SUCCESS;
+    }
+
+    if (type == SYM_LINK_TYPE) {
+        if ((target = read_link(st, ino, node)) == NULL) {
+            return -MINFS_ECORRUPT;
+        }
+        cpio_header(st, name, ino, node, 1, strlen(target));
+        put(st, target, strlen(target));
+        pad_to(st, CPIO_ALIGN);
+        free(target);
+        return SUCCESS;
+    }
+
+    if (type != REGULAR_FILE) {
+        cpio_header(st, name, ino, node, 1, 0);
+        return SUCCESS;
+    }
+
+    cpio_header(st, name, ino, node, 1, node->size);
+    if ((err = write_body(st, ino, FALSE)) < 0) {
+        return err;
+    }
+    pad_to(st, CPIO_ALIGN);
+    return SUCCESS;
+}
+
+/* the tree */
+
+static int export_entry(minfs_t *fs, uint32_t ino, const struct inode *node,
+                        const char *path, void *arg) {
+    struct export_state *st = arg;
+    const char *name = path + st->strip;
+    int err;
+
+    if (st->format == EXPORT_TAR) {
+        err = tar_entry(st, ino, node, name);
+    }
+    else {
+        err = cpio_entry(st, ino, node, name);
+    }
+
+    if (err < 0) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+    }
+    return err < 0 ? err : SUCCESS;
+}
+
+//! writes path (and everything under it if it is a directory) to out as
+//! one archive. names in the archive start at the last part of path, the
+//! way tar -C would have them
+
+int export_tree(minfs_t *fs, uint32_t ino, const char *path, int format,
+                FILE *out) {
+    const struct inode *node = minfs_inode(fs, ino);
+    struct export_state st;
+    char *top;
+    char *slash;
+    size_t len;
+    uint32_t i;
+    int err = SUCCESS;
+
+    memset(&st, 0, sizeof(st));
+    st.fs = fs;
+    st.out = out;
+    st.format = format;
+    st.first_name = calloc(minfs_ninodes(fs) + 1, sizeof(char *));
+    if (!st.first_name || (top = strdup(path)) == NULL) {
+        return -ENOMEM;
+    }
+
+    // trailing slashes would make the strip below come out wrong
+    len = strlen(top);
+    while (len > 1 && top[len - 1] == '/') {
+        top[--len] = '\0';
+    }
+    slash = strrchr(top, '/');
+    st.strip = slash ? slash - top + 1 : 0;
+
+    // the root has no name of its own, everything else is in by name
+    if (strcmp(top, "/")) {
+        err = export_entry(fs, ino, node, top, &st);
+    }
+    if (!err && (node->mode & FILE_TYPE) == MASK_DIR) {
+        err = minfs_walk(fs, ino, top, export_entry, &st);
+    }
+
+    // and whatever ends the archive
+    if (format == EXPORT_TAR) {
+        put_zeros(&st, TAR_BLOCK * 2);
+    }
+    else {
+        cpio_header(&st, CPIO_TRAILER, 0, NULL, 1, 0);
+        pad_to(&st, TAR_BLOCK);
+    }
+    fflush(out);
+    if (!err && ferror(out)) {
+        err = -EIO;
+    }
+
+    for (i = 0; i <= minfs_ninodes(fs); i++) {
+        free(st.first_name[i]);
+    }
+    free(st.first_name);
+    free(top);
+    return err;
+}
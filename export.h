@@ -0,0 +1,20 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "minfs.h"
+
+//macros
+#define EXPORT_NONE 0
+#define EXPORT_TAR 1    // POSIX (pax) tar, holes as GNU 1.0 sparse entries
+#define EXPORT_CPIO 2   // SVR4 newc cpio, holes written out as zeros
+
+#define TAR_BLOCK 512
+
+//functions
+int export_format_from_name(const char *name);
+int export_tree(minfs_t *fs, uint32_t ino, const char *path, int format,
+                FILE *out);
+
+#endif
@@ -0,0 +1,796 @@
+#define _GNU_SOURCE // for copy_file_range
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h> // FICLONE
+
+// linux/fs.h has its own BLOCK_SIZE, ours is the same 1024
+#undef BLOCK_SIZE
+#include "helper.h"
+#include "hash.h"
+#include "manifest.h"
+#include "extract.h"
+
+/*
+ * Extracting a tree onto the host. Each inode is only read out of the
+ * image once: the first name of a file with more than one link is
+ * remembered, and every later name is made a hardlink to it. When the
+ * host wont link (another filesystem, too many links) it gets a reflink
+ * copy if the filesystem can do those, and a copy of the host file if
+ * not, none of which reads the image again.
+ *
+ * Holes are not written, the file is just made the right size at the end
+ * so the host file is sparse in the same places.
+ *
+ * Nothing is made through a path joined up from names in the image. Each
+ * directory is opened (never through a symlink) and whats in it is made
+ * relative to that, so a symlink extracted earlier cant send anything
+ * after it out of dst.
+ *
+ * With a manifest from the last run only what changed is extracted. One
+ * pass over the inode table (which is already in memory) finds every
+ * inode that doesnt look the way the manifest says. A directory that
+ * didnt change still has the same names in it, so those come out of the
+ * manifest instead of being read, and only changed directories and
+ * changed files ever get read out of the image. Like rsync without -c,
+ * a file written behind the filesystems back, keeping its mtime, ctime
+ * and size, looks the same and isnt extracted again.
+ */
+
+/* Structures */
+
+struct extract_state {
+    minfs_t *fs;
+    const char *dst;
+    int dst_fd;         // dst itself, everything is made under it
+    char **first_name;  // where each hardlinked inode went first, in the tree
+    uint8_t *visited;   // by inode, directories already gone into
+    int hash_algo;      // what files are hashed with as they go out
+    struct extract_stats *stats;
+};
+
+// where the zones of one file go
+struct extract_file {
+    int fd;
+    uint64_t bytes;
+    struct hasher *hash; // NULL if it isnt being hashed
+};
+
+// what syncing against a manifest keeps track of
+struct sync_state {
+    struct extract_state ex;
+    struct manifest *old;   // what the last run left
+    struct manifest *now;   // what this one leaves
+    uint8_t *changed;       // by inode, doesnt match the old manifest
+    int32_t *first;         // entry in now of a hardlinked inodes first name
+};
+
+// the names in a directory, kept while whats under them is extracted
+struct dir_names {
+    struct minfs_dirent *ents;
+    uint32_t count;
+    uint32_t cap;
+};
+
+static int write_zone(const uint8_t *data, size_t len, uint64_t off,
+                      uint32_t zone, void *arg) {
+    struct extract_file *file = arg;
+    size_t done = 0;
+    ssize_t ret;
+
+    // holes are left for ftruncate
+    if (!data) {
+        if (file->hash) {
+            hash_update_zeros(file->hash, len);
+        }
+        return SUCCESS;
+    }
+    if (file->hash) {
+        hash_update(file->hash, data, len);
+    }
+
+    while (done < len) {
+        if ((ret = pwrite(file->fd, data + done, len - done,
+                          off + done)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        done += ret;
+    }
+    file->bytes += len;
+    return SUCCESS;
+}
+
+//! sets the mode and times the inode has on a host file
+static void copy_attrs(int fd, const struct inode *node) {
+    struct timespec times[2];
+
+    times[0].tv_sec = node->atime;
+    times[0].tv_nsec = 0;
+    times[1].tv_sec = node->mtime;
+    times[1].tv_nsec = 0;
+    futimens(fd, times);
+    fchmod(fd, node->mode & 07777);
+}
+
+//! the last name in path (in the tree), "." for the top of it
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+
+    return slash && slash[1] ? slash + 1 : path[0] == '/' ? "." : path;
+}
+
+//! opens directory name in dirfd, making it with mode first if make. a
+//! symlink there isnt followed, it is an error
+static int open_dir(int dirfd, const char *name, mode_t mode, int make) {
+    int fd;
+
+    if (make && mkdirat(dirfd, name, mode) < 0 && errno != EEXIST) {
+        return -errno;
+    }
+    if ((fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) <
+        0) {
+        return -errno;
+    }
+    return fd;
+}
+
+//! opens the directory path (in the tree under dst_fd) is in, a name at
+//! a time the same way, and points name at the last one in path
+
+static int open_parent(int dst_fd, const char *path, const char **name) {
+    char part[NAME_MAX + 1];
+    size_t len;
+    int next;
+    int fd;
+
+    *name = base_name(path);
+    if ((fd = openat(dst_fd, ".", O_RDONLY | O_DIRECTORY)) < 0) {
+        return -errno;
+    }
+    for (path += *path == '/'; path[len = strcspn(path, "/")];
+         path += len + 1) {
+        if (len > NAME_MAX) {
+            close(fd);
+            return -ENAMETOOLONG;
+        }
+        memcpy(part, path, len);
+        part[len] = '\0';
+        next = open_dir(fd, part, 0, FALSE);
+        close(fd);
+        if (next < 0) {
+            return next;
+        }
+        fd = next;
+    }
+    return fd;
+}
+
+//! where path (in the tree) goes on the host
+static char *host_path(const char *dst, const char *path) {
+    char *host;
+
+    if ((host = malloc(strlen(dst) + strlen(path) + 1)) != NULL) {
+        sprintf(host, "%s%s", dst, path);
+    }
+    return host;
+}
+
+//! path of name in directory dir, where the top of the tree is "/"
+static char *join_path(const char *dir, const char *name) {
+    char *path;
+
+    if ((path = malloc(strlen(dir) + strlen(name) + 2)) != NULL) {
+        sprintf(path, "%s/%s", strcmp(dir, "/") ? dir : "", name);
+    }
+    return path;
+}
+
+//! reads file ino out of the image into name in dirfd, and hashes it into
+//! digest too if that isnt NULL
+
+static int extract_file(struct extract_state *st, uint32_t ino,
+                        const struct inode *node, int dirfd,
+                        const char *name, char *digest) {
+    struct extract_file file;
+    struct hasher hash;
+    int err;
+
+    // it is only made writable by us while the data goes in
+    if ((file.fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC |
+                          O_NOFOLLOW, 0600)) < 0) {
+        return -errno;
+    }
+    file.bytes = 0;
+    file.hash = NULL;
+    if (digest) {
+        hash_init(&hash, st->hash_algo);
+        file.hash = &hash;
+    }
+
+    if ((err = minfs_read_zones(st->fs, ino, write_zone, &file)) == 0 &&
+        ftruncate(file.fd, node->size) < 0) {
+        err = -errno;
+    }
+    copy_attrs(file.fd, node);
+    if (close(file.fd) < 0 && err == 0) {
+        err = -errno;
+    }
+    if (digest) {
+        hash_final(&hash, digest);
+    }
+
+    st->stats->files++;
+    st->stats->bytes += file.bytes;
+    return err;
+}
+
+//! copies an already extracted host file, as a reflink if the host can
+static int copy_host_file(int from_dir, const char *from, int dirfd,
+                          const char *name, const struct inode *node) {
+    ssize_t ret;
+    int in;
+    int out;
+    int err = 0;
+
+    if ((in = openat(from_dir, from, O_RDONLY | O_NOFOLLOW)) < 0) {
+        return -errno;
+    }
+    if ((out = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC |
+                      O_NOFOLLOW, 0600)) < 0) {
+        err = -errno;
+        close(in);
+        return err;
+    }
+
+    if (ioctl(out, FICLONE, in) < 0) {
+        // the kernel copies it then, without it coming through us
+        while ((ret = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) >
+               0) {
+        }
+        if (ret < 0) {
+            err = -errno;
+        }
+    }
+
+    copy_attrs(out, node);
+    close(in);
+    if (close(out) < 0 && err == 0) {
+        err = -errno;
+    }
+    return err;
+}
+
+//! makes name in dirfd another name for the file first extracted to from
+//! (in the tree)
+
+static int link_file(struct extract_state *st, const struct inode *node,
+                     const char *from, int dirfd, const char *name) {
+    const char *from_name;
+    int from_dir;
+    int err = SUCCESS;
+
+    if ((from_dir = open_parent(st->dst_fd, from, &from_name)) < 0) {
+        return from_dir;
+    }
+    if (linkat(from_dir, from_name, dirfd, name, 0) < 0) {
+        if (errno != EXDEV && errno != EMLINK && errno != EPERM) {
+            err = -errno;
+        }
+        else {
+            err = copy_host_file(from_dir, from_name, dirfd, name, node);
+        }
+    }
+    close(from_dir);
+    if (err < 0) {
+        return err;
+    }
+
+    st->stats->links++;
+    st->stats->saved += node->size;
+    return SUCCESS;
+}
+
+//! makes name in dirfd a symlink to the same place ino points
+static int extract_link(struct extract_state *st, uint32_t ino, int dirfd,
+                        const char *name) {
+    char target[PATH_MAX];
+    ssize_t len;
+
+    if ((len = minfs_readlink(st->fs, ino, target, sizeof(target) - 1)) <
+        0) {
+        return len;
+    }
+    target[MIN(len, (ssize_t)sizeof(target) - 1)] = '\0';
+
+    if ((unlinkat(dirfd, name, 0) < 0 && errno != ENOENT) ||
+        symlinkat(target, dirfd, name) < 0) {
+        return -errno;
+    }
+    st->stats->symlinks++;
+    return SUCCESS;
+}
+
+//! prints what went wrong making path (in the tree) on the host
+static void report(const char *dst, const char *path, int err) {
+    char *host = host_path(dst, path);
+
+    fprintf(stderr, "%s: %s\n", host ? host : path, minfs_strerror(err));
+    free(host);
+}
+
+static int collect_entry(const struct minfs_dirent *ent, void *arg) {
+    struct dir_names *dir = arg;
+
+    if (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")) {
+        return SUCCESS;
+    }
+    if (!minfs_name_ok(ent->name)) {
+        return -MINFS_ECORRUPT;
+    }
+    if (dir->count == dir->cap) {
+        dir->cap = dir->cap ? dir->cap * 2 : 16;
+        dir->ents = realloc(dir->ents,
+                            sizeof(struct minfs_dirent) * dir->cap);
+        if (!dir->ents) {
+            return -ENOMEM;
+        }
+    }
+    dir->ents[dir->count++] = *ent;
+    return SUCCESS;
+}
+
+static int extract_dir(struct extract_state *st, int dirfd, uint32_t ino,
+                       const char *path);
+
+//! extracts ino, which is path in the tree, into dirfd
+static int extract_entry(struct extract_state *st, int dirfd, uint32_t ino,
+                         const char *path) {
+    const struct inode *node = minfs_inode(st->fs, ino);
+    const char *name = base_name(path);
+    uint16_t type;
+    int fd;
+    int err = SUCCESS;
+
+    if (node == NULL) {
+        return -MINFS_ECORRUPT;
+    }
+    type = node->mode & FILE_TYPE;
+
+    if (type == MASK_DIR) {
+        // the same directory twice means the tree loops back on itself
+        if (st->visited[ino]) {
+            report(st->dst, path, -MINFS_ECORRUPT);
+            return -MINFS_ECORRUPT;
+        }
+        st->visited[ino] = TRUE;
+
+        // it has to stay writable until everything is in it
+        if ((fd = open_dir(dirfd, name, (node->mode & 07777) | S_IRWXU,
+                           TRUE)) < 0) {
+            report(st->dst, path, fd);
+            return fd;
+        }
+        st->stats->dirs++;
+        err = extract_dir(st, fd, ino, path);
+        copy_attrs(fd, node);
+        close(fd);
+        return err;
+    }
+
+    if (type == SYM_LINK_TYPE) {
+        err = extract_link(st, ino, dirfd, name);
+    }
+    else if (type != REGULAR_FILE) {
+        fprintf(stderr, "%s: not a regular file, skipped\n", path);
+        st->stats->skipped++;
+    }
+    // an old file in the way would be linked to instead of replaced
+    else if (unlinkat(dirfd, name, 0) < 0 && errno != ENOENT) {
+        err = -errno;
+    }
+    else if (node->links > 1 && st->first_name[ino]) {
+        err = link_file(st, node, st->first_name[ino], dirfd, name);
+    }
+    else if ((err = extract_file(st, ino, node, dirfd, name, NULL)) == 0 &&
+             node->links > 1 &&
+             (st->first_name[ino] = strdup(path)) == NULL) {
+        err = -ENOMEM;
+    }
+
+    if (err < 0) {
+        report(st->dst, path, err);
+    }
+    return err;
+}
+
+//! extracts everything in directory ino, which is path in the tree, into
+//! dirfd
+static int extract_dir(struct extract_state *st, int dirfd, uint32_t ino,
+                       const char *path) {
+    struct dir_names dir;
+    char *child;
+    uint32_t i;
+    int err;
+
+    memset(&dir, 0, sizeof(dir));
+    if ((err = minfs_readdir(st->fs, ino, collect_entry, &dir)) < 0) {
+        report(st->dst, path, err);
+        free(dir.ents);
+        return err;
+    }
+
+    for (i = 0; i < dir.count && err == SUCCESS; i++) {
+        if ((child = join_path(path, dir.ents[i].name)) == NULL) {
+            err = -ENOMEM;
+            break;
+        }
+        err = extract_entry(st, dirfd, dir.ents[i].ino, child);
+        free(child);
+    }
+    free(dir.ents);
+    return err;
+}
+
+//! extracts everything under directory ino into the host directory dst,
+//! making it if it isnt there
+
+int extract_tree(minfs_t *fs, uint32_t ino, const char *dst,
+                 struct extract_stats *stats) {
+    struct extract_state st;
+    uint32_t i;
+    int err;
+
+    memset(stats, 0, sizeof(struct extract_stats));
+    if (mkdir(dst, S_IRWXU | S_IRWXG | S_IRWXO) < 0 && errno != EEXIST) {
+        return -errno;
+    }
+
+    st.fs = fs;
+    st.dst = dst;
+    st.hash_algo = HASH_NONE;
+    st.stats = stats;
+    if ((st.dst_fd = open(dst, O_RDONLY | O_DIRECTORY)) < 0) {
+        return -errno;
+    }
+    if ((st.first_name = calloc(minfs_ninodes(fs) + 1, sizeof(char *))) ==
+        NULL ||
+        (st.visited = calloc(minfs_ninodes(fs) + 1, 1)) == NULL) {
+        free(st.first_name);
+        close(st.dst_fd);
+        return -ENOMEM;
+    }
+
+    st.visited[ino] = TRUE;
+    err = extract_dir(&st, st.dst_fd, ino, "/");
+
+    for (i = 0; i <= minfs_ninodes(fs); i++) {
+        free(st.first_name[i]);
+    }
+    free(st.first_name);
+    free(st.visited);
+    close(st.dst_fd);
+    return err;
+}
+
+//! the inode table pass: marks every inode that isnt the way the old
+//! manifest has it. one the manifest doesnt have at all is new
+
+static void mark_changed(struct sync_state *st) {
+    const struct inode *table = minfs_inode(st->ex.fs, ROOT_INODE);
+    uint32_t ninodes = minfs_ninodes(st->ex.fs);
+    struct manifest_entry *e;
+    int32_t *by_ino;
+    uint32_t ino;
+    uint32_t i;
+
+    if ((by_ino = malloc(sizeof(int32_t) * (ninodes + 1))) == NULL) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    memset(by_ino, 0xff, sizeof(int32_t) * (ninodes + 1));
+    for (i = 0; i < st->old->count; i++) {
+        if (st->old->entries[i].ino <= ninodes) {
+            by_ino[st->old->entries[i].ino] = i;
+        }
+    }
+
+    for (ino = ROOT_INODE; ino <= ninodes; ino++) {
+        if (by_ino[ino] < 0) {
+            st->changed[ino] = TRUE;
+            continue;
+        }
+        e = &st->old->entries[by_ino[ino]];
+        st->changed[ino] = !manifest_same(e, ino, &table[ino - ROOT_INODE]);
+
+        // a file without a hash now that there should be one gets read
+        // again to get it
+        if ((e->mode & FILE_TYPE) == REGULAR_FILE &&
+            st->ex.hash_algo != HASH_NONE && !e->hash) {
+            st->changed[ino] = TRUE;
+        }
+    }
+    free(by_ino);
+}
+
+//! takes old entry idx (and everything under it) off the host
+static void remove_old(struct sync_state *st, int32_t idx) {
+    struct manifest_entry *e = &st->old->entries[idx];
+    const char *name;
+    int32_t c;
+    int dir;
+    int err;
+
+    e->seen = TRUE;
+    for (c = e->child; c >= 0; c = st->old->entries[c].sibling) {
+        if (!st->old->entries[c].seen) {
+            remove_old(st, c);
+        }
+    }
+
+    // the path is gone down a name at a time, like everything else
+    if ((dir = open_parent(st->ex.dst_fd, e->path, &name)) < 0) {
+        err = dir;
+    }
+    else {
+        err = unlinkat(dir, name, (e->mode & FILE_TYPE) == MASK_DIR ?
+                       AT_REMOVEDIR : 0) < 0 ? -errno : SUCCESS;
+        close(dir);
+    }
+
+    // whatever else is in a directory isnt ours to take away
+    if (err < 0 && err != -ENOENT) {
+        report(st->ex.dst, e->path, err);
+    }
+    else {
+        st->ex.stats->removed++;
+    }
+}
+
+static int sync_entry(struct sync_state *st, int dirfd, const char *path,
+                      uint32_t ino, int32_t old);
+
+//! syncs everything in directory ino, which is dirfd on the host. old is
+//! its entry in the old manifest if it didnt change, and then its names
+//! come from there
+
+static int sync_children(struct sync_state *st, int dirfd, const char *path,
+                         uint32_t ino, int32_t old) {
+    struct dir_names dir;
+    char *child;
+    int32_t c;
+    uint32_t i;
+    int err = SUCCESS;
+
+    if (old >= 0) {
+        for (c = st->old->entries[old].child; c >= 0 && err == SUCCESS;
+             c = st->old->entries[c].sibling) {
+            err = sync_entry(st, dirfd, st->old->entries[c].path,
+                             st->old->entries[c].ino, c);
+        }
+        return err;
+    }
+
+    memset(&dir, 0, sizeof(dir));
+    if ((err = minfs_readdir(st->ex.fs, ino, collect_entry, &dir)) < 0) {
+        report(st->ex.dst, path, err);
+        free(dir.ents);
+        return err;
+    }
+
+    for (i = 0; i < dir.count && err == SUCCESS; i++) {
+        if ((child = join_path(path, dir.ents[i].name)) == NULL) {
+            err = -ENOMEM;
+            break;
+        }
+        err = sync_entry(st, dirfd, child, dir.ents[i].ino,
+                         manifest_find(st->old, child));
+        free(child);
+    }
+    free(dir.ents);
+    return err;
+}
+
+//! brings one name on the host, in dirfd, up to date with the image. old
+//! is the entry the last run made for the same path, or -1
+
+static int sync_entry(struct sync_state *st, int dirfd, const char *path,
+                      uint32_t ino, int32_t old) {
+    const struct inode *node;
+    uint16_t type;
+    struct manifest_entry *prev = old >= 0 ? &st->old->entries[old] : NULL;
+    const char *name = base_name(path);
+    char digest[HASH_HEX_MAX];
+    const char *hash = NULL;
+    int32_t idx;
+    int fd;
+    int same;
+    int err = SUCCESS;
+
+    // names out of a manifest for some other image could be anything
+    if (ino < ROOT_INODE || ino > minfs_ninodes(st->ex.fs)) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(-MINFS_ECORRUPT));
+        return -MINFS_ECORRUPT;
+    }
+    node = minfs_inode(st->ex.fs, ino);
+    type = node->mode & FILE_TYPE;
+
+    same = prev && prev->ino == ino && !st->changed[ino];
+    if (prev && !same && (prev->mode & FILE_TYPE) != type) {
+        // something else had the name last time, it goes first
+        remove_old(st, old);
+        prev = NULL;
+    }
+    if (prev) {
+        prev->seen = TRUE;
+    }
+
+    if (type == MASK_DIR && st->ex.visited[ino]) {
+        // the same directory twice means the tree loops back on itself
+        err = -MINFS_ECORRUPT;
+    }
+    else if (type == MASK_DIR) {
+        st->ex.visited[ino] = TRUE;
+        if ((fd = open_dir(dirfd, name, (node->mode & 07777) | S_IRWXU,
+                           TRUE)) < 0) {
+            err = fd;
+        }
+        else {
+            st->ex.stats->dirs += !same;
+            manifest_add(st->now, path, ino, node, NULL);
+            err = sync_children(st, fd, path, ino, same ? old : -1);
+            close(fd);
+
+            // whatever went wrong below has been reported already
+            return err;
+        }
+    }
+    else if (same) {
+        // already on the host the way it is in the image
+        hash = prev->hash;
+        st->ex.stats->unchanged++;
+    }
+    else if (type == SYM_LINK_TYPE) {
+        err = extract_link(&st->ex, ino, dirfd, name);
+    }
+    else if (type != REGULAR_FILE) {
+        fprintf(stderr, "%s: not a regular file, skipped\n", path);
+        st->ex.stats->skipped++;
+    }
+    else if (unlinkat(dirfd, name, 0) < 0 && errno != ENOENT) {
+        err = -errno;
+    }
+    else if (node->links > 1 && st->first[ino] >= 0) {
+        hash = st->now->entries[st->first[ino]].hash;
+        err = link_file(&st->ex, node, st->now->entries[st->first[ino]].path,
+                        dirfd, name);
+    }
+    else if ((err = extract_file(&st->ex, ino, node, dirfd, name,
+                                 st->ex.hash_algo != HASH_NONE ? digest :
+                                 NULL)) == 0 &&
+             st->ex.hash_algo != HASH_NONE) {
+        hash = digest;
+    }
+
+    if (err == SUCCESS && type != MASK_DIR) {
+        idx = manifest_add(st->now, path, ino, node, hash);
+        if (node->links > 1 && st->first[ino] < 0) {
+            st->first[ino] = idx;
+        }
+    }
+    if (err < 0) {
+        report(st->ex.dst, path, err);
+    }
+    return err;
+}
+
+//! like extract_tree, but only extracts what changed since the run that
+//! wrote the manifest file, removes what is gone, and then writes the
+//! manifest again for the next run. no manifest file is a first run
+
+int extract_changed(minfs_t *fs, uint32_t ino, const char *dst,
+                    const char *manifest, int hash_algo,
+                    struct extract_stats *stats) {
+    struct sync_state st;
+    struct manifest old;
+    struct manifest now;
+    uint32_t ninodes = minfs_ninodes(fs);
+    uint32_t i;
+    int err;
+
+    memset(stats, 0, sizeof(struct extract_stats));
+    if (mkdir(dst, S_IRWXU | S_IRWXG | S_IRWXO) < 0 && errno != EEXIST) {
+        return -errno;
+    }
+    memset(&st, 0, sizeof(st));
+    if ((st.ex.dst_fd = open(dst, O_RDONLY | O_DIRECTORY)) < 0) {
+        return -errno;
+    }
+    if ((err = manifest_load(manifest, &old)) < 0) {
+        close(st.ex.dst_fd);
+        return err;
+    }
+
+    // hashes made some other way are no use for comparing
+    if (old.hash_algo != hash_algo) {
+        for (i = 0; i < old.count; i++) {
+            free(old.entries[i].hash);
+            old.entries[i].hash = NULL;
+        }
+    }
+    manifest_init(&now, hash_algo);
+
+    st.ex.fs = fs;
+    st.ex.dst = dst;
+    st.ex.hash_algo = hash_algo;
+    st.ex.stats = stats;
+    st.old = &old;
+    st.now = &now;
+    if ((st.changed = calloc(ninodes + 1, 1)) == NULL ||
+        (st.ex.visited = calloc(ninodes + 1, 1)) == NULL ||
+        (st.first = malloc(sizeof(int32_t) * (ninodes + 1))) == NULL) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    memset(st.first, 0xff, sizeof(int32_t) * (ninodes + 1));
+
+    mark_changed(&st);
+    for (i = ROOT_INODE; i <= ninodes; i++) {
+        stats->changed += st.changed[i] &&
+                          minfs_inode(fs, i)->links > 0;
+    }
+
+    if ((err = sync_entry(&st, st.ex.dst_fd, "/", ino,
+                          manifest_find(&old, "/"))) == SUCCESS) {
+        // anything the last run made that wasnt found this time is gone
+        for (i = 0; i < old.count; i++) {
+            if (!old.entries[i].seen) {
+                remove_old(&st, i);
+            }
+        }
+        err = manifest_save(manifest, &now);
+    }
+
+    free(st.changed);
+    free(st.ex.visited);
+    free(st.first);
+    manifest_free(&old);
+    manifest_free(&now);
+    close(st.ex.dst_fd);
+    return err;
+}
+
+//! extracts a single file or symlink ino to host, which can already be
+//! there and is replaced
+
+int extract_one(minfs_t *fs, uint32_t ino, const char *host,
+                struct extract_stats *stats) {
+    const struct inode *node = minfs_inode(fs, ino);
+    struct extract_state st;
+
+    memset(stats, 0, sizeof(struct extract_stats));
+    memset(&st, 0, sizeof(st));
+    st.fs = fs;
+    st.hash_algo = HASH_NONE;
+    st.stats = stats;
+
+    if ((node->mode & FILE_TYPE) == SYM_LINK_TYPE) {
+        return extract_link(&st, ino, AT_FDCWD, host);
+    }
+    if ((node->mode & FILE_TYPE) != REGULAR_FILE) {
+        stats->skipped++;
+        return -EINVAL;
+    }
+    if (unlink(host) < 0 && errno != ENOENT) {
+        return -errno;
+    }
+    return extract_file(&st, ino, node, AT_FDCWD, host, NULL);
+}
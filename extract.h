@@ -0,0 +1,32 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <stdint.h>
+#include "minfs.h"
+
+/* Structures */
+
+// what extracting a tree did
+struct extract_stats {
+    uint64_t files;     // regular files whose data was read
+    uint64_t dirs;
+    uint64_t bytes;     // data read out of the image (holes arent)
+    uint64_t links;     // names made from a file already extracted
+    uint64_t saved;     // bytes those would have read again
+    uint64_t symlinks;
+    uint64_t skipped;   // things that arent files or directories
+    uint64_t unchanged; // left alone because the manifest matched
+    uint64_t removed;   // in the manifest but not the image any more
+    uint64_t changed;   // inodes the inode table pass found different
+};
+
+//functions
+int extract_tree(minfs_t *fs, uint32_t ino, const char *dst,
+                 struct extract_stats *stats);
+int extract_one(minfs_t *fs, uint32_t ino, const char *host,
+                struct extract_stats *stats);
+int extract_changed(minfs_t *fs, uint32_t ino, const char *dst,
+                    const char *manifest, int hash_algo,
+                    struct extract_stats *stats);
+
+#endif
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+// a zone of zeros to feed the hashers when a file has a hole in it
+#define ZERO_CHUNK 4096
+#define MIN_SIZE(a, b) (((a) < (b)) ? (a) : (b))
+static const uint8_t zero_chunk[ZERO_CHUNK];
+
+/* sha256 (FIPS 180-4) */
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+//! runs the compression function over one 64 byte block
+static void sha256_block(struct sha256_ctx *c, const uint8_t *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, d, e, f, g, h, cc, t1, t2;
+    int i;
+
+    // the message schedule, the block is big endian
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 |
+               (uint32_t)p[i * 4 + 2] << 8 | (uint32_t)p[i * 4 + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        w[i] = w[i - 16] + w[i - 7] +
+               (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^
+                (w[i - 15] >> 3)) +
+               (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^
+                (w[i - 2] >> 10));
+    }
+
+    a = c->state[0]; b = c->state[1]; cc = c->state[2]; d = c->state[3];
+    e = c->state[4]; f = c->state[5]; g = c->state[6]; h = c->state[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+             ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+             ((a & b) ^ (a & cc) ^ (b & cc));
+        h = g; g = f; f = e; e = d + t1;
+        d = cc; cc = b; b = a; a = t1 + t2;
+    }
+
+    c->state[0] += a; c->state[1] += b; c->state[2] += cc; c->state[3] += d;
+    c->state[4] += e; c->state[5] += f; c->state[6] += g; c->state[7] += h;
+}
+
+static void sha256_init(struct sha256_ctx *c)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(c->state, iv, sizeof(iv));
+    c->length = 0;
+    c->used = 0;
+}
+
+static void sha256_update(struct sha256_ctx *c, const uint8_t *data,
+                          size_t len)
+{
+    size_t take;
+
+    c->length += len;
+
+    // top up a partial block first
+    if (c->used) {
+        take = MIN_SIZE(len, SHA256_BLOCK - c->used);
+        memcpy(c->block + c->used, data, take);
+        c->used += take;
+        data += take;
+        len -= take;
+        if (c->used < SHA256_BLOCK) {
+            return;
+        }
+        sha256_block(c, c->block);
+        c->used = 0;
+    }
+
+    // whole blocks straight from the callers buffer
+    while (len >= SHA256_BLOCK) {
+        sha256_block(c, data);
+        data += SHA256_BLOCK;
+        len -= SHA256_BLOCK;
+    }
+
+    // keep the leftovers for next time
+    memcpy(c->block, data, len);
+    c->used = len;
+}
+
+static void sha256_final(struct sha256_ctx *c, uint8_t out[SHA256_DIGEST])
+{
+    uint64_t bits = c->length * 8;
+    uint8_t pad[SHA256_BLOCK + 8];
+    size_t padlen;
+    int i;
+
+    // a one bit, zeros, then the length so it all lands on a block edge
+    padlen = (c->used < 56) ? 56 - c->used : 120 - c->used;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[padlen + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256_update(c, pad, padlen + 8);
+
+    for (i = 0; i < 8; i++) {
+        out[i * 4] = (uint8_t)(c->state[i] >> 24);
+        out[i * 4 + 1] = (uint8_t)(c->state[i] >> 16);
+        out[i * 4 + 2] = (uint8_t)(c->state[i] >> 8);
+        out[i * 4 + 3] = (uint8_t)c->state[i];
+    }
+}
+
+/* xxh64 */
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+//! little endian loads, minix images and the hash both want those
+static uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init(struct xxh64_ctx *c)
+{
+    // the seed is always zero
+    c->v[0] = XXH_P1 + XXH_P2;
+    c->v[1] = XXH_P2;
+    c->v[2] = 0;
+    c->v[3] = 0 - XXH_P1;
+    c->length = 0;
+    c->used = 0;
+}
+
+static void xxh64_stripe(struct xxh64_ctx *c, const uint8_t *p)
+{
+    c->v[0] = xxh64_round(c->v[0], read64(p));
+    c->v[1] = xxh64_round(c->v[1], read64(p + 8));
+    c->v[2] = xxh64_round(c->v[2], read64(p + 16));
+    c->v[3] = xxh64_round(c->v[3], read64(p + 24));
+}
+
+static void xxh64_update(struct xxh64_ctx *c, const uint8_t *data,
+                         size_t len)
+{
+    size_t take;
+
+    c->length += len;
+
+    // same deal as sha256, finish a partial stripe before the fast loop
+    if (c->used) {
+        take = MIN_SIZE(len, XXH64_STRIPE - c->used);
+        memcpy(c->stripe + c->used, data, take);
+        c->used += take;
+        data += take;
+        len -= take;
+        if (c->used < XXH64_STRIPE) {
+            return;
+        }
+        xxh64_stripe(c, c->stripe);
+        c->used = 0;
+    }
+
+    while (len >= XXH64_STRIPE) {
+        xxh64_stripe(c, data);
+        data += XXH64_STRIPE;
+        len -= XXH64_STRIPE;
+    }
+
+    memcpy(c->stripe, data, len);
+    c->used = len;
+}
+
+static uint64_t xxh64_final(struct xxh64_ctx *c)
+{
+    const uint8_t *p = c->stripe;
+    const uint8_t *end = c->stripe + c->used;
+    uint64_t h;
+
+    if (c->length >= XXH64_STRIPE) {
+        h = ROTL64(c->v[0], 1) + ROTL64(c->v[1], 7) +
+            ROTL64(c->v[2], 12) + ROTL64(c->v[3], 18);
+        h = xxh64_merge(h, c->v[0]);
+        h = xxh64_merge(h, c->v[1]);
+        h = xxh64_merge(h, c->v[2]);
+        h = xxh64_merge(h, c->v[3]);
+    }
+    else {
+        h = c->v[2] + XXH_P5;
+    }
+    h += c->length;
+
+    // whatever did not fill a whole stripe gets mixed in piece by piece
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, read64(p));
+        h = ROTL64(h, 27) * XXH_P1 + XXH_P4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = ROTL64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_P5;
+        h = ROTL64(h, 11) * XXH_P1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* generic interface */
+
+//! turns the name given on the command line into an algorithm
+int hash_algo_from_name(const char *name)
+{
+    if (!strcmp(name, "xxh64")) {
+        return HASH_XXH64;
+    }
+    if (!strcmp(name, "sha256")) {
+        return HASH_SHA256;
+    }
+    return HASH_NONE;
+}
+
+const char *hash_algo_name(int algo)
+{
+    switch (algo) {
+        case HASH_XXH64:
+            return "xxh64";
+        case HASH_SHA256:
+            return "sha256";
+        default:
+            return "none";
+    }
+}
+
+void hash_init(struct hasher *h, int algo)
+{
+    h->algo = algo;
+    if (algo == HASH_SHA256) {
+        sha256_init(&h->ctx.sha256);
+    }
+    else {
+        xxh64_init(&h->ctx.xxh64);
+    }
+}
+
+void hash_update(struct hasher *h, const uint8_t *data, size_t len)
+{
+    if (h->algo == HASH_SHA256) {
+        sha256_update(&h->ctx.sha256, data, len);
+    }
+    else {
+        xxh64_update(&h->ctx.xxh64, data, len);
+    }
+}
+
+//! hashes len zero bytes, this is how holes get hashed without a read
+void hash_update_zeros(struct hasher *h, size_t len)
+{
+    size_t chunk;
+
+    while (len > 0) {
+        chunk = MIN_SIZE(len, ZERO_CHUNK);
+        hash_update(h, zero_chunk, chunk);
+        len -= chunk;
+    }
+}
+
+//! finishes the hash and writes it out as a lowercase hex string
+void hash_final(struct hasher *h, char hex[HASH_HEX_MAX])
+{
+    uint8_t digest[SHA256_DIGEST];
+    uint64_t v;
+    int i;
+
+    if (h->algo == HASH_SHA256) {
+        sha256_final(&h->ctx.sha256, digest);
+        for (i = 0; i < SHA256_DIGEST; i++) {
+            sprintf(hex + i * 2, "%02x", digest[i]);
+        }
+        return;
+    }
+
+    // xxh64 is printed as one big endian number like xxhsum does
+    v = xxh64_final(&h->ctx.xxh64);
+    sprintf(hex, "%016llx", (unsigned long long)v);
+}
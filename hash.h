@@ -0,0 +1,51 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//macros
+#define HASH_NONE 0
+#define HASH_XXH64 1
+#define HASH_SHA256 2
+
+#define SHA256_BLOCK 64
+#define SHA256_DIGEST 32
+#define XXH64_STRIPE 32
+
+// longest hex digest we can produce (sha256) plus the terminator
+#define HASH_HEX_MAX (SHA256_DIGEST * 2 + 1)
+
+/* Structures */
+struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t length;              // total bytes hashed so far
+    uint8_t block[SHA256_BLOCK];  // partial block waiting for more data
+    size_t used;                  // how much of block is filled
+};
+
+struct xxh64_ctx {
+    uint64_t v[4];                // the four lane accumulators
+    uint64_t length;              // total bytes hashed so far
+    uint8_t stripe[XXH64_STRIPE]; // partial stripe waiting for more data
+    size_t used;                  // how much of stripe is filled
+};
+
+struct hasher {
+    int algo;
+    union {
+        struct sha256_ctx sha256;
+        struct xxh64_ctx xxh64;
+    } ctx;
+};
+
+//functions
+int hash_algo_from_name(const char *name);
+const char *hash_algo_name(int algo);
+
+void hash_init(struct hasher *h, int algo);
+void hash_update(struct hasher *h, const uint8_t *data, size_t len);
+void hash_update_zeros(struct hasher *h, size_t len);
+void hash_final(struct hasher *h, char hex[HASH_HEX_MAX]);
+
+#endif
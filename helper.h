@@ -1,8 +1,11 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include "minfunc.h" //for structs
+#include "minfs.h"
+#include "arena.h"
 
 //macros
 #define SUCCESS 0
@@ -10,142 +13,66 @@
 #define TRUE 1
 #define FALSE 0
 
-#define IZT_ENTRY_SIZE 4 //indirect zone table entry size
-
-#define DIRECT_ZONES 7
-#define PARTITION_TABLE_LOCATION 0x1BE
-#define SECTOR_SIZE 512
-#define BLOCK_SIZE 1024 // the size of a block
-#define SUPERBLOCK_MAGIC 19802
-
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
-// the type of the partition (needs to be minix type)
-#define FILETYPE_MINIX 0x81 
-#define PT_510 0x55 // checks for the valid partition table signature 
-#define PT_511 0xAA // samesies
-
-/* Structures */
-struct __attribute__ ((__packed__)) superblock {
-    uint32_t ninodes;         // number of inodes in this filesystem
-    uint16_t pad1;            // make things line up properly
-    int16_t i_blocks;         // # of blocks used by inode bit map
-    int16_t z_blocks;         // # of blocks used by zone bit map
-    uint16_t firstdata;       // number of first data zone
-    int16_t log_zone_size;    // log2 of blocks per zone
-    int16_t pad2;             // make things line up again
-    uint32_t max_file;        // maximum file size
-    uint32_t zones;           // number of zones on disk
-    int16_t magic;            // magic number */
-    int16_t pad3;             // make things line up again
-    uint16_t blocksize;       // block size in bytes
-    uint8_t subversion;       // filesystem sub–version 
-};
-
-struct __attribute__ ((__packed__)) inode {
-    uint16_t mode;           
-    uint16_t links;           
-    uint16_t uid;
-    uint16_t gid;
-    uint32_t size;
-    int32_t atime;
-    int32_t mtime;
-    int32_t ctime;
-    uint32_t zone[DIRECT_ZONES];
-    uint32_t indirect;
-    uint32_t two_indirect;
-    uint32_t unused;
-};
-
-struct __attribute__ ((__packed__)) directory {
-    uint32_t inode;
-    unsigned char name[60];
-};
-
-
-struct partition partition;  
-struct superblock superblock;  
-struct inode *inodes;  
-
-unsigned int zonesize; 
-
-short p_flag;          
-short s_flag;           
-short h_flag;
-short v_flag;
-
-int prim_part;
-int sub_part;
-
-// global representing where the minix file system partition starts
-uint32_t partition_start; 
-
-char *image_file;
-char **src_path;
-char *src_path_string;
-char **dst_path;
-char *dst_path_string;
-
-int path_arg_count;
-int destination_path_args;
+#define CACHE_DEFAULT_MB 256 // shared frame cache when there are many images
+#define PART_SUFFIX_LEN 32   // room for the .pNsM of a per partition file
+
+/* Global Variables (the command line) */
+extern short p_flag;          
+extern short s_flag;           
+extern short h_flag;
+extern short v_flag;
+extern short n_flag;           // don't write the file data anywhere
+extern short r_flag;           // walk the whole tree under the path
+extern short a_flag;           // every minix filesystem in the partition tree
+extern short c_flag;           // compare file data even if the inodes match
+extern short d_flag;           // read the image with O_DIRECT
+extern short b_flag;           // time reads through the cache and direct
+extern short e_flag;           // drop file data from the cache once read
+
+extern int hash_algo;          // which hash to compute while streaming
+extern int export_format;      // archive to stream a subtree out as
+extern int jobs;               // worker threads, 0 for one per cpu
+extern char *manifest_file;    // what the last -r run extracted, for -m
+extern uint32_t page_limit;    // most entries a listing prints, 0 for all
+extern char *cursor_token;     // where a paged listing picks up again
+extern size_t cache_limit;     // bytes the shared frame cache can hold
+extern uint32_t pipe_depth;    // buffers between reading and writing a file
+extern char *trace_file;       // where -T writes down every read
+extern short inode_columns;    // open with the inode table only as columns
+
+extern int prim_part;
+extern int sub_part;
+
+extern char *image_file;
+extern char **src_path;
+extern char *src_path_string;
+extern char **dst_path;
+extern char *dst_path_string;
+
+extern int path_arg_count;
+extern int destination_path_args;
+
+// the parsed command line lives in cmd_arena for the whole run. anything
+// only needed while one request (a listing, one filesystem, one entry)
+// is handled goes in request_arena, which the front end resets after it
+extern struct arena cmd_arena;
+extern struct arena request_arena;
 
 //functions
 int parse_cmd_line(int argc, char *argv[]);
 char **parse_path(char *string, int *path_count);
 
-void partition_info(FILE *fd);
-void check_partition_table(FILE *disk_image);
-void check_partition();
-
-void read_superblock(FILE *fd);
-void check_superblock();
-
-void read_store_inodes(FILE *fd);
-
-struct inode *find_inode_from_path(FILE *fd, struct inode *node, int);
-
-struct directory *read_entries_from_inode(FILE *fd, struct inode *node);
-
-void populate_dir(FILE *image, struct directory *dir, int location, int size);
-
-void read_full_file_data(FILE *image, struct inode *node, uint8_t *ptr);
-
-
-void initialize_flags();
-
-void handle_flag(char opt, char *optarg, char *argv[]);
-
-int determine_image_location(int argc, char *argv[], int flagCount);
-
-void process_paths(int argc, char *argv[], int imageLoc);
-
-
-int find_partition(FILE *disk_image, int partition_num, 
-                        int is_subpartition);
-void process_partition(FILE *disk_image, int partition_num, 
-                        int is_subpartition);
-
-void process_indirect_zones(FILE *disk_image, struct inode *inode,
-                            struct directory **curr_dir, int *bytes_left);
-
-void process_direct_zones(FILE *disk_image, struct inode *inode,
-                          struct directory **curr_dir, int *bytes_left);
-
-void read_zone_to_dir(FILE *disk_image, unsigned int zone_number,
-                      struct directory **curr_dir, int *bytes_left, 
-                      int zone_size);
-
-
-void read_direct_zone_data(FILE *disk_image, struct inode *node, 
-                           uint8_t *dst, int *bytes_left);
-
-void read_indirect_zone_data(FILE *disk_image, struct inode *node, 
-                             uint8_t *dst, int *bytes_left);
-
-void read_zone(FILE *disk_image, uint8_t *dst, int node_size, 
-               int bytes_left, int size, unsigned int zone);
+minfs_t *open_filesystem(void);
+minfs_t *open_filesystem_in(const char *file);
+void print_filesystem(minfs_t *fs);
+minfs_trace_t *open_trace(void);
+uint32_t lookup_src_path(minfs_t *fs);
+uint32_t resolve_src_path(minfs_t *fs);
 
+int option_takes_value(const char *arg);
 
 void write_to_output(uint8_t *data, size_t size, const char *output_path);
 
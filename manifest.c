@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "hash.h"
+#include "manifest.h"
+
+/*
+ * The manifest an extraction leaves behind, so the next run only has to
+ * touch what changed. It is a text file, a header and then a line per
+ * name:
+ *
+ *   # minget manifest 1 xxh64
+ *   ino mode mtime ctime size hash path
+ *
+ * mode is octal, hash is - when there is none, and path runs to the end
+ * of the line with any backslash or newline in it escaped, so names with
+ * spaces in them need nothing special.
+ */
+
+#define MANIFEST_MAGIC "# minget manifest 1"
+#define ENTRIES_START 256
+
+void manifest_init(struct manifest *m, int hash_algo) {
+    memset(m, 0, sizeof(struct manifest));
+    m->hash_algo = hash_algo;
+}
+
+static int by_path(const void *a, const void *b) {
+    return strcmp(((const struct manifest_entry *)a)->path,
+                  ((const struct manifest_entry *)b)->path);
+}
+
+//! the entry whose path is the first len characters of path, or -1
+static int32_t find_len(const struct manifest *m, const char *path,
+                        size_t len) {
+    int32_t lo = 0;
+    int32_t hi = m->count;
+    int32_t mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if ((cmp = strncmp(m->entries[mid].path, path, len)) == 0) {
+            cmp = m->entries[mid].path[len] != '\0';
+        }
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+//! the entry for path, or -1. only works on a loaded (sorted) manifest
+int32_t manifest_find(const struct manifest *m, const char *path) {
+    return find_len(m, path, strlen(path));
+}
+
+//! sorts the entries and hangs every one off its directory
+static void link_entries(struct manifest *m) {
+    const char *slash;
+    int32_t parent;
+    int32_t i;
+
+    qsort(m->entries, m->count, sizeof(struct manifest_entry), by_path);
+    for (i = 0; i < (int32_t)m->count; i++) {
+        m->entries[i].child = -1;
+        m->entries[i].sibling = -1;
+    }
+
+    // backwards so each directory ends up with its entries in order
+    for (i = m->count - 1; i >= 0; i--) {
+        if (!strcmp(m->entries[i].path, "/")) {
+            continue;
+        }
+        slash = strrchr(m->entries[i].path, '/');
+        parent = find_len(m, m->entries[i].path,
+                          slash == m->entries[i].path ? 1 :
+                          (size_t)(slash - m->entries[i].path));
+        if (parent >= 0) {
+            m->entries[i].sibling = m->entries[parent].child;
+            m->entries[parent].child = i;
+        }
+    }
+}
+
+//! adds a name (with the hash of its data, if there is one) and returns
+//! where it went
+
+int32_t manifest_add(struct manifest *m, const char *path, uint32_t ino,
+                     const struct inode *node, const char *hash) {
+    struct manifest_entry *e;
+
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : ENTRIES_START;
+        m->entries = realloc(m->entries,
+                             sizeof(struct manifest_entry) * m->cap);
+        if (!m->entries) {
+            perror("realloc");
+            exit(ERROR);
+        }
+    }
+
+    e = &m->entries[m->count];
+    memset(e, 0, sizeof(struct manifest_entry));
+    if ((e->path = strdup(path)) == NULL ||
+        (hash && (e->hash = strdup(hash)) == NULL)) {
+        perror("strdup");
+        exit(ERROR);
+    }
+    e->ino = ino;
+    e->mode = node->mode;
+    e->mtime = node->mtime;
+    e->ctime = node->ctime;
+    e->size = node->size;
+    e->child = -1;
+    e->sibling = -1;
+    return m->count++;
+}
+
+//! whether inode ino still looks the way it did when e was written
+int manifest_same(const struct manifest_entry *e, uint32_t ino,
+                  const struct inode *node) {
+    return e->ino == ino && e->mode == node->mode &&
+           e->mtime == node->mtime && e->ctime == node->ctime &&
+           e->size == node->size;
+}
+
+//! undoes the escaping of a path in place
+static void unescape(char *path) {
+    char *out = path;
+
+    for (; *path; path++) {
+        if (*path == '\\' && path[1]) {
+            path++;
+            *out++ = *path == 'n' ? '\n' : *path;
+        }
+        else {
+            *out++ = *path;
+        }
+    }
+    *out = '\0';
+}
+
+static void escape(FILE *out, const char *path) {
+    for (; *path; path++) {
+        if (*path == '\n') {
+            fputs("\\n", out);
+        }
+        else {
+            if (*path == '\\') {
+                fputc('\\', out);
+            }
+            fputc(*path, out);
+        }
+    }
+}
+
+//! whether path is one an extraction could have written: "/" or names
+//! after it, none of them empty, . or .. (which could lead out of the
+//! tree when a stale or edited manifest has things removed)
+
+static int path_ok(const char *path) {
+    size_t len;
+
+    if (*path != '/') {
+        return FALSE;
+    }
+    if (!strcmp(path, "/")) {
+        return TRUE;
+    }
+    for (path++;; path += len + 1) {
+        len = strcspn(path, "/");
+        if (len == 0 || (len == 1 && path[0] == '.') ||
+            (len == 2 && !strncmp(path, "..", 2))) {
+            return FALSE;
+        }
+        if (!path[len]) {
+            return TRUE;
+        }
+    }
+}
+
+//! reads a manifest in, or leaves m empty if there isnt one yet (the
+//! first run). a file that isnt a manifest, or has a path in it that
+//! isnt one, is MINFS_ECORRUPT
+
+int manifest_load(const char *file, struct manifest *m) {
+    char hash[HASH_HEX_MAX + 1];
+    char name[16];
+    unsigned int ino, mode, size;
+    int mtime, ctime;
+    struct inode node;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int used;
+    FILE *in;
+    int err = SUCCESS;
+
+    manifest_init(m, HASH_NONE);
+    if ((in = fopen(file, "r")) == NULL) {
+        return errno == ENOENT ? SUCCESS : -errno;
+    }
+
+    // the header says what the hashes are
+    if ((len = getline(&line, &cap, in)) < 0 ||
+        strncmp(line, MANIFEST_MAGIC, strlen(MANIFEST_MAGIC))) {
+        err = -MINFS_ECORRUPT;
+    }
+    else if (sscanf(line + strlen(MANIFEST_MAGIC), "%15s", name) == 1) {
+        m->hash_algo = hash_algo_from_name(name);
+    }
+
+    while (err == SUCCESS && (len = getline(&line, &cap, in)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (sscanf(line, "%u %o %d %d %u %65s %n", &ino, &mode, &mtime,
+                   &ctime, &size, hash, &used) < 6 || used >= len) {
+            err = -MINFS_ECORRUPT;
+            break;
+        }
+        unescape(line + used);
+        if (!path_ok(line + used)) {
+            err = -MINFS_ECORRUPT;
+            break;
+        }
+
+        // manifest_add takes an inode, so make one up from the line
+        memset(&node, 0, sizeof(node));
+        node.mode = mode;
+        node.mtime = mtime;
+        node.ctime = ctime;
+        node.size = size;
+        manifest_add(m, line + used, ino, &node,
+                     strcmp(hash, "-") ? hash : NULL);
+    }
+
+    free(line);
+    fclose(in);
+    if (err < 0) {
+        manifest_free(m);
+        return err;
+    }
+    link_entries(m);
+    return SUCCESS;
+}
+
+//! writes m out sorted by path. it goes to a new file that is renamed
+//! over the old one, so a run that dies halfway leaves the old manifest
+
+int manifest_save(const char *file, struct manifest *m) {
+    struct manifest_entry *e;
+    char *tmp;
+    FILE *out;
+    uint32_t i;
+    int err = SUCCESS;
+
+    if ((tmp = malloc(strlen(file) + 5)) == NULL) {
+        return -ENOMEM;
+    }
+    sprintf(tmp, "%s.new", file);
+    if ((out = fopen(tmp, "w")) == NULL) {
+        err = -errno;
+        free(tmp);
+        return err;
+    }
+
+    link_entries(m);
+    fprintf(out, "%s %s\n", MANIFEST_MAGIC,
+            m->hash_algo == HASH_NONE ? "-" : hash_algo_name(m->hash_algo));
+    for (i = 0; i < m->count; i++) {
+        e = &m->entries[i];
+        fprintf(out, "%u %o %d %d %u %s ", e->ino, e->mode, e->mtime,
+                e->ctime, e->size, e->hash ? e->hash : "-");
+        escape(out, e->path);
+        fputc('\n', out);
+    }
+
+    if (ferror(out)) {
+        err = -EIO;
+    }
+    if (fclose(out) < 0 && err == SUCCESS) {
+        err = -errno;
+    }
+    if (err == SUCCESS && rename(tmp, file) < 0) {
+        err = -errno;
+    }
+    if (err < 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return err;
+}
+
+void manifest_free(struct manifest *m) {
+    uint32_t i;
+
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].path);
+        free(m->entries[i].hash);
+    }
+    free(m->entries);
+    m->entries = NULL;
+    m->count = 0;
+    m->cap = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+#include "minfs.h"
+
+/* Structures */
+
+// one name in the extracted tree as it was when the manifest was written
+struct manifest_entry {
+    char *path;         // from the top of the tree, which is "/" itself
+    uint32_t ino;
+    uint16_t mode;
+    int32_t mtime;
+    int32_t ctime;
+    uint32_t size;
+    char *hash;         // NULL when it wasnt hashed
+    int32_t child;      // first entry in this directory, -1 for none
+    int32_t sibling;    // next entry in the same directory
+    int seen;           // still in the image this run
+};
+
+// everything one extraction made, sorted by path once it is loaded
+struct manifest {
+    struct manifest_entry *entries;
+    uint32_t count;
+    uint32_t cap;
+    int hash_algo;      // what the hashes in it are, HASH_NONE for none
+};
+
+//functions
+void manifest_init(struct manifest *m, int hash_algo);
+int manifest_load(const char *file, struct manifest *m);
+int manifest_save(const char *file, struct manifest *m);
+void manifest_free(struct manifest *m);
+
+int32_t manifest_add(struct manifest *m, const char *path, uint32_t ino,
+                     const struct inode *node, const char *hash);
+int32_t manifest_find(const struct manifest *m, const char *path);
+int manifest_same(const struct manifest_entry *e, uint32_t ino,
+                  const struct inode *node);
+
+#endif
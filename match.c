@@ -0,0 +1,71 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "match.h"
+
+//! finds every place one pattern starts in hay
+static void match_one(const uint8_t *hay, size_t len,
+                      const struct pattern *pat, int which, match_fn fn,
+                      void *arg)
+{
+    const uint8_t *needle = pat->bytes;
+    size_t m = pat->len;
+    // the middle, the first and last bytes are already checked
+    size_t mid = m > 2 ? m - 2 : 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i first;
+    __m128i last;
+    __m128i a;
+    __m128i b;
+    unsigned mask;
+    int bit;
+#endif
+
+    if (m == 0 || m > len) {
+        return;
+    }
+
+#ifdef __SSE2__
+    first = _mm_set1_epi8(needle[0]);
+    last = _mm_set1_epi8(needle[m - 1]);
+
+    // 16 starting places at a time, as long as all 16 fit
+    for (; i + m - 1 + 16 <= len; i += 16) {
+        a = _mm_loadu_si128((const __m128i *)(hay + i));
+        b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                               _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            bit = __builtin_ctz(mask);
+            if (!memcmp(hay + i + bit + 1, needle + 1, mid)) {
+                fn(i + bit, which, arg);
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // whatever is left over (or everything without SSE2)
+    for (; i + m <= len; i++) {
+        if (hay[i] == needle[0] && hay[i + m - 1] == needle[m - 1] &&
+            !memcmp(hay + i + 1, needle + 1, mid)) {
+            fn(i, which, arg);
+        }
+    }
+}
+
+//! hands fn every place any of the patterns starts in hay, pattern by
+//! pattern (so not in order of where they are)
+
+void match_all(const uint8_t *hay, size_t len, const struct pattern *pats,
+               int npats, match_fn fn, void *arg)
+{
+    int i;
+
+    for (i = 0; i < npats; i++) {
+        match_one(hay, len, &pats[i], i, fn, arg);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed string search for mingrep. Each pattern is found with the SIMD
+ * first and last byte filter: 16 positions at a time are checked for the
+ * patterns first byte at i and its last byte at i + len - 1, and only the
+ * positions where both line up get a memcmp. On real data that skips
+ * almost everything without looking at it twice.
+ */
+
+//macros
+#define MATCH_MAX_LEN 255 // longer patterns could straddle more than 2 zones
+
+/* Structures */
+struct pattern {
+    const uint8_t *bytes;
+    size_t len;
+};
+
+// gets where a pattern (by index) starts in the buffer searched
+typedef void (*match_fn)(size_t at, int which, void *arg);
+
+//functions
+void match_all(const uint8_t *hay, size_t len, const struct pattern *pats,
+               int npats, match_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,707 @@
+#define _GNU_SOURCE // for memfd_create
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "minfunc.h"
+#include "minfs.h"
+#include "print.h"
+#include "helper.h"
+#include "arena.h"
+
+/*
+ * What the library routines each cost on their own, as opposed to what a
+ * whole minget or minls run takes. Every routine runs against images
+ * built in memory (one with 1K zones and one with 4K, so the readers
+ * specialised for each get measured), over and over until it has run
+ * for long enough to time, and gets:
+ *
+ *   ns/op, bytes of the image it went through and mallocs, per call
+ *   cycles, instructions, cache misses and branch misses per call, from
+ *   perf_event_open, when the kernel lets us have them
+ *
+ * -j prints it all as JSON with the same keys every time (null for a
+ * counter that wasnt there) so runs can be kept and compared.
+ *
+ * mallocs are counted by having our own malloc in front of glibcs, so
+ * this only counts on glibc.
+ */
+
+#define MIN_TIME_MS 200     // each routine runs at least this long
+#define NINODES 4096
+#define BIG_SIZE (8 << 20)  // goes well into the double indirect zones
+#define MANY_ENTRIES 2000   // a directory past its direct zones
+#define SMALL_FILES 62      // in the root next to everything else
+#define SMALL_SIZE 100
+#define PREAD_LEN 64
+#define DEEP_PATH "/d1/d2/d3/d4/target"
+#define NCOUNTERS 4
+#define NGEOMETRIES 2
+
+/* Structures */
+
+// an image being made, straight into the memory the memfd has
+struct synth {
+    uint8_t *img;
+    size_t size;
+    uint32_t zonesize;
+    uint32_t per_table;
+    uint32_t next_zone;
+    uint32_t next_ino;
+    struct inode *inodes;
+};
+
+// one geometry, built and opened
+struct bench_image {
+    const char *name;
+    uint32_t blocksize;
+    minfs_t *fs;
+    int fd;
+    uint32_t many;      // the big directory
+    uint32_t big;       // the big file
+    uint32_t target;    // the file at the end of DEEP_PATH
+};
+
+typedef void (*bench_fn)(struct bench_image *image, uint64_t i);
+
+// one routine, and what it goes through in the image each call
+struct bench {
+    const char *name;
+    bench_fn fn;
+    uint64_t (*bytes)(struct bench_image *image);
+};
+
+// what one run of a routine came to
+struct bench_result {
+    uint64_t iterations;
+    double ns;
+    uint64_t allocs;
+    uint64_t counts[NCOUNTERS];
+    int have[NCOUNTERS];
+};
+
+static const struct {
+    const char *name;
+    uint64_t config;
+} counters[NCOUNTERS] = {
+    { "cycles", PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache_misses", PERF_COUNT_HW_CACHE_MISSES },
+    { "branch_misses", PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int counter_fd[NCOUNTERS];
+static uint64_t allocs;
+static volatile uint64_t sink;  // so nothing a routine does is optimised out
+
+/* malloc counting */
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+/* Building the images */
+
+static uint32_t synth_zone(struct synth *st) {
+    if ((uint64_t)(st->next_zone + 1) * st->zonesize > st->size) {
+        fprintf(stderr, "synthetic image is too small\n");
+        exit(ERROR);
+    }
+    return st->next_zone++;
+}
+
+static uint32_t *synth_table(struct synth *st, uint32_t zone) {
+    return (uint32_t *)(st->img + (uint64_t)zone * st->zonesize);
+}
+
+static uint32_t synth_inode(struct synth *st, uint16_t mode) {
+    struct inode *node = &st->inodes[st->next_ino - 1];
+
+    node->mode = mode;
+    node->links = 1;
+    node->mtime = node->ctime = node->atime = 1700000000;
+    return st->next_ino++;
+}
+
+//! gives inode ino size bytes in freshly handed out zones, copied from
+//! data or filled with a pattern if data is NULL
+
+static void synth_write(struct synth *st, uint32_t ino, const uint8_t *data,
+                        uint32_t size) {
+    struct inode *node = &st->inodes[ino - 1];
+    uint32_t nzones = (size + st->zonesize - 1) / st->zonesize;
+    uint32_t zone;
+    uint32_t idx;
+    uint32_t k;
+    uint32_t len;
+    uint32_t *dind;
+
+    node->size = size;
+    for (k = 0; k < nzones; k++) {
+        zone = synth_zone(st);
+        len = MIN(st->zonesize, size - k * st->zonesize);
+        if (data) {
+            memcpy(st->img + (uint64_t)zone * st->zonesize,
+                   data + (uint64_t)k * st->zonesize, len);
+        }
+        else {
+            memset(st->img + (uint64_t)zone * st->zonesize, k & 0xFF, len);
+        }
+
+        // and hang it off the inode wherever zone k goes
+        if (k < DIRECT_ZONES) {
+            node->zone[k] = zone;
+            continue;
+        }
+        idx = k - DIRECT_ZONES;
+        if (idx < st->per_table) {
+            if (!node->indirect) {
+                node->indirect = synth_zone(st);
+            }
+            synth_table(st, node->indirect)[idx] = zone;
+            continue;
+        }
+        idx -= st->per_table;
+        if (!node->two_indirect) {
+            node->two_indirect = synth_zone(st);
+        }
+        dind = synth_table(st, node->two_indirect);
+        if (!dind[idx / st->per_table]) {
+            dind[idx / st->per_table] = synth_zone(st);
+        }
+        synth_table(st, dind[idx / st->per_table])[idx % st->per_table] =
+            zone;
+    }
+}
+
+static void synth_entry(struct directory *entries, uint32_t *count,
+                        uint32_t ino, const char *name) {
+    entries[*count].inode = ino;
+    strncpy((char *)entries[*count].name, name, DIR_NAME_SIZE);
+    (*count)++;
+}
+
+//! a directory in parent (0 for its own ..) holding the one entry child
+static uint32_t synth_dir(struct synth *st, uint32_t parent,
+                          uint32_t child, const char *name) {
+    struct directory entries[3];
+    uint32_t ino = synth_inode(st, MASK_DIR | 0755);
+    uint32_t count = 0;
+
+    memset(entries, 0, sizeof(entries));
+    synth_entry(entries, &count, ino, ".");
+    synth_entry(entries, &count, parent ? parent : ino, "..");
+    if (child) {
+        synth_entry(entries, &count, child, name);
+    }
+    synth_write(st, ino, (uint8_t *)entries,
+                count * sizeof(struct directory));
+    return ino;
+}
+
+//! builds the image for one geometry into a memfd and opens it
+static void build_image(struct bench_image *image) {
+    struct superblock *sb;
+    struct directory *entries;
+    struct synth st;
+    char name[DIR_NAME_SIZE];
+    char path[32];
+    uint32_t table_blocks;
+    uint32_t small;
+    uint32_t count = 0;
+    uint32_t dir;
+    uint32_t ino;
+    uint32_t i;
+    int err;
+
+    memset(&st, 0, sizeof(st));
+    st.zonesize = image->blocksize;
+    st.per_table = st.zonesize / IZT_ENTRY_SIZE;
+    table_blocks = (NINODES * sizeof(struct inode) + image->blocksize - 1) /
+                   image->blocksize;
+    st.size = BIG_SIZE + (4 << 20) + (uint64_t)(4 + table_blocks) *
+              image->blocksize;
+
+    if ((image->fd = memfd_create(image->name, 0)) < 0 ||
+        ftruncate(image->fd, st.size) < 0 ||
+        (st.img = mmap(NULL, st.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       image->fd, 0)) == MAP_FAILED) {
+        perror("memfd");
+        exit(ERROR);
+    }
+
+    sb = (struct superblock *)(st.img + BLOCK_SIZE);
+    sb->ninodes = NINODES;
+    sb->i_blocks = 1;
+    sb->z_blocks = 1;
+    sb->firstdata = 4 + table_blocks;
+    sb->log_zone_size = 0;
+    sb->max_file = UINT32_MAX;
+    sb->zones = st.size / image->blocksize;
+    sb->magic = SUPERBLOCK_MAGIC;
+    sb->blocksize = image->blocksize;
+    st.inodes = (struct inode *)(st.img + 4 * image->blocksize);
+    st.next_zone = sb->firstdata;
+    st.next_ino = ROOT_INODE + 1;
+
+    // the root is filled in last, once everything in it has an inode
+    st.inodes[ROOT_INODE - 1].mode = MASK_DIR | 0755;
+    st.inodes[ROOT_INODE - 1].links = 1;
+
+    image->target = synth_inode(&st, REGULAR_FILE | 0644);
+    synth_write(&st, image->target, NULL, SMALL_SIZE);
+    // DEEP_PATH from the bottom up, lookup never looks at ..
+    dir = synth_dir(&st, 0, image->target, "target");
+    dir = synth_dir(&st, 0, dir, "d4");
+    dir = synth_dir(&st, 0, dir, "d3");
+    dir = synth_dir(&st, ROOT_INODE, dir, "d2");
+
+    image->big = synth_inode(&st, REGULAR_FILE | 0644);
+    synth_write(&st, image->big, NULL, BIG_SIZE);
+
+    // every name in the big directory is a link to the same small file
+    small = synth_inode(&st, REGULAR_FILE | 0644);
+    synth_write(&st, small, NULL, SMALL_SIZE);
+    if ((entries = calloc(MANY_ENTRIES + SMALL_FILES + 8,
+                          sizeof(struct directory))) == NULL) {
+        perror("calloc");
+        exit(ERROR);
+    }
+    image->many = synth_inode(&st, MASK_DIR | 0755);
+    synth_entry(entries, &count, image->many, ".");
+    synth_entry(entries, &count, ROOT_INODE, "..");
+    for (i = 0; i < MANY_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "entry-%04u", i);
+        synth_entry(entries, &count, small, name);
+    }
+    synth_write(&st, image->many, (uint8_t *)entries,
+                count * sizeof(struct directory));
+
+    count = 0;
+    synth_entry(entries, &count, ROOT_INODE, ".");
+    synth_entry(entries, &count, ROOT_INODE, "..");
+    synth_entry(entries, &count, dir, "d1");
+    synth_entry(entries, &count, image->many, "many");
+    synth_entry(entries, &count, image->big, "big");
+    for (i = 0; i < SMALL_FILES; i++) {
+        snprintf(name, sizeof(name), "file%u", i);
+        synth_entry(entries, &count, synth_inode(&st, REGULAR_FILE | 0644),
+                    name);
+        synth_write(&st, st.next_ino - 1, NULL, SMALL_SIZE);
+    }
+    synth_write(&st, ROOT_INODE, (uint8_t *)entries,
+                count * sizeof(struct directory));
+    free(entries);
+    munmap(st.img, st.size);
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", image->fd);
+    if ((image->fs = minfs_open(path, NULL, &err)) == NULL) {
+        fprintf(stderr, "%s: %s\n", image->name, minfs_strerror(err));
+        exit(ERROR);
+    }
+
+    // timing a lookup that fails would be timing the wrong thing
+    if ((err = minfs_lookup(image->fs, DEEP_PATH, &ino)) < 0 ||
+        ino != image->target) {
+        fprintf(stderr, "%s: %s: built wrong\n", image->name, DEEP_PATH);
+        exit(ERROR);
+    }
+}
+
+/* The routines */
+
+static int count_entry(const struct minfs_dirent *ent, void *arg) {
+    (*(uint64_t *)arg)++;
+    return SUCCESS;
+}
+
+static int first_byte(const uint8_t *data, size_t len, uint64_t off,
+                      uint32_t zone, void *arg) {
+    if (data) {
+        *(uint64_t *)arg += data[0];
+    }
+    return SUCCESS;
+}
+
+static void bench_lookup(struct bench_image *image, uint64_t i) {
+    uint32_t ino;
+
+    minfs_lookup(image->fs, DEEP_PATH, &ino);
+    sink += ino;
+}
+
+static void bench_readdir(struct bench_image *image, uint64_t i) {
+    uint64_t count = 0;
+
+    minfs_readdir(image->fs, image->many, count_entry, &count);
+    sink += count;
+}
+
+static void bench_read_zones(struct bench_image *image, uint64_t i) {
+    uint64_t sum = 0;
+
+    minfs_read_zones(image->fs, image->big, first_byte, &sum);
+    sink += sum;
+}
+
+//! small reads all over one part of the big file, so the cost is finding
+//! the zone (the indirect tables) more than copying it
+
+static void pread_in(struct bench_image *image, uint64_t i, uint64_t from,
+                     uint64_t to) {
+    uint8_t buf[PREAD_LEN];
+    uint64_t span = to - from - PREAD_LEN;
+
+    minfs_pread(image->fs, image->big, buf, PREAD_LEN,
+                from + (i * 40503) % span);
+    sink += buf[0];
+}
+
+static uint64_t indirect_start(struct bench_image *image) {
+    return (uint64_t)DIRECT_ZONES * image->blocksize;
+}
+
+static uint64_t double_start(struct bench_image *image) {
+    return indirect_start(image) +
+           (uint64_t)image->blocksize / IZT_ENTRY_SIZE * image->blocksize;
+}
+
+static void bench_pread_direct(struct bench_image *image, uint64_t i) {
+    pread_in(image, i, 0, indirect_start(image));
+}
+
+static void bench_pread_indirect(struct bench_image *image, uint64_t i) {
+    pread_in(image, i, indirect_start(image), double_start(image));
+}
+
+static void bench_pread_double(struct bench_image *image, uint64_t i) {
+    pread_in(image, i, double_start(image), BIG_SIZE);
+}
+
+static void bench_get_mode(struct bench_image *image, uint64_t i) {
+    sink += get_mode(i & 1 ? MASK_DIR | 0755 : REGULAR_FILE | 0644)[0];
+    arena_reset(&request_arena);
+}
+
+static void bench_print_file(struct bench_image *image, uint64_t i) {
+    print_file(minfs_inode(image->fs, image->target), "target");
+    arena_reset(&request_arena);
+}
+
+static uint64_t no_bytes(struct bench_image *image) {
+    return 0;
+}
+
+static uint64_t dir_bytes(struct bench_image *image) {
+    return minfs_inode(image->fs, image->many)->size;
+}
+
+static uint64_t big_bytes(struct bench_image *image) {
+    return BIG_SIZE;
+}
+
+static uint64_t pread_bytes(struct bench_image *image) {
+    return PREAD_LEN;
+}
+
+static const struct bench benches[] = {
+    { "lookup", bench_lookup, no_bytes },
+    { "readdir", bench_readdir, dir_bytes },
+    { "read_zones", bench_read_zones, big_bytes },
+    { "pread_direct", bench_pread_direct, pread_bytes },
+    { "pread_indirect", bench_pread_indirect, pread_bytes },
+    { "pread_double", bench_pread_double, pread_bytes },
+    { "get_mode", bench_get_mode, no_bytes },
+    { "print_file", bench_print_file, no_bytes },
+};
+
+/* Counting and timing */
+
+//! opens each counter on its own so a kernel (or a vm) that only has some
+//! of them still gives those. the ones it wont give stay at -1
+
+static void counters_open(void) {
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = counters[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counter_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void counters_switch(int on) {
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        if (counter_fd[i] >= 0) {
+            ioctl(counter_fd[i], on ? PERF_EVENT_IOC_ENABLE :
+                  PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+static double elapsed_ns(const struct timespec *t0,
+                         const struct timespec *t1) {
+    return (t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+//! runs fn n times and times it, counting mallocs and (if count) the
+//! hardware counters too
+
+static void run_bench(const struct bench *b, struct bench_image *image,
+                      uint64_t n, int count, struct bench_result *res) {
+    struct timespec t0, t1;
+    uint64_t start = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    uint64_t i;
+    int k;
+
+    if (count) {
+        for (k = 0; k < NCOUNTERS; k++) {
+            if (counter_fd[k] >= 0) {
+                ioctl(counter_fd[k], PERF_EVENT_IOC_RESET, 0);
+            }
+        }
+        counters_switch(TRUE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n; i++) {
+        b->fn(image, i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (count) {
+        counters_switch(FALSE);
+    }
+
+    res->iterations = n;
+    res->ns = elapsed_ns(&t0, &t1);
+    res->allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - start;
+    for (k = 0; k < NCOUNTERS && count; k++) {
+        res->have[k] = counter_fd[k] >= 0 &&
+                       read(counter_fd[k], &res->counts[k],
+                            sizeof(uint64_t)) == sizeof(uint64_t);
+    }
+}
+
+//! doubles the calls until they take a while, then does the real run
+//! long enough to take min_ms
+
+static void measure(const struct bench *b, struct bench_image *image,
+                    uint32_t min_ms, struct bench_result *res) {
+    uint64_t n = 1;
+
+    // the first call grows whatever arenas and caches it needs
+    b->fn(image, 0);
+    for (;;) {
+        run_bench(b, image, n, FALSE, res);
+        if (res->ns * 8 >= min_ms * 1e6 || n >= UINT64_MAX / 2) {
+            break;
+        }
+        n *= 2;
+    }
+    n = MAX(n, (uint64_t)(n * (min_ms * 1e6 / MAX(res->ns, 1.0))));
+    memset(res, 0, sizeof(*res));
+    run_bench(b, image, n, TRUE, res);
+}
+
+/* Output */
+
+static void print_text(FILE *out, const struct bench *b,
+                       struct bench_image *image,
+                       const struct bench_result *res) {
+    int k;
+
+    fprintf(out, "%-15s %-3s %10llu %11.1f %9llu %8.3f",
+            b->name, image->name, (unsigned long long)res->iterations,
+            res->ns / res->iterations,
+            (unsigned long long)b->bytes(image),
+            (double)res->allocs / res->iterations);
+    for (k = 0; k < NCOUNTERS; k++) {
+        if (res->have[k]) {
+            fprintf(out, " %13.1f",
+                    (double)res->counts[k] / res->iterations);
+        }
+        else {
+            fprintf(out, " %13s", "-");
+        }
+    }
+    fputc('\n', out);
+}
+
+static void print_json(FILE *out, const struct bench *b,
+                       struct bench_image *image,
+                       const struct bench_result *res, int first) {
+    int k;
+
+    fprintf(out, "%s    {\"name\": \"%s\", \"geometry\": \"%s\", "
+            "\"iterations\": %llu, \"ns_per_op\": %.2f, "
+            "\"bytes_per_op\": %llu, \"allocs_per_op\": %.4f",
+            first ? "" : ",\n", b->name, image->name,
+            (unsigned long long)res->iterations,
+            res->ns / res->iterations,
+            (unsigned long long)b->bytes(image),
+            (double)res->allocs / res->iterations);
+    for (k = 0; k < NCOUNTERS; k++) {
+        if (res->have[k]) {
+            fprintf(out, ", \"%s_per_op\": %.2f", counters[k].name,
+                    (double)res->counts[k] / res->iterations);
+        }
+        else {
+            fprintf(out, ", \"%s_per_op\": null", counters[k].name);
+        }
+    }
+    fputc('}', out);
+}
+
+//! whether a routine was asked for, by the start of its name
+static int wanted(const char *name, int argc, char *argv[], int from) {
+    int i;
+
+    if (from >= argc) {
+        return TRUE;
+    }
+    for (i = from; i < argc; i++) {
+        if (!strncmp(name, argv[i], strlen(argv[i]))) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_image images[NGEOMETRIES] = {
+        { "1k", 1024 }, { "4k", 4096 },
+    };
+    struct bench_result res;
+    uint32_t min_ms = MIN_TIME_MS;
+    int json = FALSE;
+    int first = TRUE;
+    FILE *out;
+    size_t i;
+    int g;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jt:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                json = TRUE;
+                break;
+            case 't':
+                if (atoi(optarg) < 1)
+                {
+                    fprintf(stderr, "-t wants milliseconds above 0\n");
+                    exit(ERROR);
+                }
+                min_ms = atoi(optarg);
+                break;
+            default:
+                print_usage(argv);
+                exit(opt == 'h' ? SUCCESS : ERROR);
+        }
+    }
+
+    // print_file writes to stdout, so the results go out on a copy of it
+    // and stdout itself goes nowhere
+    if ((out = fdopen(dup(STDOUT_FILENO), "w")) == NULL ||
+        freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("stdout");
+        exit(ERROR);
+    }
+
+    for (g = 0; g < NGEOMETRIES; g++)
+    {
+        build_image(&images[g]);
+    }
+    counters_open();
+
+    if (json)
+    {
+        fprintf(out, "{\n  \"tool\": \"minbench\",\n  \"version\": 1,\n"
+                "  \"min_time_ms\": %u,\n  \"results\": [\n", min_ms);
+    }
+    else
+    {
+        fprintf(out, "%-15s %-3s %10s %11s %9s %8s", "routine", "geo",
+                "calls", "ns/op", "bytes/op", "allocs");
+        for (g = 0; g < NCOUNTERS; g++)
+        {
+            fprintf(out, " %13s", counters[g].name);
+        }
+        fputc('\n', out);
+    }
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        if (!wanted(benches[i].name, argc, argv, optind))
+        {
+            continue;
+        }
+        for (g = 0; g < NGEOMETRIES; g++)
+        {
+            measure(&benches[i], &images[g], min_ms, &res);
+            if (json)
+            {
+                print_json(out, &benches[i], &images[g], &res, first);
+            }
+            else
+            {
+                print_text(out, &benches[i], &images[g], &res);
+            }
+            first = FALSE;
+            fflush(out);
+        }
+    }
+
+    if (json)
+    {
+        fprintf(out, "\n  ]\n}\n");
+    }
+
+    for (g = 0; g < NGEOMETRIES; g++)
+    {
+        minfs_close(images[g].fs);
+        close(images[g].fd);
+    }
+    for (g = 0; g < NCOUNTERS; g++)
+    {
+        if (counter_fd[g] >= 0)
+        {
+            close(counter_fd[g]);
+        }
+    }
+    fclose(out);
+    return SUCCESS;
+}
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+#include "extract.h"
+#include "pool.h"
+
+/*
+ * One question asked of a whole list of images: which of them have a
+ * path, what is in a directory on each, or get it out of all of them.
+ * Every image is its own job on the pool, opened, asked and closed again,
+ * so only as many are open at once as there are threads. Compressed
+ * images all decompress through one shared frame cache (-M), which is
+ * the only thing that grows with how much gets read, and it doesnt grow
+ * past its limit.
+ *
+ * Every line of output starts with the image it is about, the way -a
+ * tags lines with the partition.
+ */
+
+#define CMD_LOOKUP 0
+#define CMD_LS 1
+#define CMD_GET 2
+#define IMAGES_START 64
+#define MODE_LEN 11
+#define SUFFIX_LEN 12   // room for the .N a repeated image name gets
+
+/* Structures */
+
+struct catalog;
+
+// one image out of the list
+struct catalog_image {
+    char *path;             // as the list has it, output is tagged with it
+    char *name;             // its own directory under dstdir for get
+    struct catalog *cat;
+};
+
+// what every job shares
+struct catalog {
+    struct catalog_image *images;
+    uint32_t count;
+    uint32_t cap;
+    int command;
+    const char *path;       // what is being looked for, "/" for the root
+    minfs_cache_t *cache;
+    minfs_trace_t *trace;   // with -T, every image is its own fs in it
+    uint64_t found;         // images the path is in, atomic
+    uint64_t failed;        // images that couldnt be opened or read, atomic
+};
+
+// what listing one directory needs for each entry
+struct catalog_ls {
+    minfs_t *fs;
+    const struct catalog_image *image;
+};
+
+//! prints one line tagged with the image it is about, all at once so
+//! lines about different images dont get mixed up
+
+static void tagged(const struct catalog_image *image, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    flockfile(stdout);
+    printf("%s: ", image->path);
+    vprintf(fmt, ap);
+    putchar('\n');
+    funlockfile(stdout);
+    va_end(ap);
+}
+
+//! one line on stderr about an image, for when something went wrong
+static void complain(struct catalog_image *image, int err) {
+    fprintf(stderr, "%s: %s: %s\n", image->path, image->cat->path,
+            minfs_strerror(err));
+    __atomic_add_fetch(&image->cat->failed, 1, __ATOMIC_RELAXED);
+}
+
+static int ls_entry(const struct minfs_dirent *ent, void *arg) {
+    struct catalog_ls *ls = arg;
+    const struct inode *node = minfs_inode(ls->fs, ent->ino);
+    char mode[MODE_LEN];
+
+    if (!node) {
+        fprintf(stderr, "%s: %s: bad inode %u\n", ls->image->path,
+                ent->name, ent->ino);
+        return SUCCESS;
+    }
+    format_mode(node->mode, mode);
+    tagged(ls->image, "%-10s  %8d %s", mode, node->size, ent->name);
+    return SUCCESS;
+}
+
+//! gets the path out of one image into dstdir/name
+static int get_from(struct catalog_image *image, minfs_t *fs, uint32_t ino) {
+    const struct inode *node = minfs_inode(fs, ino);
+    struct extract_stats stats;
+    const char *base;
+    char *dst;
+    char *host;
+    int err;
+
+    if ((dst = malloc(strlen(dst_path_string) + strlen(image->name) +
+                      2)) == NULL) {
+        return -ENOMEM;
+    }
+    sprintf(dst, "%s/%s", dst_path_string, image->name);
+
+    if ((node->mode & FILE_TYPE) == MASK_DIR) {
+        err = extract_tree(fs, ino, dst, &stats);
+        free(dst);
+        if (err == SUCCESS) {
+            tagged(image, "%llu files, %llu bytes", (unsigned long long)
+                   stats.files, (unsigned long long)stats.bytes);
+        }
+        return err;
+    }
+
+    // a single file goes in the images directory under its own name
+    base = strrchr(image->cat->path, '/');
+    base = base ? base + 1 : image->cat->path;
+    if (mkdir(dst, S_IRWXU | S_IRWXG | S_IRWXO) < 0 && errno != EEXIST) {
+        err = -errno;
+        free(dst);
+        return err;
+    }
+    if ((host = malloc(strlen(dst) + strlen(base) + 2)) == NULL) {
+        free(dst);
+        return -ENOMEM;
+    }
+    sprintf(host, "%s/%s", dst, base);
+
+    if ((err = extract_one(fs, ino, host, &stats)) == SUCCESS) {
+        tagged(image, "%s", host);
+    }
+    free(host);
+    free(dst);
+    return err;
+}
+
+//! the job for one image: open it, ask it, close it
+static void catalog_image(void *arg) {
+    struct catalog_image *image = arg;
+    struct catalog *cat = image->cat;
+    struct minfs_opts opts;
+    struct catalog_ls ls;
+    const struct inode *node;
+    char mode[MODE_LEN];
+    minfs_t *fs;
+    uint32_t ino;
+    int err;
+
+    minfs_default_opts(&opts);
+    if (p_flag) {
+        opts.part = prim_part;
+    }
+    if (s_flag) {
+        opts.subpart = sub_part;
+    }
+    opts.direct = d_flag;
+    opts.drop_behind = e_flag;
+    opts.cache = cat->cache;
+    opts.trace = cat->trace;
+
+    if ((fs = minfs_open(image->path, &opts, &err)) == NULL) {
+        fprintf(stderr, "%s: %s\n", image->path, minfs_strerror(err));
+        __atomic_add_fetch(&cat->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // lookup is about the name itself, the others about what it leads to
+    err = cat->command == CMD_LOOKUP ? minfs_lookup(fs, cat->path, &ino) :
+          minfs_resolve(fs, cat->path, &ino);
+    if (err == -ENOENT || err == -ENOTDIR) {
+        // not having the path is an answer, not a failure
+        minfs_close(fs);
+        return;
+    }
+    if (err < 0) {
+        complain(image, err);
+        minfs_close(fs);
+        return;
+    }
+    __atomic_add_fetch(&cat->found, 1, __ATOMIC_RELAXED);
+    node = minfs_inode(fs, ino);
+
+    if (cat->command == CMD_LOOKUP ||
+        (cat->command == CMD_LS && (node->mode & FILE_TYPE) != MASK_DIR)) {
+        format_mode(node->mode, mode);
+        tagged(image, "%-10s  %8d %s", mode, node->size, cat->path);
+    }
+    else if (cat->command == CMD_LS) {
+        ls.fs = fs;
+        ls.image = image;
+        if ((err = minfs_readdir(fs, ino, ls_entry, &ls)) < 0) {
+            complain(image, err);
+        }
+    }
+    else if ((err = get_from(image, fs, ino)) < 0) {
+        complain(image, err);
+    }
+
+    minfs_close(fs);
+}
+
+//! reads the list of images, one path a line. blank lines and ones
+//! starting with # are skipped, and - is stdin
+
+static void read_list(struct catalog *cat, const char *list) {
+    FILE *in = strcmp(list, "-") ? fopen(list, "r") : stdin;
+    struct catalog_image *image;
+    const char *base;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    uint32_t i;
+    uint32_t k;
+
+    if (!in) {
+        perror(list);
+        exit(ERROR);
+    }
+
+    while ((len = getline(&line, &cap, in)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (!len || line[0] == '#') {
+            continue;
+        }
+
+        if (cat->count == cat->cap) {
+            cat->cap = cat->cap ? cat->cap * 2 : IMAGES_START;
+            cat->images = realloc(cat->images,
+                                  sizeof(struct catalog_image) * cat->cap);
+            if (!cat->images) {
+                perror("realloc");
+                exit(ERROR);
+            }
+        }
+        image = &cat->images[cat->count++];
+        image->cat = cat;
+        if ((image->path = strdup(line)) == NULL ||
+            (image->name = malloc(len + SUFFIX_LEN)) == NULL) {
+            perror("malloc");
+            exit(ERROR);
+        }
+        base = strrchr(line, '/');
+        strcpy(image->name, base ? base + 1 : line);
+    }
+    free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    // images with the same file name in different places each get their
+    // own directory for get
+    for (i = 0; i < cat->count; i++) {
+        for (k = 0; k < i; k++) {
+            if (!strcmp(cat->images[i].name, cat->images[k].name)) {
+                sprintf(cat->images[i].name + strlen(cat->images[i].name),
+                        ".%u", i);
+                break;
+            }
+        }
+    }
+}
+
+static int command_from_name(const char *name) {
+    if (!strcmp(name, "lookup")) {
+        return CMD_LOOKUP;
+    }
+    if (!strcmp(name, "ls")) {
+        return CMD_LS;
+    }
+    if (!strcmp(name, "get")) {
+        return CMD_GET;
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct catalog cat;
+    struct minfs_cache_stats cs;
+    struct pool *pool;
+    int command_at;
+    uint32_t i;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    // the command comes first, take it out before getopt sees it so the
+    // list and path are where parse_cmd_line expects the image and path
+    for (command_at = 1; command_at < argc; command_at++)
+    {
+        if (argv[command_at][0] != '-')
+        {
+            break;
+        }
+        if (option_takes_value(argv[command_at]))
+        {
+            command_at++;
+        }
+    }
+    if (command_at >= argc)
+    {
+        print_usage(argv);
+        exit(ERROR);
+    }
+
+    memset(&cat, 0, sizeof(cat));
+    if ((cat.command = command_from_name(argv[command_at])) < 0)
+    {
+        fprintf(stderr, "Unknown command '%s' (lookup, ls, get)\n",
+                argv[command_at]);
+        exit(ERROR);
+    }
+    for (i = command_at; i < (uint32_t)argc - 1; i++)
+    {
+        argv[i] = argv[i + 1];
+    }
+    parse_cmd_line(argc - 1, argv);
+
+    cat.path = path_arg_count ? src_path_string : "/";
+    if (cat.command == CMD_GET && !destination_path_args)
+    {
+        fprintf(stderr, "get needs a dstdir\n");
+        exit(ERROR);
+    }
+    if (cat.command == CMD_GET &&
+        mkdir(dst_path_string, S_IRWXU | S_IRWXG | S_IRWXO) < 0 &&
+        errno != EEXIST)
+    {
+        perror(dst_path_string);
+        exit(ERROR);
+    }
+
+    read_list(&cat, image_file);
+    cat.trace = open_trace();
+    if ((cat.cache = minfs_cache_create(cache_limit)) == NULL)
+    {
+        perror("malloc");
+        exit(ERROR);
+    }
+
+    pool = pool_create(jobs);
+    for (i = 0; i < cat.count; i++)
+    {
+        pool_submit(pool, catalog_image, &cat.images[i]);
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+
+    if (v_flag)
+    {
+        minfs_cache_stats(cat.cache, &cs);
+        fprintf(stderr, "%u images, %llu with %s, %llu failed\n",
+                cat.count, (unsigned long long)cat.found, cat.path,
+                (unsigned long long)cat.failed);
+        fprintf(stderr, "frame cache: %llu hits, %llu misses, "
+                "%llu evictions, at most %llu bytes of %zu held\n",
+                (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+                (unsigned long long)cs.evictions,
+                (unsigned long long)cs.peak, cache_limit);
+    }
+
+    minfs_cache_free(cat.cache);
+    for (i = 0; i < cat.count; i++)
+    {
+        free(cat.images[i].path);
+        free(cat.images[i].name);
+    }
+    free(cat.images);
+
+    // like grep, finding nothing anywhere is a failure too
+    if (cat.failed || !cat.found)
+    {
+        return ERROR;
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+#include "hash.h"
+
+// what main returns when the trees are not the same, like diff
+#define DIFFERENT 1
+
+// one name in a directory, collected so both sides can be merged by name
+struct diff_entry {
+    uint32_t ino;
+    char name[DIR_NAME_SIZE + 1];
+};
+
+struct diff_dir {
+    struct diff_entry *ents;
+    size_t count;
+    size_t cap;
+};
+
+// the two filesystems being compared, a is the old one and b the new one
+static minfs_t *fs_a;
+static minfs_t *fs_b;
+
+// by inode, the directories on each side already gone into
+static uint8_t *seen_a;
+static uint8_t *seen_b;
+
+// how much work the compare did, printed for -v
+static unsigned long compared;
+static unsigned long hashed;
+static uint64_t hashed_bytes;
+static unsigned long differences;
+
+//! prints one difference, with why it is different for -v
+static void report(char kind, const char *path, const char *why) {
+    differences++;
+    if (v_flag && why) {
+        printf("%c %s (%s)\n", kind, path, why);
+    }
+    else {
+        printf("%c %s\n", kind, path);
+    }
+}
+
+//! the path of name inside dir, without a double slash at the root
+static char *child_path(const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    char *path = malloc(len + strlen(name) + 2);
+
+    if (!path) {
+        perror("malloc");
+        exit(ERROR);
+    }
+
+    if (len && dir[len - 1] == '/') {
+        sprintf(path, "%s%s", dir, name);
+    }
+    else {
+        sprintf(path, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+static int collect_entry(const struct minfs_dirent *ent, void *arg) {
+    struct diff_dir *dir = arg;
+
+    if (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")) {
+        return SUCCESS;
+    }
+
+    if (dir->count == dir->cap) {
+        dir->cap = dir->cap ? dir->cap * 2 : 16;
+        dir->ents = realloc(dir->ents, sizeof(struct diff_entry) * dir->cap);
+        if (!dir->ents) {
+            perror("realloc");
+            exit(ERROR);
+        }
+    }
+
+    dir->ents[dir->count].ino = ent->ino;
+    strcpy(dir->ents[dir->count].name, ent->name);
+    dir->count++;
+    return SUCCESS;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct diff_entry *)a)->name,
+                  ((const struct diff_entry *)b)->name);
+}
+
+//! reads a whole directory and sorts it by name
+static void read_dir(minfs_t *fs, uint32_t ino, const char *path,
+                     struct diff_dir *dir) {
+    int err;
+
+    dir->ents = NULL;
+    dir->count = 0;
+    dir->cap = 0;
+
+    if ((err = minfs_readdir(fs, ino, collect_entry, dir)) < 0) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+        exit(ERROR);
+    }
+    qsort(dir->ents, dir->count, sizeof(struct diff_entry), compare_entries);
+}
+
+static int report_walk(minfs_t *fs, uint32_t ino, const struct inode *node,
+                       const char *path, void *arg) {
+    report(*(char *)arg, path, NULL);
+    return SUCCESS;
+}
+
+//! reports a path that is only on one side, and everything under it
+static void report_subtree(char kind, minfs_t *fs, uint32_t ino,
+                           const char *path) {
+    const struct inode *node = minfs_inode(fs, ino);
+    int err;
+
+    report(kind, path, NULL);
+    if (node && (node->mode & FILE_TYPE) == MASK_DIR) {
+        if ((err = minfs_walk(fs, ino, path, report_walk, &kind)) < 0) {
+            fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+            exit(ERROR);
+        }
+    }
+}
+
+//! true if two inodes look like the same file without reading anything:
+//! same metadata and the same zones. this is the quick check, anything
+//! that passes it is taken to be unchanged unless -c was given
+
+static int same_inode(const struct inode *a, const struct inode *b) {
+    return a->mode == b->mode && a->uid == b->uid && a->gid == b->gid &&
+           a->size == b->size && a->mtime == b->mtime &&
+           !memcmp(a->zone, b->zone, sizeof(a->zone)) &&
+           a->indirect == b->indirect && a->two_indirect == b->two_indirect;
+}
+
+static int hash_zone(const uint8_t *data, size_t len, uint64_t off,
+                     uint32_t zone, void *arg) {
+    struct hasher *hash = arg;
+
+    if (data) {
+        hash_update(hash, data, len);
+    }
+    else {
+        hash_update_zeros(hash, len);
+    }
+    return SUCCESS;
+}
+
+//! hashes the contents of a file into hex
+static void hash_contents(minfs_t *fs, uint32_t ino, const char *path,
+                          char hex[HASH_HEX_MAX]) {
+    struct hasher hash;
+    int err;
+
+    hash_init(&hash, hash_algo);
+    if ((err = minfs_read_zones(fs, ino, hash_zone, &hash)) < 0) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+        exit(ERROR);
+    }
+    hash_final(&hash, hex);
+
+    hashed++;
+    hashed_bytes += minfs_inode(fs, ino)->size;
+}
+
+static void diff_tree(uint32_t ino_a, uint32_t ino_b, const char *path);
+
+//! compares one path that is on both sides
+static void diff_path(uint32_t ino_a, uint32_t ino_b, const char *path) {
+    const struct inode *a = minfs_inode(fs_a, ino_a);
+    const struct inode *b = minfs_inode(fs_b, ino_b);
+    char hex_a[HASH_HEX_MAX];
+    char hex_b[HASH_HEX_MAX];
+    uint16_t type;
+
+    if (!a || !b) {
+        fprintf(stderr, "%s: bad inode\n", path);
+        exit(ERROR);
+    }
+    compared++;
+    type = a->mode & FILE_TYPE;
+
+    // a file that became a directory (or the other way) is just changed
+    if (type != (b->mode & FILE_TYPE)) {
+        report('M', path, "type");
+        return;
+    }
+
+    if (a->mode != b->mode) {
+        report('M', path, "mode");
+    }
+    else if (a->uid != b->uid || a->gid != b->gid) {
+        report('M', path, "owner");
+    }
+
+    // directories are always gone into, a change can be anywhere below
+    if (type == MASK_DIR) {
+        diff_tree(ino_a, ino_b, path);
+        return;
+    }
+
+    // only regular files and symlinks have data worth comparing
+    if (type != REGULAR_FILE && type != SYM_LINK_TYPE) {
+        return;
+    }
+    if (a->mode != b->mode || a->uid != b->uid || a->gid != b->gid) {
+        return;
+    }
+
+    // same inode and zones, nothing to read
+    if (!c_flag && same_inode(a, b)) {
+        return;
+    }
+    if (a->size != b->size) {
+        report('M', path, "size");
+        return;
+    }
+
+    // the zones moved or the inode changed, only the data can tell us
+    hash_contents(fs_a, ino_a, path, hex_a);
+    hash_contents(fs_b, ino_b, path, hex_b);
+    if (strcmp(hex_a, hex_b)) {
+        report('M', path, "data");
+    }
+}
+
+//! goes through two directories together, name by name
+static void diff_tree(uint32_t ino_a, uint32_t ino_b, const char *path) {
+    struct diff_dir dir_a;
+    struct diff_dir dir_b;
+    size_t i = 0;
+    size_t j = 0;
+    char *child;
+    int cmp;
+
+    // a directory coming round again means that side loops back on itself
+    if (seen_a[ino_a] || seen_b[ino_b]) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(-MINFS_ECORRUPT));
+        exit(ERROR);
+    }
+    seen_a[ino_a] = TRUE;
+    seen_b[ino_b] = TRUE;
+
+    read_dir(fs_a, ino_a, path, &dir_a);
+    read_dir(fs_b, ino_b, path, &dir_b);
+
+    // both are sorted, so this is a merge
+    while (i < dir_a.count || j < dir_b.count) {
+        if (i == dir_a.count) {
+            cmp = 1;
+        }
+        else if (j == dir_b.count) {
+            cmp = -1;
+        }
+        else {
+            cmp = strcmp(dir_a.ents[i].name, dir_b.ents[j].name);
+        }
+
+        if (cmp < 0) {
+            child = child_path(path, dir_a.ents[i].name);
+            report_subtree('D', fs_a, dir_a.ents[i].ino, child);
+            i++;
+        }
+        else if (cmp > 0) {
+            child = child_path(path, dir_b.ents[j].name);
+            report_subtree('A', fs_b, dir_b.ents[j].ino, child);
+            j++;
+        }
+        else {
+            child = child_path(path, dir_a.ents[i].name);
+            diff_path(dir_a.ents[i].ino, dir_b.ents[j].ino, child);
+            i++;
+            j++;
+        }
+        free(child);
+    }
+
+    free(dir_a.ents);
+    free(dir_b.ents);
+}
+
+int main(int argc, char *argv[]) {
+
+    // the second image and the path to compare in both
+    char *image_b;
+    const char *path;
+    uint32_t ino_a;
+    uint32_t ino_b;
+    int err;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    // image1 lands in image_file and the next two where minget has its paths
+    parse_cmd_line(argc, argv);
+    if (src_path_string == NULL)
+    {
+        print_usage(argv);
+        exit(ERROR);
+    }
+    image_b = src_path_string;
+    path = destination_path_args ? dst_path_string : "/";
+
+    if (hash_algo == HASH_NONE)
+    {
+        hash_algo = HASH_XXH64;
+    }
+
+    fs_a = open_filesystem_in(image_file);
+    fs_b = open_filesystem_in(image_b);
+
+    if ((err = minfs_lookup(fs_a, path, &ino_a)) < 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", image_file, path,
+                minfs_strerror(err));
+        exit(ERROR);
+    }
+    if ((err = minfs_lookup(fs_b, path, &ino_b)) < 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", image_b, path, minfs_strerror(err));
+        exit(ERROR);
+    }
+    if ((seen_a = calloc(minfs_ninodes(fs_a) + 1, 1)) == NULL ||
+        (seen_b = calloc(minfs_ninodes(fs_b) + 1, 1)) == NULL)
+    {
+        perror("calloc");
+        exit(ERROR);
+    }
+
+    diff_path(ino_a, ino_b, path);
+
+    // how little we had to read is the whole point, so show it
+    if (v_flag)
+    {
+        fprintf(stderr, "%lu paths compared, %lu files hashed (%llu bytes)",
+                compared, hashed, (unsigned long long)hashed_bytes);
+        fprintf(stderr, ", %lu differences\n", differences);
+    }
+
+    free(seen_a);
+    free(seen_b);
+    minfs_close(fs_a);
+    minfs_close(fs_b);
+    return differences ? DIFFERENT : SUCCESS;
+}
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+#include "partscan.h"
+#include "pool.h"
+
+#define KIB 1024
+
+/* Structures */
+
+// everything the directory jobs share, indexed by inode number. each
+// directory is only ever worked on by its own job, so the per directory
+// arrays need no locking; the rest is updated with atomics
+
+struct du_state {
+    minfs_t *fs;
+    const struct minfs_columns *cols; // the only inode fields looked at
+    struct pool *pool;
+    uint32_t ninodes;
+    uint8_t *dir_claimed;   // so a directory linked twice is read once
+    uint64_t *own;          // zones charged to a directory itself
+    uint64_t *total;        // own plus everything below it
+    uint32_t *parent;
+    char **name;
+    uint32_t *owner;        // hardlinks: lowest directory linking it
+    uint8_t *link_claimed;  // hardlinks: whoever counts its zones
+    uint64_t *link_zones;
+    uint32_t *dirs;         // every directory, parents before children
+    uint32_t ndirs;
+    int failed;
+};
+
+// one directory job
+struct du_job {
+    struct du_state *st;
+    uint32_t dir;
+};
+
+static uint64_t zones_of(struct du_state *st, uint32_t ino) {
+    uint64_t zones = 0;
+    int err;
+
+    if ((err = minfs_alloc_zones(st->fs, ino, &zones)) < 0) {
+        fprintf(stderr, "inode %u: %s\n", ino, minfs_strerror(err));
+        __atomic_store_n(&st->failed, TRUE, __ATOMIC_RELAXED);
+    }
+    return zones;
+}
+
+static void queue_dir(struct du_state *st, uint32_t dir);
+
+//! looks at one entry of the directory the job is for
+static int du_entry(const struct minfs_dirent *ent, void *arg) {
+    struct du_job *job = arg;
+    struct du_state *st = job->st;
+    uint32_t seen;
+    uint16_t mode;
+    uint16_t links;
+
+    if (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")) {
+        return SUCCESS;
+    }
+    if (ent->ino < ROOT_INODE || ent->ino > st->ninodes) {
+        fprintf(stderr, "%s: bad inode %u\n", ent->name, ent->ino);
+        __atomic_store_n(&st->failed, TRUE, __ATOMIC_RELAXED);
+        return SUCCESS;
+    }
+    mode = st->cols->mode[ent->ino - 1];
+    links = st->cols->links[ent->ino - 1];
+
+    // subdirectories get a job of their own
+    if ((mode & FILE_TYPE) == MASK_DIR) {
+        if (__atomic_exchange_n(&st->dir_claimed[ent->ino], 1,
+                                __ATOMIC_ACQ_REL)) {
+            return SUCCESS;
+        }
+        st->parent[ent->ino] = job->dir;
+        if ((st->name[ent->ino] = strdup(ent->name)) == NULL) {
+            perror("strdup");
+            exit(ERROR);
+        }
+        queue_dir(st, ent->ino);
+        return SUCCESS;
+    }
+
+    if (links <= 1) {
+        st->own[job->dir] += zones_of(st, ent->ino);
+        return SUCCESS;
+    }
+
+    // a hardlink is charged once, to the lowest numbered directory with a
+    // link to it, so the answer doesnt depend on which job got there first
+    seen = __atomic_load_n(&st->owner[ent->ino], __ATOMIC_RELAXED);
+    while ((seen == 0 || job->dir < seen) &&
+           !__atomic_compare_exchange_n(&st->owner[ent->ino], &seen,
+                                        job->dir, FALSE, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+    }
+
+    // and only the first job to see it counts its zones
+    if (!__atomic_exchange_n(&st->link_claimed[ent->ino], 1,
+                             __ATOMIC_ACQ_REL)) {
+        st->link_zones[ent->ino] = zones_of(st, ent->ino);
+    }
+    return SUCCESS;
+}
+
+static void du_dir(void *arg) {
+    struct du_job *job = arg;
+    struct du_state *st = job->st;
+    int err;
+
+    st->own[job->dir] += zones_of(st, job->dir);
+    if ((err = minfs_readdir(st->fs, job->dir, du_entry, job)) < 0) {
+        fprintf(stderr, "inode %u: %s\n", job->dir, minfs_strerror(err));
+        __atomic_store_n(&st->failed, TRUE, __ATOMIC_RELAXED);
+    }
+    free(job);
+}
+
+static void queue_dir(struct du_state *st, uint32_t dir) {
+    struct du_job *job = malloc(sizeof(struct du_job));
+    uint32_t slot;
+
+    if (!job) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    job->st = st;
+    job->dir = dir;
+
+    // a directory is always found by its parents job, so the parent is
+    // already in the list ahead of it
+    slot = __atomic_fetch_add(&st->ndirs, 1, __ATOMIC_ACQ_REL);
+    st->dirs[slot] = dir;
+
+    pool_submit(st->pool, du_dir, job);
+}
+
+//! the path of a directory from the names collected on the way down
+static char *dir_path(struct du_state *st, uint32_t dir, uint32_t top,
+                      const char *top_path) {
+    char *parent;
+    char *path;
+
+    if (dir == top) {
+        return strdup(top_path);
+    }
+
+    parent = dir_path(st, st->parent[dir], top, top_path);
+    path = malloc(strlen(parent) + strlen(st->name[dir]) + 2);
+    if (!parent || !path) {
+        perror("malloc");
+        exit(ERROR);
+    }
+
+    if (parent[strlen(parent) - 1] == '/') {
+        sprintf(path, "%s%s", parent, st->name[dir]);
+    }
+    else {
+        sprintf(path, "%s/%s", parent, st->name[dir]);
+    }
+    free(parent);
+    return path;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void *alloc_array(uint32_t count, size_t size) {
+    void *array = calloc(count, size);
+
+    if (!array) {
+        perror("calloc");
+        exit(ERROR);
+    }
+    return array;
+}
+
+//! adds up the space under the path in one filesystem and prints it
+static void du_filesystem(struct fs_location *loc) {
+    struct du_state st;
+    uint64_t zonesize;
+    uint64_t linked = 0;
+    char **lines;
+    char *path;
+    uint32_t top;
+    uint32_t i;
+
+    memset(&st, 0, sizeof(st));
+    inode_columns = TRUE;
+    st.fs = open_filesystem();
+    st.cols = minfs_columns(st.fs);
+    top = lookup_src_path(st.fs);
+    zonesize = minfs_zonesize(st.fs);
+
+    if ((st.cols->mode[top - 1] & FILE_TYPE) != MASK_DIR) {
+        printf("%llu\t%s\n", (unsigned long long)
+               ((zones_of(&st, top) * zonesize + KIB - 1) / KIB),
+               src_path_string);
+        minfs_close(st.fs);
+        return;
+    }
+
+    st.ninodes = st.cols->count;
+    st.dir_claimed = alloc_array(st.ninodes + 1, sizeof(uint8_t));
+    st.own = alloc_array(st.ninodes + 1, sizeof(uint64_t));
+    st.total = alloc_array(st.ninodes + 1, sizeof(uint64_t));
+    st.parent = alloc_array(st.ninodes + 1, sizeof(uint32_t));
+    st.name = alloc_array(st.ninodes + 1, sizeof(char *));
+    st.owner = alloc_array(st.ninodes + 1, sizeof(uint32_t));
+    st.link_claimed = alloc_array(st.ninodes + 1, sizeof(uint8_t));
+    st.link_zones = alloc_array(st.ninodes + 1, sizeof(uint64_t));
+    st.dirs = alloc_array(st.ninodes, sizeof(uint32_t));
+
+    // every directory is read (and every file in it counted) in parallel
+    st.pool = pool_create(jobs);
+    st.dir_claimed[top] = 1;
+    queue_dir(&st, top);
+    pool_wait(st.pool);
+    pool_destroy(st.pool);
+
+    // hardlinks go to the directory that won them
+    for (i = ROOT_INODE; i <= st.ninodes; i++) {
+        if (st.owner[i]) {
+            st.own[st.owner[i]] += st.link_zones[i];
+            linked++;
+        }
+    }
+
+    // children are after their parents in the list, so going backwards
+    // every directory is finished before it is added to its parent
+    for (i = st.ndirs; i-- > 0; ) {
+        st.total[st.dirs[i]] += st.own[st.dirs[i]];
+        if (st.dirs[i] != top) {
+            st.total[st.parent[st.dirs[i]]] += st.total[st.dirs[i]];
+        }
+    }
+
+    // print them sorted by path, like du | sort -k2
+    lines = alloc_array(st.ndirs, sizeof(char *));
+    for (i = 0; i < st.ndirs; i++) {
+        path = dir_path(&st, st.dirs[i], top,
+                        path_arg_count ? src_path_string : "/");
+        lines[i] = malloc(strlen(path) + 32);
+        if (!lines[i]) {
+            perror("malloc");
+            exit(ERROR);
+        }
+        sprintf(lines[i], "%s\t%llu", path, (unsigned long long)
+                ((st.total[st.dirs[i]] * zonesize + KIB - 1) / KIB));
+        free(path);
+    }
+    qsort(lines, st.ndirs, sizeof(char *), compare_paths);
+
+    for (i = 0; i < st.ndirs; i++) {
+        // stored as path first for the sort, printed size first like du
+        path = strrchr(lines[i], '\t');
+        *path = '\0';
+        printf("%s\t%s\n", path + 1, lines[i]);
+        free(lines[i]);
+    }
+
+    if (v_flag) {
+        fprintf(stderr, "%u directories, %llu hardlinked inodes counted "
+                "once, %llu zones of %llu bytes\n", st.ndirs,
+                (unsigned long long)linked,
+                (unsigned long long)st.total[top],
+                (unsigned long long)zonesize);
+    }
+
+    for (i = 0; i <= st.ninodes; i++) {
+        free(st.name[i]);
+    }
+    free(lines);
+    free(st.dir_claimed);
+    free(st.own);
+    free(st.total);
+    free(st.parent);
+    free(st.name);
+    free(st.owner);
+    free(st.link_claimed);
+    free(st.link_zones);
+    free(st.dirs);
+    minfs_close(st.fs);
+
+    if (st.failed) {
+        exit(ERROR);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    minfs_image_t *disk_image;
+    struct fs_location *locs;
+    int count;
+    int err;
+    int ret;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    parse_cmd_line(argc, argv);
+
+    // with -a add up the path on every filesystem in the partition tree
+    if (a_flag)
+    {
+        if ((disk_image = minfs_image_open(image_file, NULL, &err)) == NULL)
+        {
+            fprintf(stderr, "%s: %s\n", image_file, minfs_strerror(err));
+            exit(ERROR);
+        }
+
+        if ((count = scan_partitions(disk_image, &locs)) == 0)
+        {
+            fprintf(stderr, "No minix partitions found\n");
+            exit(ERROR);
+        }
+        minfs_image_close(disk_image);
+
+        ret = run_on_all_partitions(locs, count, du_filesystem);
+        free(locs);
+        return ret;
+    }
+
+    du_filesystem(NULL);
+    return SUCCESS;
+}
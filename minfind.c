@@ -0,0 +1,523 @@
+#define _XOPEN_SOURCE 700 // for strptime
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+
+#define SECONDS_PER_DAY 86400
+#define PATH_START 256 // first guess at how long a path is
+
+// the other file types, minfunc.h only has the ones minls needs
+#define FIFO_TYPE 0010000
+#define CHAR_TYPE 0020000
+#define BLOCK_TYPE 0060000
+#define SOCKET_TYPE 0140000
+
+// what a predicate looks at
+enum pred_field {
+    PRED_TYPE,
+    PRED_SIZE,
+    PRED_MTIME,
+    PRED_CTIME,
+    PRED_UID,
+    PRED_GID,
+    PRED_LINKS,
+    PRED_PERM
+};
+
+// how it compares, the perm ones are for -perm MODE, -MODE and /MODE
+enum pred_cmp {
+    CMP_EQ,
+    CMP_GT,
+    CMP_LT,
+    CMP_ALL_BITS,
+    CMP_ANY_BIT
+};
+
+/* Structures */
+struct predicate {
+    enum pred_field field;
+    enum pred_cmp cmp;
+    int64_t value;
+};
+
+// the command line words that start the expression
+static const char *pred_words[] = {
+    "-type", "-size", "-mtime", "-ctime", "-newermt", "-newerct",
+    "-uid", "-gid", "-links", "-perm", NULL
+};
+
+static struct predicate *preds;
+static int npreds;
+
+static void usage_exit(char *argv[]) {
+    print_usage(argv);
+    exit(ERROR);
+}
+
+static void add_pred(enum pred_field field, enum pred_cmp cmp,
+                     int64_t value) {
+    preds = realloc(preds, sizeof(struct predicate) * (npreds + 1));
+    if (!preds) {
+        perror("realloc");
+        exit(ERROR);
+    }
+    preds[npreds].field = field;
+    preds[npreds].cmp = cmp;
+    preds[npreds].value = value;
+    npreds++;
+}
+
+static int is_pred_word(const char *arg) {
+    int i;
+
+    for (i = 0; pred_words[i]; i++) {
+        if (!strcmp(arg, pred_words[i])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+//! reads a find style number, +N is more than N and -N less than N.
+//! a size can end in c, k, M or G (plain numbers are bytes)
+
+static int64_t parse_number(const char *arg, enum pred_cmp *cmp,
+                            int is_size) {
+    int64_t value;
+    char *end;
+
+    *cmp = CMP_EQ;
+    if (*arg == '+') {
+        *cmp = CMP_GT;
+        arg++;
+    }
+    else if (*arg == '-') {
+        *cmp = CMP_LT;
+        arg++;
+    }
+
+    value = strtoll(arg, &end, 10);
+    if (end == arg) {
+        fprintf(stderr, "minfind: bad number '%s'\n", arg);
+        exit(ERROR);
+    }
+
+    if (is_size) {
+        switch (*end) {
+            case 'G':
+                value <<= 10;
+                /* fall through */
+            case 'M':
+                value <<= 10;
+                /* fall through */
+            case 'k':
+                value <<= 10;
+                /* fall through */
+            case 'c':
+                end++;
+                break;
+        }
+    }
+
+    if (*end) {
+        fprintf(stderr, "minfind: bad number '%s'\n", arg);
+        exit(ERROR);
+    }
+    return value;
+}
+
+//! reads @seconds or YYYY-MM-DD with an optional HH:MM[:SS] (local time)
+static int64_t parse_date(const char *arg) {
+    static const char *formats[] = {
+        "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d", NULL
+    };
+    struct tm tm;
+    const char *end;
+    int i;
+
+    if (*arg == '@') {
+        return strtoll(arg + 1, NULL, 10);
+    }
+
+    for (i = 0; formats[i]; i++) {
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(arg, formats[i], &tm);
+        if (end && !*end) {
+            tm.tm_isdst = -1;
+            return mktime(&tm);
+        }
+    }
+
+    fprintf(stderr, "minfind: bad date '%s'\n", arg);
+    exit(ERROR);
+}
+
+//! -mtime N is N days old (rounded down, like find), which is turned
+//! into a range of times here so the scan only compares numbers
+
+static void add_age(enum pred_field field, const char *arg) {
+    enum pred_cmp cmp;
+    int64_t days = parse_number(arg, &cmp, FALSE);
+    int64_t now = time(NULL);
+    int64_t day_start = now - days * SECONDS_PER_DAY;
+    int64_t day_end = now - (days + 1) * SECONDS_PER_DAY;
+
+    // older than N days is at or before the far end of day N
+    if (cmp == CMP_GT) {
+        add_pred(field, CMP_LT, day_end + 1);
+    }
+    // newer than N days is after its near end
+    else if (cmp == CMP_LT) {
+        add_pred(field, CMP_GT, day_start);
+    }
+    else {
+        add_pred(field, CMP_GT, day_end);
+        add_pred(field, CMP_LT, day_start + 1);
+    }
+}
+
+static void add_type(const char *arg) {
+    int64_t type;
+
+    switch (arg[0]) {
+        case 'f': type = REGULAR_FILE; break;
+        case 'd': type = MASK_DIR; break;
+        case 'l': type = SYM_LINK_TYPE; break;
+        case 'c': type = CHAR_TYPE; break;
+        case 'b': type = BLOCK_TYPE; break;
+        case 'p': type = FIFO_TYPE; break;
+        case 's': type = SOCKET_TYPE; break;
+        default:
+            fprintf(stderr, "minfind: unknown type '%s'\n", arg);
+            exit(ERROR);
+    }
+    add_pred(PRED_TYPE, CMP_EQ, type);
+}
+
+static void add_perm(const char *arg) {
+    enum pred_cmp cmp = CMP_EQ;
+    char *end;
+    long mode;
+
+    if (*arg == '-') {
+        cmp = CMP_ALL_BITS;
+        arg++;
+    }
+    else if (*arg == '/') {
+        cmp = CMP_ANY_BIT;
+        arg++;
+    }
+
+    mode = strtol(arg, &end, 8);
+    if (end == arg || *end) {
+        fprintf(stderr, "minfind: bad mode '%s' (octal only)\n", arg);
+        exit(ERROR);
+    }
+    add_pred(PRED_PERM, cmp, mode);
+}
+
+//! turns the words after the path into predicates, all of them have to
+//! match (there is no -o or !)
+
+static void parse_expression(int argc, char *argv[], int start) {
+    enum pred_cmp cmp;
+    int64_t value;
+    const char *word;
+    const char *arg;
+    int i;
+
+    for (i = start; i < argc; i += 2) {
+        word = argv[i];
+        if (!is_pred_word(word) || i + 1 >= argc) {
+            usage_exit(argv);
+        }
+        arg = argv[i + 1];
+
+        if (!strcmp(word, "-type")) {
+            add_type(arg);
+        }
+        else if (!strcmp(word, "-size")) {
+            value = parse_number(arg, &cmp, TRUE);
+            add_pred(PRED_SIZE, cmp, value);
+        }
+        else if (!strcmp(word, "-mtime")) {
+            add_age(PRED_MTIME, arg);
+        }
+        else if (!strcmp(word, "-ctime")) {
+            add_age(PRED_CTIME, arg);
+        }
+        else if (!strcmp(word, "-newermt")) {
+            add_pred(PRED_MTIME, CMP_GT, parse_date(arg));
+        }
+        else if (!strcmp(word, "-newerct")) {
+            add_pred(PRED_CTIME, CMP_GT, parse_date(arg));
+        }
+        else if (!strcmp(word, "-uid")) {
+            value = parse_number(arg, &cmp, FALSE);
+            add_pred(PRED_UID, cmp, value);
+        }
+        else if (!strcmp(word, "-gid")) {
+            value = parse_number(arg, &cmp, FALSE);
+            add_pred(PRED_GID, cmp, value);
+        }
+        else if (!strcmp(word, "-links")) {
+            value = parse_number(arg, &cmp, FALSE);
+            add_pred(PRED_LINKS, cmp, value);
+        }
+        else {
+            add_perm(arg);
+        }
+    }
+}
+
+// narrows keep[] down to the inodes whose column value (masked) passes
+// one predicate. the value is clamped to what the column can hold first
+// so the compare is done at the columns own width, and the compare is
+// picked before the loop, so every loop is a straight run down one array
+// that the compiler can vectorize
+#define FILTER_COLUMN(name, type)                                          \
+static void name(uint8_t *keep, const type *col, uint32_t count,          \
+                 type mask, enum pred_cmp cmp, int64_t value) {           \
+    type want = (type)value;                                               \
+    uint32_t i;                                                            \
+                                                                           \
+    switch (cmp) {                                                         \
+        case CMP_EQ:                                                       \
+            if (value < 0 || value > mask) break;                          \
+            for (i = 0; i < count; i++)                                    \
+                keep[i] &= (type)(col[i] & mask) == want;                  \
+            return;                                                        \
+        case CMP_GT:                                                       \
+            if (value < 0) return;                                         \
+            if (value >= mask) break;                                      \
+            for (i = 0; i < count; i++)                                    \
+                keep[i] &= (type)(col[i] & mask) > want;                   \
+            return;                                                        \
+        case CMP_LT:                                                       \
+            if (value > mask) return;                                      \
+            if (value <= 0) break;                                         \
+            for (i = 0; i < count; i++)                                    \
+                keep[i] &= (type)(col[i] & mask) < want;                   \
+            return;                                                        \
+        case CMP_ALL_BITS:                                                 \
+            if (value < 0 || (value & ~(int64_t)mask)) break;              \
+            for (i = 0; i < count; i++)                                    \
+                keep[i] &= (type)(col[i] & want) == want;                  \
+            return;                                                        \
+        case CMP_ANY_BIT:                                                  \
+            if (!value) return;                                            \
+            want &= mask;                                                  \
+            if (!want) break;                                              \
+            for (i = 0; i < count; i++)                                    \
+                keep[i] &= (col[i] & want) != 0;                           \
+            return;                                                        \
+    }                                                                      \
+    /* nothing the column can hold passes */                               \
+    memset(keep, 0, count);                                                \
+}
+
+FILTER_COLUMN(filter_u16, uint16_t)
+FILTER_COLUMN(filter_u32, uint32_t)
+
+//! runs every predicate over the columns it needs, keep[] starts out as
+//! the inodes in use and ends up as the ones that match everything
+
+static void filter_inodes(const struct minfs_columns *cols, uint8_t *keep) {
+    const struct predicate *pred;
+    uint32_t n = cols->count;
+    uint32_t i;
+    int p;
+
+    // no links means the inode is free
+    for (i = 0; i < n; i++) {
+        keep[i] = cols->links[i] != 0;
+    }
+
+    for (p = 0; p < npreds; p++) {
+        pred = &preds[p];
+
+        switch (pred->field) {
+            case PRED_TYPE:
+                filter_u16(keep, cols->mode, n, FILE_TYPE, pred->cmp,
+                           pred->value);
+                break;
+            case PRED_PERM:
+                filter_u16(keep, cols->mode, n, 07777, pred->cmp,
+                           pred->value);
+                break;
+            case PRED_SIZE:
+                filter_u32(keep, cols->size, n, UINT32_MAX, pred->cmp,
+                           pred->value);
+                break;
+            // times are compared as unsigned, the way minls prints them
+            case PRED_MTIME:
+                filter_u32(keep, (const uint32_t *)cols->mtime, n,
+                           UINT32_MAX, pred->cmp, pred->value);
+                break;
+            case PRED_CTIME:
+                filter_u32(keep, (const uint32_t *)cols->ctime, n,
+                           UINT32_MAX, pred->cmp, pred->value);
+                break;
+            case PRED_UID:
+                filter_u16(keep, cols->uid, n, UINT16_MAX, pred->cmp,
+                           pred->value);
+                break;
+            case PRED_GID:
+                filter_u16(keep, cols->gid, n, UINT16_MAX, pred->cmp,
+                           pred->value);
+                break;
+            case PRED_LINKS:
+                filter_u16(keep, cols->links, n, UINT16_MAX, pred->cmp,
+                           pred->value);
+                break;
+        }
+    }
+}
+
+//! true if path is at or under the directory prefix
+static int under_prefix(const char *path, const char *prefix,
+                        size_t prefix_len) {
+    if (prefix_len == 0) {
+        return TRUE;
+    }
+    return !strncmp(path, prefix, prefix_len) &&
+           (path[prefix_len] == '\0' || path[prefix_len] == '/');
+}
+
+//! prints every path an inode is linked at that is under the prefix
+static void print_paths(minfs_names_t *names, uint32_t ino,
+                        const char *prefix, size_t prefix_len) {
+    static char *path;
+    static size_t path_len = PATH_START;
+    int links = (ino == ROOT_INODE) ? 1 : minfs_names_count(names, ino);
+    int err;
+    int n;
+
+    for (n = 0; n < links; n++) {
+        // grow the buffer until the path fits
+        do {
+            if (!path && (path = malloc(path_len)) == NULL) {
+                perror("malloc");
+                exit(ERROR);
+            }
+            err = minfs_names_path(names, ino, n, path, path_len);
+            if (err == -ENAMETOOLONG) {
+                free(path);
+                path = NULL;
+                path_len *= 2;
+            }
+        } while (err == -ENAMETOOLONG);
+
+        if (err < 0) {
+            fprintf(stderr, "inode %u: %s\n", ino, minfs_strerror(err));
+            continue;
+        }
+        if (under_prefix(path, prefix, prefix_len)) {
+            printf("%s\n", path);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    minfs_t *fs;
+    minfs_names_t *names = NULL;
+    const struct minfs_columns *cols;
+    uint8_t *keep;
+    uint32_t *found = NULL;
+    uint32_t nfound = 0;
+    uint32_t ninodes;
+    uint32_t i;
+    char *prefix = "";
+    size_t prefix_len;
+    int expr_start;
+    int err;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    // the expression is find style so getopt can't see it, cut it off
+    for (expr_start = 1; expr_start < argc; expr_start++)
+    {
+        if (is_pred_word(argv[expr_start]))
+        {
+            break;
+        }
+    }
+    parse_expression(argc, argv, expr_start);
+    parse_cmd_line(expr_start, argv);
+
+    // the predicates only ever look at columns, so the table is split
+    // into them as it is read and never kept packed
+    inode_columns = TRUE;
+    fs = open_filesystem();
+
+    // a path only limits what gets printed, it has to be there though
+    if (path_arg_count)
+    {
+        lookup_src_path(fs);
+        prefix = src_path_string;
+        prefix_len = strlen(prefix);
+        while (prefix_len > 0 && prefix[prefix_len - 1] == '/')
+        {
+            prefix[--prefix_len] = '\0';
+        }
+    }
+    prefix_len = strlen(prefix);
+
+    // each predicate only reads the column it is about
+    cols = minfs_columns(fs);
+    ninodes = cols->count;
+    keep = malloc(ninodes);
+    if (!keep || (found = malloc(sizeof(uint32_t) * ninodes)) == NULL)
+    {
+        perror("malloc");
+        exit(ERROR);
+    }
+
+    filter_inodes(cols, keep);
+    for (i = 0; i < ninodes; i++)
+    {
+        if (keep[i])
+        {
+            found[nfound++] = i + ROOT_INODE;
+        }
+    }
+    free(keep);
+
+    // only now are the directories read, and only if there is something
+    // to name
+    if (nfound)
+    {
+        if ((names = minfs_names_build(fs, &err)) == NULL)
+        {
+            fprintf(stderr, "%s: %s\n", image_file, minfs_strerror(err));
+            exit(ERROR);
+        }
+        for (i = 0; i < nfound; i++)
+        {
+            print_paths(names, found[i], prefix, prefix_len);
+        }
+    }
+
+    if (v_flag)
+    {
+        fprintf(stderr, "%u inodes scanned, %u matched\n", ninodes, nfound);
+    }
+
+    minfs_names_free(names);
+    free(found);
+    free(preds);
+    minfs_close(fs);
+    return SUCCESS;
+}
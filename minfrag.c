@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+#include "partscan.h"
+
+#define BUCKETS 24      // power of two buckets, the last one takes the rest
+#define BAR_WIDTH 40
+#define EXTENTS_START 16
+
+/* Structures */
+
+// one run of zones that follow each other both in the file and on disk
+struct frag_extent {
+    uint64_t logical;   // first zone of the run, counted in the file
+    uint64_t physical;  // and its zone number on disk
+    uint64_t length;    // in zones
+};
+
+// the extents of the file being looked at
+struct frag_file {
+    struct frag_extent *extents;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t zonesize;
+};
+
+// what the whole image adds up to
+struct frag_stats {
+    minfs_t *fs;
+    uint8_t *seen;              // hardlinks only get counted once
+    uint64_t files;
+    uint64_t fragmented;        // files in more than one extent
+    uint64_t extents;
+    uint64_t zones;
+    uint64_t per_file[BUCKETS]; // files by how many extents they have
+    uint64_t lengths[BUCKETS];  // extents by how many zones long
+    struct frag_file file;
+};
+
+//! which power of two bucket n goes in: 1, 2-3, 4-7 and so on
+static int bucket_of(uint64_t n) {
+    int b = 0;
+
+    while (n > 1 && b < BUCKETS - 1) {
+        n >>= 1;
+        b++;
+    }
+    return b;
+}
+
+//! adds one zone to the file, joining it onto the last extent when it is
+//! the next zone both in the file and on disk
+
+static int add_zone(const uint8_t *data, size_t len, uint64_t off,
+                    uint32_t zone, void *arg) {
+    struct frag_file *file = arg;
+    struct frag_extent *last;
+    uint64_t logical = off / file->zonesize;
+
+    if (zone == 0) {
+        return SUCCESS;
+    }
+
+    last = file->count ? &file->extents[file->count - 1] : NULL;
+    if (last && last->logical + last->length == logical &&
+        last->physical + last->length == zone) {
+        last->length++;
+        return SUCCESS;
+    }
+
+    if (file->count == file->cap) {
+        file->cap = file->cap ? file->cap * 2 : EXTENTS_START;
+        file->extents = realloc(file->extents,
+                                sizeof(struct frag_extent) * file->cap);
+        if (!file->extents) {
+            perror("realloc");
+            exit(ERROR);
+        }
+    }
+
+    last = &file->extents[file->count++];
+    last->logical = logical;
+    last->physical = zone;
+    last->length = 1;
+    return SUCCESS;
+}
+
+//! works out one files extents, adds them to the totals and prints them
+static void frag_one(struct frag_stats *st, uint32_t ino, const char *path) {
+    struct frag_file *file = &st->file;
+    uint32_t i;
+    int err;
+
+    if (st->seen[ino]) {
+        return;
+    }
+    st->seen[ino] = TRUE;
+
+    file->count = 0;
+    if ((err = minfs_map_zones(st->fs, ino, add_zone, file)) < 0) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+        return;
+    }
+
+    st->files++;
+    st->extents += file->count;
+    // empty files are in no extents at all, they stay out of the histogram
+    if (file->count) {
+        st->per_file[bucket_of(file->count)]++;
+    }
+    if (file->count > 1) {
+        st->fragmented++;
+    }
+    for (i = 0; i < file->count; i++) {
+        st->zones += file->extents[i].length;
+        st->lengths[bucket_of(file->extents[i].length)]++;
+    }
+
+    printf("%s: %u extent%s found\n", path, file->count,
+           file->count == 1 ? "" : "s");
+
+    // the whole map, like filefrag -v
+    if (v_flag && file->count) {
+        printf("%5s %10s %10s %8s\n", "ext", "logical", "physical",
+               "length");
+        for (i = 0; i < file->count; i++) {
+            printf("%5u %10llu %10llu %8llu\n", i,
+                   (unsigned long long)file->extents[i].logical,
+                   (unsigned long long)file->extents[i].physical,
+                   (unsigned long long)file->extents[i].length);
+        }
+    }
+}
+
+static int frag_entry(minfs_t *fs, uint32_t ino, const struct inode *node,
+                      const char *path, void *arg) {
+    uint16_t type = node->mode & FILE_TYPE;
+
+    // only files and directories have zones of their own
+    if (type == REGULAR_FILE || type == MASK_DIR) {
+        frag_one(arg, ino, path);
+    }
+    return SUCCESS;
+}
+
+//! one histogram, a line per bucket that has anything in it
+static void print_histogram(const char *title, const uint64_t *counts) {
+    uint64_t most = 0;
+    char range[32];
+    uint64_t low;
+    int b;
+
+    for (b = 0; b < BUCKETS; b++) {
+        most = MAX(most, counts[b]);
+    }
+    if (!most) {
+        return;
+    }
+
+    printf("%s:\n", title);
+    for (b = 0; b < BUCKETS; b++) {
+        if (!counts[b]) {
+            continue;
+        }
+        low = 1ULL << b;
+        if (b == 0) {
+            sprintf(range, "1");
+        }
+        else if (b == BUCKETS - 1) {
+            sprintf(range, "%llu+", (unsigned long long)low);
+        }
+        else {
+            sprintf(range, "%llu-%llu", (unsigned long long)low,
+                    (unsigned long long)(low * 2 - 1));
+        }
+        printf("%14s %10llu %.*s\n", range, (unsigned long long)counts[b],
+               (int)((counts[b] * BAR_WIDTH + most - 1) / most),
+               "########################################");
+    }
+}
+
+//! looks at everything under the path in one filesystem
+static void frag_filesystem(struct fs_location *loc) {
+    struct frag_stats st;
+    const struct inode *node;
+    uint32_t ino;
+    int err;
+
+    memset(&st, 0, sizeof(st));
+    st.fs = open_filesystem();
+    st.file.zonesize = minfs_zonesize(st.fs);
+    if ((st.seen = calloc(minfs_ninodes(st.fs) + 1, 1)) == NULL) {
+        perror("calloc");
+        exit(ERROR);
+    }
+
+    ino = lookup_src_path(st.fs);
+    node = minfs_inode(st.fs, ino);
+    frag_one(&st, ino, path_arg_count ? src_path_string : "/");
+
+    if ((node->mode & FILE_TYPE) == MASK_DIR) {
+        err = minfs_walk(st.fs, ino, path_arg_count ? src_path_string : "/",
+                         frag_entry, &st);
+        if (err < 0) {
+            fprintf(stderr, "%s\n", minfs_strerror(err));
+            exit(ERROR);
+        }
+    }
+
+    // a single file only gets its own line (and map)
+    if (st.files > 1) {
+        printf("\n%llu files, %llu extents, %llu fragmented (%.1f%%)\n",
+               (unsigned long long)st.files, (unsigned long long)st.extents,
+               (unsigned long long)st.fragmented,
+               100.0 * st.fragmented / st.files);
+        printf("%llu zones of %u bytes, %.2f zones per extent, "
+               "%.2f extents per file\n", (unsigned long long)st.zones,
+               st.file.zonesize,
+               st.extents ? (double)st.zones / st.extents : 0.0,
+               (double)st.extents / st.files);
+        print_histogram("extents per file", st.per_file);
+        print_histogram("extent length in zones", st.lengths);
+    }
+
+    free(st.file.extents);
+    free(st.seen);
+    minfs_close(st.fs);
+}
+
+int main(int argc, char *argv[])
+{
+    minfs_image_t *disk_image;
+    struct fs_location *locs;
+    int count;
+    int err;
+    int ret;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    parse_cmd_line(argc, argv);
+
+    // with -a report on every filesystem in the partition tree
+    if (a_flag)
+    {
+        if ((disk_image = minfs_image_open(image_file, NULL, &err)) == NULL)
+        {
+            fprintf(stderr, "%s: %s\n", image_file, minfs_strerror(err));
+            exit(ERROR);
+        }
+
+        if ((count = scan_partitions(disk_image, &locs)) == 0)
+        {
+            fprintf(stderr, "No minix partitions found\n");
+            exit(ERROR);
+        }
+        minfs_image_close(disk_image);
+
+        ret = run_on_all_partitions(locs, count, frag_filesystem);
+        free(locs);
+        return ret;
+    }
+
+    frag_filesystem(NULL);
+    return SUCCESS;
+}
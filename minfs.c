@@ -0,0 +1,1184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "minfs_int.h"
+#include "arena.h"
+
+// the largest zone we will believe a superblock about (log_zone_size)
+#define MAX_LOG_ZONE 16
+
+// each thread gets an arena for the buffers a walk needs and the paths
+// minfs_walk builds, so looking up a path or walking a tree doesnt malloc
+// anything once the first few calls have grown it
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+/* Structures */
+
+// what read_zones carries down through the tables. the buffers are only
+// there for images that cant be mapped, a mapped one hands out pointers
+struct zone_walk {
+    minfs_t *fs;
+    uint8_t *zone_buf;
+    uint8_t *table_buf;
+    int map_only;       // only say where zones are, dont read them
+    uint8_t type;       // what the zones are, for a trace
+    uint64_t tables;    // indirect tables the walk went through
+    struct prefetch pf; // hints for the kernel while reading
+    minfs_zone_fn fn;
+    void *arg;
+};
+
+// what readdir passes through read_zones
+struct dir_walk {
+    minfs_dir_fn fn;
+    void *arg;
+};
+
+// what lookup is looking for in one directory
+struct dir_search {
+    const char *name;
+    size_t len;
+    uint32_t found;
+};
+
+// what a whole walk shares, however deep it goes
+struct walk_state {
+    minfs_t *fs;
+    minfs_walk_fn fn;
+    void *arg;
+    uint8_t *visited;   // a bit per inode, for directories already gone into
+};
+
+// what walk passes through readdir for one directory
+struct tree_walk {
+    struct walk_state *st;
+    const char *path;
+};
+
+void minfs_default_opts(struct minfs_opts *opts)
+{
+    opts->part = MINFS_NO_PARTITION;
+    opts->subpart = MINFS_NO_PARTITION;
+    opts->frame_cache = 0;
+    opts->direct = 0;
+    opts->drop_behind = 0;
+    opts->cache = NULL;
+    opts->trace = NULL;
+    opts->columns = 0;
+}
+
+/*
+ * bmap and pread are written once against a zonesize argument and always
+ * inlined, so the copies made for 1K and 4K zones (what nearly every
+ * image has) get it as a constant and the compiler turns every divide
+ * and remainder by it into a shift and a mask. Any other geometry gets
+ * the copy that reads fs->zonesize. load_filesystem picks which copies a
+ * filesystem uses, once.
+ */
+
+#define ZONE_READER static inline __attribute__ ((always_inline))
+
+//! entry i of the indirect table in zone table, a zero table is all holes
+ZONE_READER int table_entry_as(minfs_t *fs, uint32_t table, uint32_t i,
+                               uint32_t *zone, uint32_t zonesize)
+{
+    if (table == 0) {
+        *zone = 0;
+        return 0;
+    }
+    if (i >= zonesize / IZT_ENTRY_SIZE) {
+        return -MINFS_ECORRUPT;
+    }
+
+    trace_access(fs, MINFS_TRACE_INDIRECT,
+                 (uint64_t)table * zonesize + i * IZT_ENTRY_SIZE,
+                 IZT_ENTRY_SIZE);
+    return minfs_image_read(fs->img, fs->start +
+                            (uint64_t)table * zonesize +
+                            i * IZT_ENTRY_SIZE, IZT_ENTRY_SIZE, zone);
+}
+
+static int table_entry(minfs_t *fs, uint32_t table, uint32_t i,
+                       uint32_t *zone)
+{
+    return table_entry_as(fs, table, i, zone, fs->zonesize);
+}
+
+//! finds which zone holds zone number idx of a file (0 for a hole)
+//! going through the indirect and double indirect tables as needed
+
+ZONE_READER int bmap_as(minfs_t *fs, const struct inode *node, uint32_t idx,
+                        uint32_t *zone, uint32_t zonesize)
+{
+    uint32_t per_table = zonesize / IZT_ENTRY_SIZE;
+    uint32_t table;
+    int ret;
+
+    if (idx < DIRECT_ZONES) {
+        *zone = node->zone[idx];
+        return 0;
+    }
+    idx -= DIRECT_ZONES;
+
+    if (idx < per_table) {
+        return table_entry_as(fs, node->indirect, idx, zone, zonesize);
+    }
+    idx -= per_table;
+
+    if (idx < per_table * per_table) {
+        if ((ret = table_entry_as(fs, node->two_indirect, idx / per_table,
+                                  &table, zonesize)) < 0) {
+            return ret;
+        }
+        return table_entry_as(fs, table, idx % per_table, zone, zonesize);
+    }
+
+    return -EFBIG;
+}
+
+//! reads len bytes (already cut to the end of the file) from off into
+//! dst, holes read as zeros
+
+ZONE_READER ssize_t pread_as(minfs_t *fs, const struct inode *node,
+                             uint8_t *dst, size_t len, uint64_t off,
+                             uint32_t zonesize)
+{
+    size_t done = 0;
+    size_t chunk;
+    uint32_t in_zone;
+    uint32_t zone;
+    int ret;
+
+    while (done < len) {
+        // which zone of the file we are in and how far into it
+        in_zone = (off + done) % zonesize;
+        chunk = MIN(len - done, zonesize - in_zone);
+
+        if ((ret = bmap_as(fs, node, (off + done) / zonesize, &zone,
+                           zonesize)) < 0) {
+            return ret;
+        }
+
+        if (zone == 0) {
+            memset(dst + done, 0, chunk);
+            done += chunk;
+            continue;
+        }
+
+        trace_access(fs, (node->mode & FILE_TYPE) == MASK_DIR ?
+                     MINFS_TRACE_DIR : MINFS_TRACE_DATA,
+                     (uint64_t)zone * zonesize + in_zone, chunk);
+        if ((ret = minfs_image_read(fs->img, fs->start +
+                                    (uint64_t)zone * zonesize + in_zone,
+                                    chunk, dst + done)) < 0) {
+            return ret;
+        }
+        done += chunk;
+    }
+
+    return done;
+}
+
+// one copy of each for every geometry that has its own
+#define ZONE_READERS(name, zonesize) \
+    static int bmap_##name(minfs_t *fs, const struct inode *node, \
+                           uint32_t idx, uint32_t *zone) \
+    { \
+        return bmap_as(fs, node, idx, zone, zonesize); \
+    } \
+    static ssize_t pread_##name(minfs_t *fs, const struct inode *node, \
+                                uint8_t *dst, size_t len, uint64_t off) \
+    { \
+        return pread_as(fs, node, dst, len, off, zonesize); \
+    }
+
+ZONE_READERS(1k, 1024)
+ZONE_READERS(4k, 4096)
+ZONE_READERS(any, fs->zonesize)
+
+//! picks the readers for the zone size, called once the superblock is in
+static void pick_zone_readers(minfs_t *fs)
+{
+    if (fs->zonesize == 1024) {
+        fs->bmap = bmap_1k;
+        fs->pread = pread_1k;
+    }
+    else if (fs->zonesize == 4096) {
+        fs->bmap = bmap_4k;
+        fs->pread = pread_4k;
+    }
+    else {
+        fs->bmap = bmap_any;
+        fs->pread = pread_any;
+    }
+}
+
+//! reads entry num of the partition table in the sector at base
+//! making sure the table has its signature and the entry is minix
+
+static int read_partition(minfs_t *fs, uint64_t base, int num,
+                          struct partition *part)
+{
+    uint8_t table[SECTOR_SIZE];
+    int ret;
+
+    if (num < 0 || num > 3) {
+        return -EINVAL;
+    }
+    if ((ret = minfs_image_read(fs->img, base, SECTOR_SIZE, table)) < 0) {
+        return ret;
+    }
+
+    // the table ends in 0x55 0xAA
+    if (table[510] != PT_510 || table[511] != PT_511) {
+        return -MINFS_ESIGNATURE;
+    }
+
+    memcpy(part, table + PARTITION_TABLE_LOCATION +
+           num * sizeof(struct partition), sizeof(struct partition));
+
+    if (part->type != FILETYPE_MINIX) {
+        return -MINFS_ENOTMINIX;
+    }
+    return 0;
+}
+
+//! finds the filesystem (partition, superblock, inode table) in the image
+static int load_filesystem(minfs_t *fs, const struct minfs_opts *opts)
+{
+    uint64_t table;
+    uint64_t table_size;
+    int ret;
+
+    // partitions are in sectors, the start is in bytes
+    if (opts->part != MINFS_NO_PARTITION) {
+        if ((ret = read_partition(fs, 0, opts->part, &fs->part)) < 0) {
+            return ret;
+        }
+        fs->start = (uint64_t)fs->part.lFirst * SECTOR_SIZE;
+    }
+
+    // a subpartition table sits at the front of the partition
+    if (opts->subpart != MINFS_NO_PARTITION) {
+        if ((ret = read_partition(fs, fs->start, opts->subpart,
+                                  &fs->part)) < 0) {
+            return ret;
+        }
+        fs->start = (uint64_t)fs->part.lFirst * SECTOR_SIZE;
+    }
+
+    // the superblock is always one block into the filesystem
+    if ((ret = minfs_image_read(fs->img, fs->start + BLOCK_SIZE,
+                                sizeof(struct superblock), &fs->sb)) < 0) {
+        return ret;
+    }
+
+    if (fs->sb.magic != SUPERBLOCK_MAGIC) {
+        return -MINFS_EMAGIC;
+    }
+    if (fs->sb.blocksize == 0 || fs->sb.ninodes == 0 ||
+        fs->sb.log_zone_size < 0 || fs->sb.log_zone_size > MAX_LOG_ZONE) {
+        return -MINFS_ECORRUPT;
+    }
+
+    // calcualte the zone size (from bit shift in spec)
+    fs->zonesize = fs->sb.blocksize << fs->sb.log_zone_size;
+    pick_zone_readers(fs);
+
+    // a trace needs the zone size, so the superblock goes in it late
+    if (opts->trace) {
+        fs->trace = opts->trace;
+        trace_attach(fs);
+        trace_access(fs, MINFS_TRACE_SUPER, BLOCK_SIZE,
+                     sizeof(struct superblock));
+    }
+
+    // the inode table is past the boot block, the superblock and bitmaps
+    table = fs->start + (2 + (uint64_t)fs->sb.i_blocks + fs->sb.z_blocks) *
+            fs->sb.blocksize;
+    table_size = (uint64_t)fs->sb.ninodes * sizeof(struct inode);
+    if (table > minfs_image_size(fs->img) ||
+        table_size > minfs_image_size(fs->img) - table) {
+        return -MINFS_ECORRUPT;
+    }
+
+    // the whole table is read in one go, and the root right after it
+    image_advise(fs->img, table, table_size, ADVISE_WILLNEED);
+    trace_access(fs, MINFS_TRACE_INODES, table - fs->start, table_size);
+    if (opts->columns) {
+        return columns_load(fs, table);
+    }
+
+    if ((fs->inodes = malloc(table_size)) == NULL) {
+        return -ENOMEM;
+    }
+    return minfs_image_read(fs->img, table, table_size, fs->inodes);
+}
+
+//! opens the image and the filesystem in it, opts picks the partition
+//! (NULL means the image is just a filesystem). on failure returns NULL
+//! and puts the reason in err
+
+minfs_t *minfs_open(const char *image, const struct minfs_opts *opts,
+                    int *err)
+{
+    minfs_image_t *img;
+    minfs_t *fs;
+
+    if ((img = minfs_image_open(image, opts, err)) == NULL) {
+        return NULL;
+    }
+
+    // the filesystem keeps its own reference to the image
+    fs = minfs_open_image(img, opts, err);
+    minfs_image_close(img);
+    return fs;
+}
+
+//! opens the filesystem in an image that is already open, so several
+//! partitions of one image can share its mapping or frame cache
+
+minfs_t *minfs_open_image(minfs_image_t *img,
+                          const struct minfs_opts *opts, int *err)
+{
+    struct minfs_opts defaults;
+    minfs_t *fs;
+    int ret;
+
+    if (!opts) {
+        minfs_default_opts(&defaults);
+        opts = &defaults;
+    }
+
+    if ((fs = calloc(1, sizeof(minfs_t))) == NULL) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    __atomic_add_fetch(&img->refs, 1, __ATOMIC_ACQ_REL);
+    fs->img = img;
+
+    if ((ret = load_filesystem(fs, opts)) < 0) {
+        goto fail;
+    }
+    return fs;
+
+fail:
+    if (err) {
+        *err = ret;
+    }
+    minfs_close(fs);
+    return NULL;
+}
+
+void minfs_close(minfs_t *fs)
+{
+    uint32_t i;
+
+    if (!fs) {
+        return;
+    }
+    if (fs->links) {
+        for (i = 0; i <= fs->sb.ninodes; i++) {
+            free(fs->links[i]);
+        }
+        free(fs->links);
+    }
+    minfs_image_close(fs->img);
+    free(fs->inodes);
+    columns_free(fs->cols);
+    free(fs);
+}
+
+//! the message for an error code from any of these calls
+const char *minfs_strerror(int err)
+{
+    switch (-err) {
+        case MINFS_ESIGNATURE:
+            return "Partition table signature is not valid";
+        case MINFS_ENOTMINIX:
+            return "Not a minix partition";
+        case MINFS_EMAGIC:
+            return "Filesystem is not of type Minix";
+        case MINFS_ECORRUPT:
+            return "Filesystem points outside of the image";
+        case MINFS_EFORMAT:
+            return "Compressed image support is not built in";
+        case MINFS_ENOTSEEKABLE:
+            return "zstd image has no seek table";
+        case MINFS_EDAMAGED:
+            return "Compressed image is damaged";
+        default:
+            return strerror(-err);
+    }
+}
+
+const struct partition *minfs_partition(minfs_t *fs)
+{
+    return &fs->part;
+}
+
+const struct superblock *minfs_superblock(minfs_t *fs)
+{
+    return &fs->sb;
+}
+
+uint32_t minfs_zonesize(minfs_t *fs)
+{
+    return fs->zonesize;
+}
+
+uint32_t minfs_ninodes(minfs_t *fs)
+{
+    return fs->sb.ninodes;
+}
+
+//! the inode with number ino, or NULL if there isn't one (or the handle
+//! only has the table as columns)
+const struct inode *minfs_inode(minfs_t *fs, uint32_t ino)
+{
+    if (ino < ROOT_INODE || ino > fs->sb.ninodes || !fs->inodes) {
+        return NULL;
+    }
+    return &fs->inodes[ino - 1];
+}
+
+int minfs_stat(minfs_t *fs, uint32_t ino, struct minfs_stat *st)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+
+    if (!node) {
+        return -EINVAL;
+    }
+
+    st->ino = ino;
+    st->mode = node->mode;
+    st->links = node->links;
+    st->uid = node->uid;
+    st->gid = node->gid;
+    st->size = node->size;
+    st->atime = node->atime;
+    st->mtime = node->mtime;
+    st->ctime = node->ctime;
+    return 0;
+}
+
+//! points data at len bytes of a zone, read for type, scratch is where
+//! they go when the image is compressed (it can be NULL for a mapped one)
+
+static int zone_data(minfs_t *fs, uint8_t type, uint32_t zone, size_t len,
+                     uint8_t *scratch, const uint8_t **data)
+{
+    trace_access(fs, type, (uint64_t)zone * fs->zonesize, len);
+    return image_map(fs->img, fs->start + (uint64_t)zone * fs->zonesize,
+                     len, scratch, data);
+}
+
+//! hands one zone of a file to fn, *off is where in the file it starts
+static int visit_zone(struct zone_walk *walk, uint32_t zone, uint64_t *off,
+                      uint64_t size)
+{
+    // either the rest of the zone or the rest of the file
+    size_t len = MIN(size - *off, walk->fs->zonesize);
+    const uint8_t *data = NULL;
+    uint64_t at = *off;
+    int ret;
+
+    // holes are never read, the visitor decides what zeros mean to it
+    if (zone != 0 && !walk->map_only) {
+        prefetch_advance(&walk->pf, at);
+        if ((ret = zone_data(walk->fs, walk->type, zone, len,
+                             walk->zone_buf, &data)) < 0) {
+            return ret;
+        }
+    }
+
+    *off += len;
+    return walk->fn(data, len, at, zone, walk->arg);
+}
+
+//! hands every zone an indirect table points at to fn
+static int visit_table(struct zone_walk *walk, uint32_t table,
+                       uint64_t *off, uint64_t size)
+{
+    uint32_t per_table = walk->fs->zonesize / IZT_ENTRY_SIZE;
+    const uint8_t *entries = NULL;
+    uint32_t zone = 0;
+    uint32_t i;
+    int ret = 0;
+
+    // a missing table means every zone it would have had is a hole
+    if (table != 0 &&
+        (ret = zone_data(walk->fs, MINFS_TRACE_INDIRECT, table,
+                         walk->fs->zonesize, walk->table_buf,
+                         &entries)) < 0) {
+        return ret;
+    }
+    if (table != 0) {
+        walk->tables++;
+    }
+
+    for (i = 0; i < per_table && *off < size && !ret; i++) {
+        if (entries) {
+            memcpy(&zone, entries + i * IZT_ENTRY_SIZE, IZT_ENTRY_SIZE);
+        }
+        ret = visit_zone(walk, zone, off, size);
+    }
+    return ret;
+}
+
+static void scratch_destroy(void *arena)
+{
+    arena_free(arena);
+    free(arena);
+}
+
+static void scratch_key_create(void)
+{
+    pthread_key_create(&scratch_key, scratch_destroy);
+}
+
+//! the calling threads scratch arena, or NULL when out of memory
+static struct arena *scratch_arena(void)
+{
+    struct arena *arena;
+
+    pthread_once(&scratch_once, scratch_key_create);
+    if ((arena = pthread_getspecific(scratch_key)) == NULL) {
+        if ((arena = calloc(1, sizeof(struct arena))) == NULL) {
+            return NULL;
+        }
+        if (pthread_setspecific(scratch_key, arena)) {
+            free(arena);
+            return NULL;
+        }
+    }
+    return arena;
+}
+
+//! walks every zone of a file in order (direct, indirect, double indirect)
+//! and hands each one to fn. returns whatever non zero value fn stopped
+//! on, otherwise 0
+
+static int walk_zones(minfs_t *fs, uint32_t ino, minfs_zone_fn fn,
+                      void *arg, int map_only, uint64_t *tables)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+    uint32_t per_table;
+    struct zone_walk walk;
+    struct arena *scratch = NULL;
+    struct arena_mark mark;
+    uint64_t off = 0;
+    uint32_t table;
+    uint32_t i;
+    int ret = 0;
+
+    if (!node) {
+        return -EINVAL;
+    }
+    per_table = fs->zonesize / IZT_ENTRY_SIZE;
+
+    walk.fs = fs;
+    walk.fn = fn;
+    walk.arg = arg;
+    walk.map_only = map_only;
+    walk.type = (node->mode & FILE_TYPE) == MASK_DIR ? MINFS_TRACE_DIR :
+                MINFS_TRACE_DATA;
+    walk.tables = 0;
+    walk.zone_buf = NULL;
+    walk.table_buf = NULL;
+    memset(&walk.pf, 0, sizeof(walk.pf));
+
+    // unmapped (compressed or direct) zones have to be read somewhere
+    if (!fs->img->map) {
+        if ((scratch = scratch_arena()) == NULL) {
+            return -ENOMEM;
+        }
+        mark = arena_mark(scratch);
+        walk.zone_buf = map_only ? NULL : arena_alloc(scratch, fs->zonesize);
+        walk.table_buf = arena_alloc(scratch, fs->zonesize);
+        if ((!map_only && !walk.zone_buf) || !walk.table_buf) {
+            ret = -ENOMEM;
+        }
+    }
+
+    // work out what is coming so the kernel can start on it
+    if (!map_only && !ret) {
+        prefetch_start(fs, ino, &walk.pf);
+    }
+
+    // the direct zones first
+    for (i = 0; i < DIRECT_ZONES && off < node->size && !ret; i++) {
+        ret = visit_zone(&walk, node->zone[i], &off, node->size);
+    }
+
+    // then everything the indirect table points to
+    if (off < node->size && !ret) {
+        ret = visit_table(&walk, node->indirect, &off, node->size);
+    }
+
+    // and last the double indirect, a table of indirect tables
+    if (off < node->size && !ret && node->two_indirect != 0) {
+        walk.tables++;
+    }
+    for (i = 0; i < per_table && off < node->size && !ret; i++) {
+        if ((ret = table_entry(fs, node->two_indirect, i, &table)) < 0) {
+            break;
+        }
+        ret = visit_table(&walk, table, &off, node->size);
+    }
+
+    if (tables) {
+        *tables = walk.tables;
+    }
+    if (!map_only) {
+        prefetch_end(&walk.pf);
+    }
+    if (scratch) {
+        arena_release(scratch, mark);
+    }
+    return ret;
+}
+
+//! hands every zone of a file to fn straight out of the image mapping
+//! when there is one
+int minfs_read_zones(minfs_t *fs, uint32_t ino, minfs_zone_fn fn,
+                     void *arg)
+{
+    return walk_zones(fs, ino, fn, arg, 0, NULL);
+}
+
+//! the same walk, but only the indirect tables are read: fn gets where
+//! each zone is with data always NULL (zone 0 is still a hole)
+int minfs_map_zones(minfs_t *fs, uint32_t ino, minfs_zone_fn fn, void *arg)
+{
+    return walk_zones(fs, ino, fn, arg, 1, NULL);
+}
+
+static int count_zone(const uint8_t *data, size_t len, uint64_t off,
+                      uint32_t zone, void *arg)
+{
+    if (zone != 0) {
+        (*(uint64_t *)arg)++;
+    }
+    return 0;
+}
+
+//! how many zones a file really has allocated: its data zones plus the
+//! indirect tables that point at them (holes dont count, unlike size)
+
+int minfs_alloc_zones(minfs_t *fs, uint32_t ino, uint64_t *zones)
+{
+    uint64_t data = 0;
+    uint64_t tables = 0;
+    int ret;
+
+    if ((ret = walk_zones(fs, ino, count_zone, &data, 1, &tables)) < 0) {
+        return ret;
+    }
+    *zones = data + tables;
+    return 0;
+}
+
+//! reads len bytes of a file from off into buf, holes read as zeros.
+//! returns how many bytes there were (less than len at the end of file)
+
+ssize_t minfs_pread(minfs_t *fs, uint32_t ino, void *buf, size_t len,
+                    uint64_t off)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+
+    if (!node) {
+        return -EINVAL;
+    }
+    if (off >= node->size) {
+        return 0;
+    }
+    return fs->pread(fs, node, buf, MIN(len, node->size - off), off);
+}
+
+//! pulls the directory entries out of one zone of a directory
+static int dir_zone(const uint8_t *data, size_t len, uint64_t off,
+                    uint32_t zone, void *arg)
+{
+    struct dir_walk *walk = arg;
+    const struct directory *entry;
+    struct minfs_dirent ent;
+    size_t i;
+    int ret;
+
+    // a hole in a directory has no entries in it
+    if (!data) {
+        return 0;
+    }
+
+    for (i = 0; i + sizeof(struct directory) <= len;
+         i += sizeof(struct directory)) {
+        entry = (const struct directory *)(data + i);
+
+        // skip deleted entries
+        if (entry->inode == 0) {
+            continue;
+        }
+
+        // names fill the whole field when they are 60 long, no terminator
+        ent.ino = entry->inode;
+        memcpy(ent.name, entry->name, DIR_NAME_SIZE);
+        ent.name[DIR_NAME_SIZE] = '\0';
+
+        if ((ret = walk->fn(&ent, walk->arg)) != 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+//! hands every live entry of directory ino to fn
+int minfs_readdir(minfs_t *fs, uint32_t ino, minfs_dir_fn fn, void *arg)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+    struct dir_walk walk;
+
+    if (!node) {
+        return -EINVAL;
+    }
+    if ((node->mode & FILE_TYPE) != MASK_DIR) {
+        return -ENOTDIR;
+    }
+
+    walk.fn = fn;
+    walk.arg = arg;
+    return minfs_read_zones(fs, ino, dir_zone, &walk);
+}
+
+//! hands up to limit live entries to fn, starting at cur. finding where
+//! a zone is only reads the indirect table entry for it, so a page deep
+//! in a big directory costs the same as the first one. cur is left on
+//! the entry after the last one fn got
+
+int minfs_readdir_page(minfs_t *fs, uint32_t ino, struct minfs_dircursor *cur,
+                       uint32_t limit, minfs_dir_fn fn, void *arg)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+    uint32_t per_zone = fs->zonesize / sizeof(struct directory);
+    const struct directory *entry;
+    const uint8_t *data = NULL;
+    struct arena *scratch = NULL;
+    struct arena_mark mark;
+    struct minfs_dirent ent;
+    uint8_t *zone_buf = NULL;
+    uint64_t at;
+    uint32_t zone;
+    size_t len;
+    int ret = 0;
+
+    if (!node) {
+        return -EINVAL;
+    }
+    if ((node->mode & FILE_TYPE) != MASK_DIR) {
+        return -ENOTDIR;
+    }
+    if (cur->entry >= per_zone) {
+        return -EINVAL;
+    }
+
+    // unmapped (compressed or direct) zones have to be read somewhere
+    if (!fs->img->map) {
+        if ((scratch = scratch_arena()) == NULL) {
+            return -ENOMEM;
+        }
+        mark = arena_mark(scratch);
+        if ((zone_buf = arena_alloc(scratch, fs->zonesize)) == NULL) {
+            arena_release(scratch, mark);
+            return -ENOMEM;
+        }
+    }
+
+    while (cur->zone != MINFS_DIR_END && limit > 0 && !ret) {
+        at = (uint64_t)cur->zone * fs->zonesize;
+        if (at >= node->size) {
+            cur->zone = MINFS_DIR_END;
+            cur->entry = 0;
+            break;
+        }
+        len = MIN(node->size - at, fs->zonesize);
+
+        // a hole in a directory has no entries in it
+        if ((ret = fs->bmap(fs, node, cur->zone, &zone)) < 0 ||
+            (zone != 0 &&
+             (ret = zone_data(fs, MINFS_TRACE_DIR, zone, len, zone_buf,
+                              &data)) < 0)) {
+            break;
+        }
+
+        for (; zone != 0 && limit > 0 && !ret &&
+             (cur->entry + 1) * sizeof(struct directory) <= len;
+             cur->entry++) {
+            entry = (const struct directory *)data + cur->entry;
+            if (entry->inode == 0) {
+                continue;
+            }
+
+            ent.ino = entry->inode;
+            memcpy(ent.name, entry->name, DIR_NAME_SIZE);
+            ent.name[DIR_NAME_SIZE] = '\0';
+            limit--;
+            ret = fn(&ent, arg);
+        }
+
+        // the rest of this zone is next time, unless there isnt any
+        if (cur->entry < per_zone &&
+            (uint64_t)(cur->entry + 1) * sizeof(struct directory) <= len &&
+            zone != 0) {
+            break;
+        }
+        cur->zone++;
+        cur->entry = 0;
+    }
+
+    // so a page that ends with the directory says so
+    if (cur->zone != MINFS_DIR_END &&
+        (uint64_t)cur->zone * fs->zonesize >= node->size) {
+        cur->zone = MINFS_DIR_END;
+        cur->entry = 0;
+    }
+
+    if (scratch) {
+        arena_release(scratch, mark);
+    }
+    return ret;
+}
+
+static int match_entry(const struct minfs_dirent *ent, void *arg)
+{
+    struct dir_search *search = arg;
+
+    if (strlen(ent->name) == search->len &&
+        !memcmp(ent->name, search->name, search->len)) {
+        search->found = ent->ino;
+        return 1;
+    }
+    return 0;
+}
+
+//! hints every zone a directory has in its inode, the lookup is about
+//! to read through all of them
+
+static void prefetch_dir(minfs_t *fs, uint32_t ino)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+    uint64_t left;
+    int i;
+
+    if (!node) {
+        return;
+    }
+    left = node->size;
+    for (i = 0; i < DIRECT_ZONES && left > 0; i++) {
+        if (node->zone[i]) {
+            image_advise(fs->img, fs->start +
+                         (uint64_t)node->zone[i] * fs->zonesize,
+                         MIN(left, fs->zonesize), ADVISE_WILLNEED);
+        }
+        left -= MIN(left, fs->zonesize);
+    }
+}
+
+//! the target of symlink ino, read out of the image the first time and
+//! kept in the handle after that. NULL (with the reason in err) if it
+//! isnt a symlink or cant be read
+
+static const char *link_target(minfs_t *fs, uint32_t ino, int *err)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+    char **links;
+    char **none = NULL;
+    char *target;
+    char *empty = NULL;
+    ssize_t got;
+
+    if (!node || (node->mode & FILE_TYPE) != SYM_LINK_TYPE) {
+        *err = -EINVAL;
+        return NULL;
+    }
+
+    // the slots are only made once something needs one
+    if ((links = __atomic_load_n(&fs->links, __ATOMIC_ACQUIRE)) == NULL) {
+        if ((links = calloc(fs->sb.ninodes + 1, sizeof(char *))) == NULL) {
+            *err = -ENOMEM;
+            return NULL;
+        }
+        if (!__atomic_compare_exchange_n(&fs->links, &none, links, 0,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            free(links);
+            links = none;
+        }
+    }
+    if ((target = __atomic_load_n(&links[ino], __ATOMIC_ACQUIRE)) != NULL) {
+        return target;
+    }
+
+    if (node->size >= PATH_MAX) {
+        *err = -ENAMETOOLONG;
+        return NULL;
+    }
+    if ((target = malloc(node->size + 1)) == NULL) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+    if ((got = minfs_pread(fs, ino, target, node->size, 0)) != node->size) {
+        free(target);
+        *err = got < 0 ? got : -MINFS_ECORRUPT;
+        return NULL;
+    }
+    target[got] = '\0';
+
+    // two threads can read the same link at once, the first one in wins
+    if (!__atomic_compare_exchange_n(&links[ino], &empty, target, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(target);
+        target = empty;
+    }
+    return target;
+}
+
+//! puts the target of symlink ino in buf like readlink does (not
+//! terminated, cut off at len) and returns how long it really is
+
+ssize_t minfs_readlink(minfs_t *fs, uint32_t ino, char *buf, size_t len)
+{
+    const char *target;
+    size_t size;
+    int err;
+
+    if ((target = link_target(fs, ino, &err)) == NULL) {
+        return err;
+    }
+    size = strlen(target);
+    memcpy(buf, target, MIN(size, len));
+    return size;
+}
+
+//! goes down the path one name at a time from the root and gives back
+//! the inode number of whatever is at the end of it. a symlink carries
+//! on from its target with the rest of the path after it, the last name
+//! is only followed when follow is set (or the path ends in a slash)
+
+static int lookup(minfs_t *fs, const char *path, int follow, uint32_t *ino)
+{
+    struct dir_search search;
+    uint32_t current = ROOT_INODE;
+    struct inode node_buf;
+    const struct inode *node;
+    struct arena *scratch = NULL;
+    struct arena_mark mark;
+    const char *target;
+    const char *end;
+    char *joined;
+    int links = 0;
+    int ret = 0;
+
+    while (*path) {
+        // slashes just separate names, any number of them
+        while (*path == '/') {
+            path++;
+        }
+        if (!*path) {
+            break;
+        }
+
+        if ((end = strchr(path, '/')) == NULL) {
+            end = path + strlen(path);
+        }
+        if (end - path > DIR_NAME_SIZE) {
+            ret = -ENAMETOOLONG;
+            break;
+        }
+
+        search.name = path;
+        search.len = end - path;
+        search.found = 0;
+
+        // readdir says if what we are in isn't a directory
+        prefetch_dir(fs, current);
+        if ((ret = minfs_readdir(fs, current, match_entry, &search)) < 0) {
+            break;
+        }
+        if (!search.found) {
+            ret = -ENOENT;
+            break;
+        }
+        if ((node = get_inode(fs, search.found, &node_buf)) == NULL) {
+            ret = -MINFS_ECORRUPT;
+            break;
+        }
+        path = end;
+
+        if ((node->mode & FILE_TYPE) != SYM_LINK_TYPE ||
+            (!follow && *end != '/')) {
+            current = search.found;
+            continue;
+        }
+
+        // the rest of the path now goes on from the links target, which
+        // starts at the root or in the directory the link is in
+        if (++links > MINFS_MAX_SYMLINKS) {
+            ret = -ELOOP;
+            break;
+        }
+        if ((target = link_target(fs, search.found, &ret)) == NULL) {
+            break;
+        }
+        if (!*target) {
+            ret = -ENOENT;
+            break;
+        }
+
+        if (!scratch) {
+            if ((scratch = scratch_arena()) == NULL) {
+                return -ENOMEM;
+            }
+            mark = arena_mark(scratch);
+        }
+        if ((joined = arena_alloc(scratch, strlen(target) + strlen(path) +
+                                  1)) == NULL) {
+            ret = -ENOMEM;
+            break;
+        }
+        sprintf(joined, "%s%s", target, path);
+        if (*target == '/') {
+            current = ROOT_INODE;
+        }
+        path = joined;
+    }
+
+    if (scratch) {
+        arena_release(scratch, mark);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    *ino = current;
+    return 0;
+}
+
+int minfs_lookup(minfs_t *fs, const char *path, uint32_t *ino)
+{
+    return lookup(fs, path, 0, ino);
+}
+
+int minfs_resolve(minfs_t *fs, const char *path, uint32_t *ino)
+{
+    return lookup(fs, path, 1, ino);
+}
+
+int minfs_name_ok(const char *name)
+{
+    return *name && strcmp(name, ".") && strcmp(name, "..") &&
+           !strchr(name, '/');
+}
+
+static int walk_dir(struct walk_state *st, uint32_t ino, const char *path);
+
+static int walk_entry(const struct minfs_dirent *ent, void *arg)
+{
+    struct tree_walk *walk = arg;
+    struct walk_state *st = walk->st;
+    struct inode node_buf;
+    const struct inode *node;
+    size_t path_len = strlen(walk->path);
+    struct arena *scratch;
+    struct arena_mark mark;
+    char *child;
+    int ret;
+
+    // skip the links back up
+    if (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")) {
+        return 0;
+    }
+
+    // a name with a slash in it would make a path to somewhere else
+    if (!minfs_name_ok(ent->name) ||
+        (node = get_inode(st->fs, ent->ino, &node_buf)) == NULL) {
+        return -MINFS_ECORRUPT;
+    }
+
+    if ((scratch = scratch_arena()) == NULL) {
+        return -ENOMEM;
+    }
+    mark = arena_mark(scratch);
+    if ((child = arena_alloc(scratch, path_len + strlen(ent->name) + 2)) ==
+        NULL) {
+        arena_release(scratch, mark);
+        return -ENOMEM;
+    }
+
+    // dont double up the slash when we start at the root
+    if (path_len && walk->path[path_len - 1] == '/') {
+        sprintf(child, "%s%s", walk->path, ent->name);
+    }
+    else {
+        sprintf(child, "%s/%s", walk->path, ent->name);
+    }
+
+    ret = st->fn(st->fs, ent->ino, node, child, st->arg);
+
+    // keep going down through directories
+    if (!ret && (node->mode & FILE_TYPE) == MASK_DIR) {
+        ret = walk_dir(st, ent->ino, child);
+    }
+
+    arena_release(scratch, mark);
+    return ret;
+}
+
+static int walk_dir(struct walk_state *st, uint32_t ino, const char *path)
+{
+    struct tree_walk walk;
+
+    // a directory met twice means the tree loops back on itself, going
+    // in again would never end
+    if (st->visited[ino / 8] & (1 << (ino % 8))) {
+        return -MINFS_ECORRUPT;
+    }
+    st->visited[ino / 8] |= 1 << (ino % 8);
+
+    walk.st = st;
+    walk.path = path;
+    return minfs_readdir(st->fs, ino, walk_entry, &walk);
+}
+
+//! goes through everything below directory ino, depth first
+//! fn gets every entry except . and .. with path put in front of its name
+//! fails with MINFS_ECORRUPT if a directory turns up twice
+
+int minfs_walk(minfs_t *fs, uint32_t ino, const char *path,
+               minfs_walk_fn fn, void *arg)
+{
+    struct walk_state st;
+    int ret;
+
+    if (ino < ROOT_INODE || ino > fs->sb.ninodes) {
+        return -MINFS_ECORRUPT;
+    }
+    if ((st.visited = calloc(fs->sb.ninodes / 8 + 1, 1)) == NULL) {
+        return -ENOMEM;
+    }
+    st.fs = fs;
+    st.fn = fn;
+    st.arg = arg;
+    ret = walk_dir(&st, ino, path);
+    free(st.visited);
+    return ret;
+}
@@ -0,0 +1,246 @@
+#ifndef MINFS_H
+#define MINFS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "minfunc.h" //for the on disk structs
+
+/*
+ * libminfs: read access to a minix filesystem image through a handle.
+ *
+ * Everything about one open filesystem (the image mapping, the partition,
+ * the superblock and the inode table) lives in its minfs_t, so a process
+ * can have as many images open as it likes. A handle is never changed
+ * after minfs_open returns, so every call below can be made from several
+ * threads on the same handle at once.
+ *
+ * Calls that can fail return 0 (or a byte count) on success and a negative
+ * error code otherwise, minfs_strerror turns that into a message.
+ *
+ * Images can be plain, gzip or seekable zstd (when the library is built
+ * with them). A compressed image is only ever decompressed a frame at a
+ * time, as zones in that frame are asked for, and the last few frames
+ * are kept around.
+ *
+ * A plain image or block device can also be read with O_DIRECT (the
+ * direct option) so reading a big image doesnt push everything else out
+ * of the page cache. Compressed images always go through the page cache.
+ * A mapped image tells the kernel which zones a big file is going to need
+ * next, and with drop_behind which ones it is done with.
+ *
+ * Lookups follow symlinks. A handle keeps every link target it has read,
+ * so a path that goes through the same links over and over only reads
+ * each of them once. That cache is the one thing in a handle that
+ * changes after minfs_open, and it is safe to fill from any thread.
+ *
+ * Compressed images can share one minfs_cache_t (the cache option)
+ * instead of each keeping its own frames, so a process with hundreds of
+ * them open has a single limit on how much it holds decompressed.
+ *
+ * A handle opened with a minfs_trace_t (the trace option) writes down
+ * every piece of the filesystem it reads and what it was for, so real
+ * runs can be replayed against caches that dont exist yet (mintrace).
+ */
+
+//macros
+#define MINFS_NO_PARTITION (-1)
+#define MINFS_MAX_SYMLINKS 40   // links one lookup follows before ELOOP
+
+// errors that are about the image itself rather than an errno
+#define MINFS_EBASE 1000
+#define MINFS_ESIGNATURE (MINFS_EBASE + 1)  // no partition table signature
+#define MINFS_ENOTMINIX (MINFS_EBASE + 2)   // partition is not type minix
+#define MINFS_EMAGIC (MINFS_EBASE + 3)      // superblock magic is wrong
+#define MINFS_ECORRUPT (MINFS_EBASE + 4)    // points outside the image
+#define MINFS_EFORMAT (MINFS_EBASE + 5)     // compression not built in
+#define MINFS_ENOTSEEKABLE (MINFS_EBASE + 6)// zstd without a seek table
+#define MINFS_EDAMAGED (MINFS_EBASE + 7)    // compressed data is broken
+
+typedef struct minfs minfs_t;
+typedef struct minfs_image minfs_image_t;
+typedef struct minfs_names minfs_names_t;
+typedef struct minfs_cache minfs_cache_t;
+typedef struct minfs_trace minfs_trace_t;
+
+// what a traced read was for
+#define MINFS_TRACE_FS 0        // not a read, a filesystem joined the trace
+#define MINFS_TRACE_SUPER 1
+#define MINFS_TRACE_INODES 2    // the inode table
+#define MINFS_TRACE_DIR 3       // a zone of a directory
+#define MINFS_TRACE_INDIRECT 4  // an indirect table, or one entry of it
+#define MINFS_TRACE_DATA 5      // a zone of anything else
+#define MINFS_TRACE_TYPES 6
+
+/* Structures */
+struct minfs_opts {
+    int part;       // primary partition or MINFS_NO_PARTITION
+    int subpart;    // subpartition or MINFS_NO_PARTITION
+    int frame_cache;// decompressed frames to keep, 0 for the default
+    int direct;     // read a plain image or device with O_DIRECT
+    int drop_behind;// drop file data from the page cache once it is read
+    minfs_cache_t *cache; // shared frame cache instead of frame_cache
+    minfs_trace_t *trace; // record every read into this, NULL for not
+    int columns;    // keep the inode table only as minfs_columns
+};
+
+// one read out of a trace. zone is where it starts in filesystem fs, and
+// len runs from the start of that zone. a MINFS_TRACE_FS record has the
+// zone size of fs in len instead
+struct minfs_trace_record {
+    uint32_t fs;
+    uint8_t type;
+    uint32_t zone;
+    uint64_t len;
+};
+
+// how a shared cache is doing
+struct minfs_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;     // held right now
+    uint64_t peak;      // the most it has held at once
+    uint64_t entries;
+};
+
+struct minfs_stat {
+    uint32_t ino;
+    uint16_t mode;
+    uint16_t links;
+    uint16_t uid;
+    uint16_t gid;
+    uint32_t size;
+    int32_t atime;
+    int32_t mtime;
+    int32_t ctime;
+};
+
+// the inode table one field per array, index i is inode i + 1. every
+// column starts on a cache line. the zone slab has MINFS_ZONE_SLOTS
+// pointers per inode: the direct zones, then indirect and double indirect
+#define MINFS_ZONE_SLOTS (DIRECT_ZONES + 2)
+
+struct minfs_columns {
+    uint32_t count;
+    uint16_t *mode;
+    uint16_t *links;
+    uint16_t *uid;
+    uint16_t *gid;
+    uint32_t *size;
+    int32_t *atime;
+    int32_t *mtime;
+    int32_t *ctime;
+    uint32_t *zones;
+};
+
+struct minfs_dirent {
+    uint32_t ino;
+    char name[DIR_NAME_SIZE + 1]; // always terminated
+};
+
+// gets each piece of a file in order. data is NULL (and zone 0) for a hole
+// and is only good until fn returns.
+// return non zero to stop, the walk then returns that value
+typedef int (*minfs_zone_fn)(const uint8_t *data, size_t len, uint64_t off,
+                             uint32_t zone, void *arg);
+
+// where a paged readdir is up to: the zone of the directory (counted
+// in the file, not on disk) and the entry in it. zone is MINFS_DIR_END
+// once the whole directory has been read
+struct minfs_dircursor {
+    uint32_t zone;
+    uint32_t entry;
+};
+
+#define MINFS_DIR_END UINT32_MAX
+
+// gets every live entry of a directory, including . and ..
+typedef int (*minfs_dir_fn)(const struct minfs_dirent *ent, void *arg);
+
+// gets everything below a directory with its full path
+typedef int (*minfs_walk_fn)(minfs_t *fs, uint32_t ino,
+                             const struct inode *node, const char *path,
+                             void *arg);
+
+//functions
+void minfs_default_opts(struct minfs_opts *opts);
+minfs_t *minfs_open(const char *image, const struct minfs_opts *opts,
+                    int *err);
+minfs_t *minfs_open_image(minfs_image_t *img,
+                          const struct minfs_opts *opts, int *err);
+void minfs_close(minfs_t *fs);
+const char *minfs_strerror(int err);
+
+// the image underneath, for looking at partition tables and such
+minfs_image_t *minfs_image_open(const char *path,
+                                const struct minfs_opts *opts, int *err);
+int minfs_image_read(minfs_image_t *img, uint64_t off, size_t len,
+                     void *buf);
+uint64_t minfs_image_size(minfs_image_t *img);
+void minfs_image_close(minfs_image_t *img);
+
+const struct partition *minfs_partition(minfs_t *fs);
+const struct superblock *minfs_superblock(minfs_t *fs);
+uint32_t minfs_zonesize(minfs_t *fs);
+uint32_t minfs_ninodes(minfs_t *fs);
+
+// the inode table is one array in memory, so minfs_inode(fs, ROOT_INODE)
+// can be walked as a whole to look at every inode in order. a handle
+// opened with columns has no such array and minfs_inode is always NULL,
+// minfs_stat still works on it
+const struct inode *minfs_inode(minfs_t *fs, uint32_t ino);
+int minfs_stat(minfs_t *fs, uint32_t ino, struct minfs_stat *st);
+
+// lookup follows symlinks everywhere but the last name (like lstat),
+// resolve follows that one too (like stat)
+int minfs_lookup(minfs_t *fs, const char *path, uint32_t *ino);
+int minfs_resolve(minfs_t *fs, const char *path, uint32_t *ino);
+ssize_t minfs_readlink(minfs_t *fs, uint32_t ino, char *buf, size_t len);
+int minfs_readdir(minfs_t *fs, uint32_t ino, minfs_dir_fn fn, void *arg);
+
+// whether a name out of a directory is one name and nothing more: not
+// empty, . or .., and no / in it. anything made from a name has to check
+int minfs_name_ok(const char *name);
+
+// at most limit entries from where cur is and moves cur past them. only
+// the zones those entries are in get read, none before them
+int minfs_readdir_page(minfs_t *fs, uint32_t ino, struct minfs_dircursor *cur,
+                       uint32_t limit, minfs_dir_fn fn, void *arg);
+int minfs_read_zones(minfs_t *fs, uint32_t ino, minfs_zone_fn fn,
+                     void *arg);
+int minfs_map_zones(minfs_t *fs, uint32_t ino, minfs_zone_fn fn, void *arg);
+int minfs_alloc_zones(minfs_t *fs, uint32_t ino, uint64_t *zones);
+ssize_t minfs_pread(minfs_t *fs, uint32_t ino, void *buf, size_t len,
+                    uint64_t off);
+int minfs_walk(minfs_t *fs, uint32_t ino, const char *path,
+               minfs_walk_fn fn, void *arg);
+
+// a frame cache shared by every image opened with it, holding at most
+// limit bytes. it can be used from any thread, and has to outlive the
+// images using it
+minfs_cache_t *minfs_cache_create(size_t limit);
+void minfs_cache_free(minfs_cache_t *cache);
+void minfs_cache_stats(minfs_cache_t *cache, struct minfs_cache_stats *st);
+
+// a trace any number of handles can write into at once (each gets its
+// own number in it). it has to outlive them, and close says if any of
+// it couldnt be written
+minfs_trace_t *minfs_trace_open(const char *path, int *err);
+int minfs_trace_close(minfs_trace_t *trace);
+int minfs_trace_load(const char *path, struct minfs_trace_record **records,
+                     size_t *count);
+
+// inode number to path, for inodes found without walking the tree.
+// the map only reads the filesystem, build it once and share it
+minfs_names_t *minfs_names_build(minfs_t *fs, int *err);
+void minfs_names_free(minfs_names_t *names);
+int minfs_names_count(minfs_names_t *names, uint32_t ino);
+int minfs_names_path(minfs_names_t *names, uint32_t ino, int n, char *buf,
+                     size_t len);
+
+// the inode table as columns, for sweeps over every inode that only need
+// a few fields. only a handle opened with columns has them (NULL for any
+// other), they are filled as the table is read and belong to the handle
+const struct minfs_columns *minfs_columns(minfs_t *fs);
+
+#endif
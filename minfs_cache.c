@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "minfs_int.h"
+
+/*
+ * A cache of decompressed frames that any number of images can share.
+ * Each compressed image normally keeps its own FRAME_CACHE_DEFAULT
+ * frames, which is fine for one image but adds up with hundreds of them
+ * open. Images opened with a shared cache keep nothing of their own, and
+ * the cache throws out the frame used longest ago whenever holding
+ * another would take it over its limit (a limit smaller than one frame
+ * still holds that one frame).
+ *
+ * Frames are decompressed outside the cache lock (under the images own
+ * lock, which the backend needs anyway), so a slow frame in one image
+ * doesnt hold up hits in the others. Two readers missing the same frame
+ * at once both decompress it and the second copy is just dropped.
+ */
+
+#define CACHE_BUCKETS 4096
+
+/* Structures */
+
+// one decompressed frame in the cache
+struct cache_entry {
+    uint64_t owner;             // the cache_id of the image it is from
+    uint64_t frame;
+    uint8_t *data;
+    size_t len;
+    struct cache_entry *chain;  // next in the same bucket
+    struct cache_entry *newer;  // the use list, newest at the head
+    struct cache_entry *older;
+};
+
+struct minfs_cache {
+    pthread_mutex_t lock;
+    size_t limit;
+    struct cache_entry *buckets[CACHE_BUCKETS];
+    struct cache_entry *newest;
+    struct cache_entry *oldest;
+    struct minfs_cache_stats stats;
+};
+
+// every image that uses a cache gets its own id, they are never reused
+static uint64_t next_id = 1;
+
+//! a cache that holds at most limit bytes of decompressed frames
+minfs_cache_t *minfs_cache_create(size_t limit)
+{
+    minfs_cache_t *cache;
+
+    if ((cache = calloc(1, sizeof(minfs_cache_t))) == NULL) {
+        return NULL;
+    }
+    cache->limit = limit;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+//! frees the cache, every image using it has to be closed first
+void minfs_cache_free(minfs_cache_t *cache)
+{
+    struct cache_entry *e;
+    struct cache_entry *next;
+
+    if (!cache) {
+        return;
+    }
+    for (e = cache->newest; e; e = next) {
+        next = e->older;
+        free(e->data);
+        free(e);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+void minfs_cache_stats(minfs_cache_t *cache, struct minfs_cache_stats *st)
+{
+    pthread_mutex_lock(&cache->lock);
+    *st = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+//! an id for an image that is going to use the cache
+uint64_t cache_new_id(void)
+{
+    return __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t bucket_of(uint64_t owner, uint64_t frame)
+{
+    uint64_t h = (owner * 0x9E3779B97F4A7C15ULL) ^ frame;
+
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return (h >> 32) % CACHE_BUCKETS;
+}
+
+static struct cache_entry **find_slot(minfs_cache_t *cache, uint64_t owner,
+                                      uint64_t frame)
+{
+    struct cache_entry **slot = &cache->buckets[bucket_of(owner, frame)];
+
+    while (*slot && ((*slot)->owner != owner || (*slot)->frame != frame)) {
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+static void unlink_use(minfs_cache_t *cache, struct cache_entry *e)
+{
+    if (e->newer) {
+        e->newer->older = e->older;
+    }
+    else {
+        cache->newest = e->older;
+    }
+    if (e->older) {
+        e->older->newer = e->newer;
+    }
+    else {
+        cache->oldest = e->newer;
+    }
+}
+
+static void push_use(minfs_cache_t *cache, struct cache_entry *e)
+{
+    e->newer = NULL;
+    e->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = e;
+    }
+    cache->newest = e;
+    if (!cache->oldest) {
+        cache->oldest = e;
+    }
+}
+
+//! takes e out of the cache and frees it. has to be called with the
+//! lock held
+static void drop_entry(minfs_cache_t *cache, struct cache_entry *e)
+{
+    struct cache_entry **slot = find_slot(cache, e->owner, e->frame);
+
+    *slot = e->chain;
+    unlink_use(cache, e);
+    cache->stats.bytes -= e->len;
+    cache->stats.entries--;
+    free(e->data);
+    free(e);
+}
+
+//! copies len bytes from in_frame into frame of image owner into buf if
+//! the frame is cached. returns 1 if it was, 0 if it has to be loaded
+
+int cache_read(minfs_cache_t *cache, uint64_t owner, uint64_t frame,
+               uint64_t in_frame, size_t len, uint8_t *buf)
+{
+    struct cache_entry *e;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((e = *find_slot(cache, owner, frame)) == NULL) {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+
+    memcpy(buf, e->data + in_frame, len);
+    unlink_use(cache, e);
+    push_use(cache, e);
+    cache->stats.hits++;
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+}
+
+//! gives a frame that was just decompressed (len bytes, from malloc) to
+//! the cache, which frees it when it goes. one another reader put in
+//! first is freed straight away. a frame bigger than the whole cache
+//! still goes in once everything else is out, or a small cache would
+//! decompress the same frame for every zone in it
+
+void cache_insert(minfs_cache_t *cache, uint64_t owner, uint64_t frame,
+                  uint8_t *data, size_t len)
+{
+    struct cache_entry **slot;
+    struct cache_entry *e;
+
+    if ((e = malloc(sizeof(*e))) == NULL) {
+        free(data);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (*(slot = find_slot(cache, owner, frame)) != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        free(data);
+        free(e);
+        return;
+    }
+
+    // make room, oldest first
+    while (cache->oldest && cache->stats.bytes + len > cache->limit) {
+        drop_entry(cache, cache->oldest);
+        cache->stats.evictions++;
+    }
+
+    e->owner = owner;
+    e->frame = frame;
+    e->data = data;
+    e->len = len;
+    e->chain = NULL;
+    *find_slot(cache, owner, frame) = e;
+    push_use(cache, e);
+    cache->stats.bytes += len;
+    cache->stats.peak = MAX(cache->stats.peak, cache->stats.bytes);
+    cache->stats.entries++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+//! drops every frame of an image that is being closed
+void cache_forget(minfs_cache_t *cache, uint64_t owner)
+{
+    struct cache_entry *e;
+    struct cache_entry *older;
+
+    pthread_mutex_lock(&cache->lock);
+    for (e = cache->newest; e; e = older) {
+        older = e->older;
+        if (e->owner == owner) {
+            drop_entry(cache, e);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
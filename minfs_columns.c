@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "minfs_int.h"
+
+/*
+ * The inode table turned on its side: one array per field instead of one
+ * packed 64 byte struct per inode. A sweep that only asks about mode and
+ * size then reads 6 bytes an inode instead of a whole cache line, and the
+ * loops over plain aligned arrays are ones the compiler can vectorize.
+ * The zone pointers go in a slab of their own since only the tools that
+ * care where the data is look at them.
+ */
+
+#define COLUMN_ALIGN 64 // a cache line, and wide enough for any vector
+#define COLUMN_CHUNK 1024 // inodes read at a time, 64K of table
+
+//! one column, cache line aligned and rounded up to a whole line so a
+//! vector loop can run off the end of the last inode without faulting
+
+static void *alloc_column(uint32_t count, size_t size)
+{
+    size_t bytes = ((size_t)count * size + COLUMN_ALIGN - 1) &
+                   ~(size_t)(COLUMN_ALIGN - 1);
+    void *column;
+
+    if (posix_memalign(&column, COLUMN_ALIGN, bytes)) {
+        return NULL;
+    }
+    memset(column, 0, bytes);
+    return column;
+}
+
+//! reads the inode table at table (in the image) into columns on the
+//! handle. it comes in a chunk at a time, and each chunk is split up
+//! into the columns as soon as it is in, so the packed table is never
+//! all in memory at once
+
+int columns_load(minfs_t *fs, uint64_t table)
+{
+    struct minfs_columns *cols = calloc(1, sizeof(struct minfs_columns));
+    struct inode *chunk = malloc(sizeof(struct inode) * COLUMN_CHUNK);
+    const struct inode *node;
+    uint32_t *zones;
+    uint32_t count = fs->sb.ninodes;
+    uint32_t i;
+    uint32_t j;
+    uint32_t n;
+    int err;
+
+    if (!cols || !chunk) {
+        free(cols);
+        free(chunk);
+        return -ENOMEM;
+    }
+    cols->count = count;
+    cols->mode = alloc_column(count, sizeof(uint16_t));
+    cols->links = alloc_column(count, sizeof(uint16_t));
+    cols->uid = alloc_column(count, sizeof(uint16_t));
+    cols->gid = alloc_column(count, sizeof(uint16_t));
+    cols->size = alloc_column(count, sizeof(uint32_t));
+    cols->atime = alloc_column(count, sizeof(int32_t));
+    cols->mtime = alloc_column(count, sizeof(int32_t));
+    cols->ctime = alloc_column(count, sizeof(int32_t));
+    cols->zones = alloc_column(count, sizeof(uint32_t) * MINFS_ZONE_SLOTS);
+
+    if (!cols->mode || !cols->links || !cols->uid || !cols->gid ||
+        !cols->size || !cols->atime || !cols->mtime || !cols->ctime ||
+        !cols->zones) {
+        columns_free(cols);
+        free(chunk);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < count; i += n) {
+        n = MIN(COLUMN_CHUNK, count - i);
+        if ((err = minfs_image_read(fs->img, table +
+                                    (uint64_t)i * sizeof(struct inode),
+                                    n * sizeof(struct inode), chunk)) < 0) {
+            columns_free(cols);
+            free(chunk);
+            return err;
+        }
+
+        for (j = 0; j < n; j++) {
+            node = &chunk[j];
+            cols->mode[i + j] = node->mode;
+            cols->links[i + j] = node->links;
+            cols->uid[i + j] = node->uid;
+            cols->gid[i + j] = node->gid;
+            cols->size[i + j] = node->size;
+            cols->atime[i + j] = node->atime;
+            cols->mtime[i + j] = node->mtime;
+            cols->ctime[i + j] = node->ctime;
+
+            zones = &cols->zones[(size_t)(i + j) * MINFS_ZONE_SLOTS];
+            memcpy(zones, node->zone, sizeof(node->zone));
+            zones[DIRECT_ZONES] = node->indirect;
+            zones[DIRECT_ZONES + 1] = node->two_indirect;
+        }
+    }
+
+    free(chunk);
+    fs->cols = cols;
+    return 0;
+}
+
+//! puts inode i + 1 back together from the columns, for the library
+//! calls that want the whole thing
+void columns_inode(const struct minfs_columns *cols, uint32_t i,
+                   struct inode *node)
+{
+    const uint32_t *zones = &cols->zones[(size_t)i * MINFS_ZONE_SLOTS];
+
+    memset(node, 0, sizeof(struct inode));
+    node->mode = cols->mode[i];
+    node->links = cols->links[i];
+    node->uid = cols->uid[i];
+    node->gid = cols->gid[i];
+    node->size = cols->size[i];
+    node->atime = cols->atime[i];
+    node->mtime = cols->mtime[i];
+    node->ctime = cols->ctime[i];
+    memcpy(node->zone, zones, sizeof(node->zone));
+    node->indirect = zones[DIRECT_ZONES];
+    node->two_indirect = zones[DIRECT_ZONES + 1];
+}
+
+const struct minfs_columns *minfs_columns(minfs_t *fs)
+{
+    return fs->cols;
+}
+
+void columns_free(struct minfs_columns *cols)
+{
+    if (!cols) {
+        return;
+    }
+    free(cols->mode);
+    free(cols->links);
+    free(cols->uid);
+    free(cols->gid);
+    free(cols->size);
+    free(cols->atime);
+    free(cols->mtime);
+    free(cols->ctime);
+    free(cols->zones);
+    free(cols);
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE // for O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h> // BLKSSZGET
+
+// linux/fs.h has its own BLOCK_SIZE, ours is the same 1024
+#undef BLOCK_SIZE
+#include "minfs_int.h"
+
+/*
+ * Plain images (or block devices) read with O_DIRECT, so nothing we read
+ * ends up in the page cache. The kernel wants the offset, the length and
+ * the buffer all aligned to the devices logical block size, so every read
+ * goes through one of a few aligned bounce buffers: the zones asked for
+ * are rounded out to whole blocks, read into a buffer, and copied out.
+ * Small reads are stretched out to DIRECT_READAHEAD bytes and the buffers
+ * remember what they hold, so reading a file zone by zone turns into a
+ * few big sequential reads. A read that is already aligned at both ends
+ * and into an aligned buffer skips the bounce and goes straight in.
+ */
+
+#define DIRECT_ALIGN_DEFAULT 4096 // what every filesystem we know accepts
+
+//! the logical block size O_DIRECT wants for this file or device
+static uint32_t direct_align(int fd, struct stat *st)
+{
+    int sector;
+
+    if (S_ISBLK(st->st_mode) && ioctl(fd, BLKSSZGET, &sector) == 0 &&
+        sector > 0) {
+        return sector;
+    }
+    return DIRECT_ALIGN_DEFAULT;
+}
+
+//! switches fd over to O_DIRECT and sets up the buffer pool
+int direct_open(int fd, struct stat *st, int nbufs,
+                struct direct_image **direct)
+{
+    struct direct_image *d;
+    void *buf;
+    int flags;
+    int i;
+
+    if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+        fcntl(fd, F_SETFL, flags | O_DIRECT) < 0) {
+        return -errno;
+    }
+
+    if ((d = calloc(1, sizeof(struct direct_image))) == NULL) {
+        return -ENOMEM;
+    }
+    d->fd = fd;
+    d->align = direct_align(fd, st);
+    d->buf_size = DIRECT_BUF_SIZE;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->freed, NULL);
+
+    if ((d->bufs = calloc(nbufs, sizeof(struct direct_buf))) == NULL) {
+        direct_free(d);
+        return -ENOMEM;
+    }
+    for (i = 0; i < nbufs; i++) {
+        if (posix_memalign(&buf, d->align, d->buf_size)) {
+            direct_free(d);
+            return -ENOMEM;
+        }
+        d->bufs[d->nbufs++].data = buf;
+    }
+
+    *direct = d;
+    return 0;
+}
+
+void direct_free(struct direct_image *d)
+{
+    int i;
+
+    if (d->bufs) {
+        for (i = 0; i < d->nbufs; i++) {
+            free(d->bufs[i].data);
+        }
+        free(d->bufs);
+    }
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->freed);
+    free(d);
+}
+
+//! takes a buffer for reading [off, off + len), one that already holds it
+//! if there is one, otherwise the one used longest ago. waits for another
+//! reader to give one back if they are all out
+
+static struct direct_buf *take_buffer(struct direct_image *d, uint64_t off,
+                                      size_t len)
+{
+    struct direct_buf *pick;
+    struct direct_buf *buf;
+    int i;
+
+    pthread_mutex_lock(&d->lock);
+    for (;;) {
+        pick = NULL;
+        for (i = 0; i < d->nbufs; i++) {
+            buf = &d->bufs[i];
+            if (buf->busy) {
+                continue;
+            }
+            if (off >= buf->start && off + len <= buf->start + buf->valid) {
+                pick = buf;
+                break;
+            }
+            if (!pick || buf->last_used < pick->last_used) {
+                pick = buf;
+            }
+        }
+        if (pick) {
+            break;
+        }
+        pthread_cond_wait(&d->freed, &d->lock);
+    }
+    pick->busy = 1;
+    pick->last_used = ++d->clock;
+    pthread_mutex_unlock(&d->lock);
+    return pick;
+}
+
+static void give_buffer(struct direct_image *d, struct direct_buf *buf)
+{
+    pthread_mutex_lock(&d->lock);
+    buf->busy = 0;
+    pthread_cond_signal(&d->freed);
+    pthread_mutex_unlock(&d->lock);
+}
+
+//! pread that keeps going after short reads, it is only short at the end
+//! of the file. returns how much it got or a negative errno
+
+static ssize_t read_fully(int fd, uint8_t *buf, size_t len, uint64_t off)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len) {
+        n = pread(fd, buf + got, len - got, off + got);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+//! copies len bytes at off out of the image without the page cache
+int direct_read(struct direct_image *d, uint64_t off, size_t len,
+                uint8_t *out)
+{
+    uint64_t mask = d->align - 1;
+    struct direct_buf *buf;
+    uint64_t start;
+    size_t span;
+    size_t chunk;
+    ssize_t got;
+
+    // big aligned reads go straight into the callers buffer
+    if (len >= DIRECT_READAHEAD && !(off & mask) && !(len & mask) &&
+        !((uintptr_t)out & mask)) {
+        got = read_fully(d->fd, out, len, off);
+        if (got < 0) {
+            return got;
+        }
+        return (size_t)got == len ? 0 : -MINFS_ECORRUPT;
+    }
+
+    while (len > 0) {
+        start = off & ~mask;
+        chunk = MIN(len, d->buf_size - (off - start));
+        buf = take_buffer(d, off, chunk);
+
+        // round out to whole blocks and read ahead while we are there
+        if (off < buf->start || off + chunk > buf->start + buf->valid) {
+            span = (off - start + chunk + mask) & ~mask;
+            span = MIN(MAX(span, DIRECT_READAHEAD), d->buf_size);
+
+            buf->valid = 0;
+            if ((got = read_fully(d->fd, buf->data, span, start)) < 0) {
+                give_buffer(d, buf);
+                return got;
+            }
+            buf->start = start;
+            buf->valid = got;
+            if ((size_t)got < off - start + chunk) {
+                give_buffer(d, buf);
+                return -MINFS_ECORRUPT;
+            }
+        }
+        memcpy(out, buf->data + (off - buf->start), chunk);
+        give_buffer(d, buf);
+
+        out += chunk;
+        off += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
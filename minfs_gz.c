@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "minfs_int.h"
+
+/*
+ * gzip images. gzip can't be entered in the middle, so on open the whole
+ * stream is inflated once and every GZ_SPAN bytes (at a deflate block
+ * boundary) we remember where we were in the compressed data and the 32K
+ * of output before it. Inflating can then restart at any checkpoint, and
+ * the spans between checkpoints are the frames the cache holds.
+ */
+
+#ifdef MINFS_ZLIB
+
+#include <zlib.h>
+
+#define GZ_SPAN (1 << 20)   // decompressed bytes between checkpoints
+#define GZ_WINDOW 32768     // how far back deflate can reach
+#define GZ_CHUNK 16384      // compressed bytes read at a time
+
+/* Structures */
+struct gz_point {
+    uint64_t in;                // compressed offset to restart from
+    int bits;                   // bits of the byte before in still unused
+    uint8_t window[GZ_WINDOW];  // the output just before this point
+};
+
+struct gz_index {
+    int fd;
+    struct gz_point *points;
+    uint8_t input[GZ_CHUNK];    // only used under the frame cache lock
+};
+
+//! remembers a checkpoint, window is circular with left bytes unused
+static int add_point(struct framed_image *fr, struct gz_index *gz,
+                     int bits, uint64_t in, uint64_t out, unsigned left,
+                     const uint8_t *window)
+{
+    struct gz_point *point;
+    uint64_t *starts;
+
+    starts = realloc(fr->starts, sizeof(uint64_t) * (fr->count + 2));
+    if (!starts) {
+        return -ENOMEM;
+    }
+    fr->starts = starts;
+
+    point = realloc(gz->points, sizeof(struct gz_point) * (fr->count + 1));
+    if (!point) {
+        return -ENOMEM;
+    }
+    gz->points = point;
+    point += fr->count;
+
+    point->in = in;
+    point->bits = bits;
+
+    // put the window in order, oldest byte first
+    if (left) {
+        memcpy(point->window, window + GZ_WINDOW - left, left);
+    }
+    if (left < GZ_WINDOW) {
+        memcpy(point->window + left, window, GZ_WINDOW - left);
+    }
+
+    fr->starts[fr->count++] = out;
+    return 0;
+}
+
+//! inflates the whole stream once to find the checkpoints
+static int build_index(struct framed_image *fr, struct gz_index *gz)
+{
+    uint8_t *window;
+    z_stream strm;
+    uint64_t in_pos = 0;    // how much we have read from the file
+    uint64_t total_in = 0;  // how much inflate has used
+    uint64_t total_out = 0;
+    uint64_t last = 0;
+    ssize_t got;
+    int ret;
+
+    if ((window = malloc(GZ_WINDOW)) == NULL) {
+        return -ENOMEM;
+    }
+
+    memset(&strm, 0, sizeof(strm));
+    // 47 is a 32K window and take either a gzip or zlib header
+    if (inflateInit2(&strm, 47) != Z_OK) {
+        free(window);
+        return -ENOMEM;
+    }
+
+    strm.avail_out = 0;
+    do {
+        if ((got = pread(gz->fd, gz->input, GZ_CHUNK, in_pos)) < 0) {
+            ret = -errno;
+            goto done;
+        }
+        if (got == 0) {
+            // ran out of file before the stream ended
+            ret = -MINFS_EDAMAGED;
+            goto done;
+        }
+        in_pos += got;
+        strm.avail_in = got;
+        strm.next_in = gz->input;
+
+        do {
+            if (strm.avail_out == 0) {
+                strm.avail_out = GZ_WINDOW;
+                strm.next_out = window;
+            }
+
+            // inflate one deflate block at a time so we see the edges
+            total_in += strm.avail_in;
+            total_out += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);
+            total_in -= strm.avail_in;
+            total_out -= strm.avail_out;
+
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+                ret == Z_MEM_ERROR) {
+                ret = -MINFS_EDAMAGED;
+                goto done;
+            }
+            if (ret == Z_STREAM_END) {
+                break;
+            }
+
+            // at the end of a block (but not the last one) far enough on
+            if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                (total_out == 0 || total_out - last > GZ_SPAN)) {
+                if ((ret = add_point(fr, gz, strm.data_type & 7, total_in,
+                                     total_out, strm.avail_out,
+                                     window)) < 0) {
+                    goto done;
+                }
+                last = total_out;
+            }
+        } while (strm.avail_in != 0);
+    } while (ret != Z_STREAM_END);
+
+    ret = 0;
+    if (fr->count == 0 || total_out == 0) {
+        ret = -MINFS_EDAMAGED;
+    }
+    else {
+        fr->starts[fr->count] = total_out;
+    }
+
+done:
+    inflateEnd(&strm);
+    free(window);
+    return ret;
+}
+
+//! inflates the span after checkpoint frame into out
+static int gz_load(struct framed_image *fr, uint64_t frame, uint8_t *out)
+{
+    struct gz_index *gz = fr->priv;
+    struct gz_point *point = &gz->points[frame];
+    uint64_t in_pos = point->in - (point->bits ? 1 : 0);
+    z_stream strm;
+    ssize_t got;
+    int ret;
+
+    memset(&strm, 0, sizeof(strm));
+    // raw deflate, we are starting in the middle of the stream
+    if (inflateInit2(&strm, -15) != Z_OK) {
+        return -ENOMEM;
+    }
+
+    // a checkpoint can be part way through a byte
+    if (point->bits) {
+        if ((got = pread(gz->fd, gz->input, 1, in_pos++)) != 1) {
+            ret = -MINFS_EDAMAGED;
+            goto done;
+        }
+        inflatePrime(&strm, point->bits, gz->input[0] >> (8 - point->bits));
+    }
+    inflateSetDictionary(&strm, point->window, GZ_WINDOW);
+
+    strm.next_out = out;
+    strm.avail_out = fr->starts[frame + 1] - fr->starts[frame];
+
+    ret = Z_OK;
+    while (strm.avail_out > 0) {
+        if (strm.avail_in == 0) {
+            if ((got = pread(gz->fd, gz->input, GZ_CHUNK, in_pos)) <= 0) {
+                ret = -MINFS_EDAMAGED;
+                goto done;
+            }
+            in_pos += got;
+            strm.avail_in = got;
+            strm.next_in = gz->input;
+        }
+
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+            ret == Z_MEM_ERROR ||
+            (ret == Z_STREAM_END && strm.avail_out > 0)) {
+            ret = -MINFS_EDAMAGED;
+            goto done;
+        }
+    }
+    ret = 0;
+
+done:
+    inflateEnd(&strm);
+    return ret;
+}
+
+static void gz_release(struct framed_image *fr)
+{
+    struct gz_index *gz = fr->priv;
+
+    if (gz) {
+        free(gz->points);
+        free(gz);
+    }
+}
+
+//! sets up a gzip image, building its checkpoint index
+int gz_open(int fd, struct framed_image **framed)
+{
+    struct framed_image *fr;
+    struct gz_index *gz;
+    int ret;
+
+    if ((fr = calloc(1, sizeof(struct framed_image))) == NULL) {
+        return -ENOMEM;
+    }
+    if ((gz = calloc(1, sizeof(struct gz_index))) == NULL) {
+        free(fr);
+        return -ENOMEM;
+    }
+
+    gz->fd = fd;
+    fr->priv = gz;
+    fr->load = gz_load;
+    fr->release = gz_release;
+    *framed = fr;
+
+    if ((ret = build_index(fr, gz)) < 0) {
+        return ret;
+    }
+    return 0;
+}
+
+#else
+
+int gz_open(int fd, struct framed_image **framed)
+{
+    return -MINFS_EFORMAT;
+}
+
+#endif
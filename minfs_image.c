@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h> // BLKSSZGET and BLKGETSIZE64
+
+// linux/fs.h has its own BLOCK_SIZE, ours is the same 1024
+#undef BLOCK_SIZE
+#include "minfs_int.h"
+
+// the first bytes of the compressed formats we know about
+#define GZIP_MAGIC0 0x1f
+#define GZIP_MAGIC1 0x8b
+#define ZSTD_MAGIC 0xFD2FB528U
+
+/* images */
+
+//! looks at the front of the file to see how it is stored
+//! and sets up the matching backend (mapped, direct, gzip or zstd)
+
+static int image_setup(minfs_image_t *img, struct stat *st,
+                       const struct minfs_opts *opts)
+{
+    int nslots = (opts && opts->frame_cache > 0) ? opts->frame_cache :
+                 FRAME_CACHE_DEFAULT;
+    uint8_t magic[4] = {0, 0, 0, 0};
+    uint32_t zstd_magic;
+    void *map;
+    int ret;
+
+    if (pread(img->fd, magic, sizeof(magic), 0) < 0) {
+        return -errno;
+    }
+    memcpy(&zstd_magic, magic, sizeof(zstd_magic));
+
+    if (magic[0] == GZIP_MAGIC0 && magic[1] == GZIP_MAGIC1) {
+        ret = gz_open(img->fd, &img->framed);
+    }
+    else if (zstd_magic == ZSTD_MAGIC) {
+        ret = zstd_open(img->fd, st->st_size, &img->framed);
+    }
+    else if (opts && opts->direct) {
+        // plain image around the page cache, zones get copied out
+        img->size = st->st_size;
+        return direct_open(img->fd, st, DIRECT_BUFFERS, &img->direct);
+    }
+    else {
+        // plain image, map the whole thing and zones are just pointers
+        map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, img->fd, 0);
+        if (map == MAP_FAILED) {
+            return -errno;
+        }
+        img->map = map;
+        img->size = st->st_size;
+        return 0;
+    }
+
+    if (ret < 0) {
+        return ret;
+    }
+    if ((ret = framed_setup(img->framed, nslots,
+                            opts ? opts->cache : NULL)) < 0) {
+        return ret;
+    }
+    img->size = img->framed->starts[img->framed->count];
+    return 0;
+}
+
+//! opens an image file on its own, without looking for a filesystem in it
+minfs_image_t *minfs_image_open(const char *path,
+                                const struct minfs_opts *opts, int *err)
+{
+    minfs_image_t *img;
+    struct stat st;
+    uint64_t dev_size;
+    int ret;
+
+    if ((img = calloc(1, sizeof(minfs_image_t))) == NULL) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    img->refs = 1;
+    img->fd = -1;
+
+    if ((img->fd = open(path, O_RDONLY)) < 0 || fstat(img->fd, &st) < 0) {
+        ret = -errno;
+        goto fail;
+    }
+
+    // a block device has no size of its own, ask the driver
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(img->fd, BLKGETSIZE64, &dev_size) < 0) {
+            ret = -errno;
+            goto fail;
+        }
+        st.st_size = dev_size;
+    }
+    if (st.st_size == 0) {
+        ret = -MINFS_ECORRUPT;
+        goto fail;
+    }
+
+    ret = image_setup(img, &st, opts);
+    if (ret < 0) {
+        goto fail;
+    }
+    img->drop_behind = opts && opts->drop_behind;
+    return img;
+
+fail:
+    if (err) {
+        *err = ret;
+    }
+    minfs_image_close(img);
+    return NULL;
+}
+
+//! drops a reference, the image goes away with the last one
+void minfs_image_close(minfs_image_t *img)
+{
+    if (!img || __atomic_sub_fetch(&img->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    if (img->map) {
+        munmap((void *)img->map, img->size);
+    }
+    if (img->framed) {
+        framed_free(img->framed);
+    }
+    if (img->direct) {
+        direct_free(img->direct);
+    }
+    if (img->fd >= 0) {
+        close(img->fd);
+    }
+    free(img);
+}
+
+uint64_t minfs_image_size(minfs_image_t *img)
+{
+    return img->size;
+}
+
+//! copies len bytes at off out of the image
+int minfs_image_read(minfs_image_t *img, uint64_t off, size_t len,
+                     void *buf)
+{
+    if (off > img->size || len > img->size - off) {
+        return -MINFS_ECORRUPT;
+    }
+    if (img->map) {
+        memcpy(buf, img->map + off, len);
+        return 0;
+    }
+    if (img->direct) {
+        return direct_read(img->direct, off, len, buf);
+    }
+    return framed_read(img->framed, off, len, buf);
+}
+
+//! points data at len bytes of the image at off. for a mapped image that
+//! is right in the mapping, otherwise it is read or decompressed into
+//! scratch
+
+int image_map(minfs_image_t *img, uint64_t off, size_t len,
+              uint8_t *scratch, const uint8_t **data)
+{
+    int ret;
+
+    if (off > img->size || len > img->size - off) {
+        return -MINFS_ECORRUPT;
+    }
+    if (img->map) {
+        *data = img->map + off;
+        return 0;
+    }
+    if (img->direct) {
+        ret = direct_read(img->direct, off, len, scratch);
+    }
+    else {
+        ret = framed_read(img->framed, off, len, scratch);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    *data = scratch;
+    return 0;
+}
+
+/* framed (compressed) images */
+
+//! makes the frame cache once the backend has worked out its frames, or
+//! hooks the image up to a shared one
+
+int framed_setup(struct framed_image *fr, int nslots, minfs_cache_t *cache)
+{
+    uint64_t i;
+
+    fr->frame_max = 0;
+    for (i = 0; i < fr->count; i++) {
+        fr->frame_max = MAX(fr->frame_max, fr->starts[i + 1] - fr->starts[i]);
+    }
+
+    fr->cache = cache;
+    if (cache) {
+        fr->cache_id = cache_new_id();
+    }
+    else if ((fr->slots = calloc(nslots, sizeof(struct frame_slot))) ==
+             NULL) {
+        return -ENOMEM;
+    }
+    fr->nslots = cache ? 0 : nslots;
+    fr->clock = 0;
+    pthread_mutex_init(&fr->lock, NULL);
+    fr->lock_ready = 1;
+    return 0;
+}
+
+void framed_free(struct framed_image *fr)
+{
+    int i;
+
+    if (fr->cache) {
+        cache_forget(fr->cache, fr->cache_id);
+    }
+    if (fr->slots) {
+        for (i = 0; i < fr->nslots; i++) {
+            free(fr->slots[i].data);
+        }
+        free(fr->slots);
+    }
+    if (fr->lock_ready) {
+        pthread_mutex_destroy(&fr->lock);
+    }
+    if (fr->release) {
+        fr->release(fr);
+    }
+    free(fr->starts);
+    free(fr);
+}
+
+//! which frame off is in, a binary search over where they start
+static uint64_t find_frame(struct framed_image *fr, uint64_t off)
+{
+    uint64_t low = 0;
+    uint64_t high = fr->count - 1;
+    uint64_t mid;
+
+    while (low < high) {
+        mid = (low + high + 1) / 2;
+        if (fr->starts[mid] <= off) {
+            low = mid;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+//! the cache slot with frame in it, decompressing it if it isn't there.
+//! has to be called with the lock held
+
+static int cached_frame(struct framed_image *fr, uint64_t frame,
+                        struct frame_slot **found)
+{
+    struct frame_slot *slot = NULL;
+    int ret;
+    int i;
+
+    for (i = 0; i < fr->nslots; i++) {
+        if (fr->slots[i].valid && fr->slots[i].frame == frame) {
+            slot = &fr->slots[i];
+            break;
+        }
+    }
+
+    if (!slot) {
+        // throw out whichever frame was used longest ago
+        slot = &fr->slots[0];
+        for (i = 1; i < fr->nslots; i++) {
+            if (!fr->slots[i].valid) {
+                slot = &fr->slots[i];
+                break;
+            }
+            if (slot->valid && fr->slots[i].last_used < slot->last_used) {
+                slot = &fr->slots[i];
+            }
+        }
+
+        if (!slot->data && (slot->data = malloc(fr->frame_max)) == NULL) {
+            return -ENOMEM;
+        }
+
+        slot->valid = 0;
+        if ((ret = fr->load(fr, frame, slot->data)) < 0) {
+            return ret;
+        }
+        slot->frame = frame;
+        slot->valid = 1;
+    }
+
+    slot->last_used = ++fr->clock;
+    *found = slot;
+    return 0;
+}
+
+//! framed_read for an image using a shared cache. a frame that isnt in it
+//! is decompressed into its own buffer, which is then handed to the cache
+
+static int shared_read(struct framed_image *fr, uint64_t off, size_t len,
+                       uint8_t *buf)
+{
+    uint64_t frame;
+    uint64_t in_frame;
+    size_t frame_len;
+    size_t chunk;
+    uint8_t *data;
+    int ret = 0;
+
+    while (len > 0) {
+        frame = find_frame(fr, off);
+        in_frame = off - fr->starts[frame];
+        chunk = MIN(len, fr->starts[frame + 1] - off);
+
+        if (!cache_read(fr->cache, fr->cache_id, frame, in_frame, chunk,
+                        buf)) {
+            frame_len = fr->starts[frame + 1] - fr->starts[frame];
+            if ((data = malloc(frame_len)) == NULL) {
+                return -ENOMEM;
+            }
+
+            // the backend decompresses through buffers of the image
+            pthread_mutex_lock(&fr->lock);
+            ret = fr->load(fr, frame, data);
+            pthread_mutex_unlock(&fr->lock);
+            if (ret < 0) {
+                free(data);
+                return ret;
+            }
+
+            memcpy(buf, data + in_frame, chunk);
+            cache_insert(fr->cache, fr->cache_id, frame, data, frame_len);
+        }
+
+        buf += chunk;
+        off += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+//! copies len bytes at off out of the decompressed image, going frame by
+//! frame and only decompressing the frames that arent cached already
+
+int framed_read(struct framed_image *fr, uint64_t off, size_t len,
+                uint8_t *buf)
+{
+    struct frame_slot *slot;
+    uint64_t frame;
+    uint64_t in_frame;
+    size_t chunk;
+    int ret = 0;
+
+    if (fr->cache) {
+        return shared_read(fr, off, len, buf);
+    }
+
+    pthread_mutex_lock(&fr->lock);
+    while (len > 0) {
+        frame = find_frame(fr, off);
+        in_frame = off - fr->starts[frame];
+        chunk = MIN(len, fr->starts[frame + 1] - off);
+
+        if ((ret = cached_frame(fr, frame, &slot)) < 0) {
+            break;
+        }
+        memcpy(buf, slot->data + in_frame, chunk);
+
+        buf += chunk;
+        off += chunk;
+        len -= chunk;
+    }
+    pthread_mutex_unlock(&fr->lock);
+    return ret;
+}
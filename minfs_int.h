@@ -0,0 +1,207 @@
+#ifndef MINFS_INT_H
+#define MINFS_INT_H
+
+/*
+ * Pieces of libminfs shared between its own files. Nothing outside the
+ * library should include this, the tools only get minfs.h.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "minfs.h"
+
+//macros
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define FRAME_CACHE_DEFAULT 8 // decompressed frames kept per image
+
+#define DIRECT_BUF_SIZE (1 << 20)   // biggest single O_DIRECT read
+#define DIRECT_READAHEAD (1 << 18)  // smallest one
+#define DIRECT_BUFFERS 4            // bounce buffers shared by the readers
+
+#define PREFETCH_WINDOW (4 << 20)   // how far ahead of a stream to hint
+#define PREFETCH_MIN_SIZE (1 << 18) // files smaller than this arent worth it
+#define ADVISE_WILLNEED 0
+#define ADVISE_DONTNEED 1
+
+/* Structures */
+
+// one decompressed frame sitting in the cache
+struct frame_slot {
+    uint64_t frame;         // which frame is in here
+    uint8_t *data;
+    uint64_t last_used;     // for picking what to throw out
+    int valid;
+};
+
+// images that are stored as a run of independently decompressible frames
+// (seekable zstd frames or the spans between gzip checkpoints)
+struct framed_image {
+    uint64_t *starts;       // where each frame starts once decompressed
+    uint64_t count;         // starts[count] is the end of the image
+    size_t frame_max;       // the biggest a frame gets decompressed
+
+    // decompresses frame n (starts[n + 1] - starts[n] bytes) into out
+    int (*load)(struct framed_image *fr, uint64_t frame, uint8_t *out);
+    void (*release)(struct framed_image *fr);
+    void *priv;             // what the backend needs to do that
+
+    pthread_mutex_t lock;   // the cache is shared by every reader
+    int lock_ready;         // framed_setup got far enough to make it
+    struct frame_slot *slots;
+    int nslots;
+    uint64_t clock;
+
+    // with a shared cache the frames go there instead of in slots, and
+    // lock is only held while one is decompressed
+    minfs_cache_t *cache;
+    uint64_t cache_id;
+};
+
+// one aligned bounce buffer and the piece of the image it holds
+struct direct_buf {
+    uint8_t *data;
+    uint64_t start;
+    size_t valid;           // bytes of data that are good, 0 for none
+    uint64_t last_used;
+    int busy;               // a reader is using it
+};
+
+// a plain image read with O_DIRECT through a pool of aligned buffers
+struct direct_image {
+    int fd;
+    uint32_t align;         // the logical block size, reads are in these
+    size_t buf_size;
+    pthread_mutex_t lock;
+    pthread_cond_t freed;   // a buffer was given back
+    struct direct_buf *bufs;
+    int nbufs;
+    uint64_t clock;
+};
+
+struct minfs_image {
+    uint64_t size;              // bytes in the image (decompressed)
+    const uint8_t *map;         // the whole image when it can be mapped
+    int fd;
+    struct framed_image *framed;// for compressed images, NULL otherwise
+    struct direct_image *direct;// for O_DIRECT, NULL otherwise
+    int drop_behind;            // drop streamed data from the page cache
+    int refs;                   // the caller plus every minfs_t using it
+};
+
+// one run of zones that follow each other both in the file and on disk
+struct extent {
+    uint64_t file;          // where it starts in the file
+    uint64_t disk;          // and in the image
+    uint64_t len;
+};
+
+// the hints for one file being streamed
+struct prefetch {
+    minfs_t *fs;
+    struct extent *extents;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t next_ahead;    // first run not completely hinted yet
+    uint32_t next_behind;   // first run not dropped yet
+    uint64_t ahead;         // hinted up to here in the file
+    int active;
+};
+
+struct minfs {
+    minfs_image_t *img;
+    uint64_t start;             // where the filesystem starts in the image
+    struct partition part;      // the partition it is in (zeros for none)
+    struct superblock sb;
+    uint32_t zonesize;
+    struct inode *inodes;       // the whole inode table, inode n is [n - 1]
+    struct minfs_columns *cols; // or the table as columns instead, then
+                                // inodes is NULL
+
+    // random access into files, built for the zone size (see minfs.c)
+    int (*bmap)(minfs_t *fs, const struct inode *node, uint32_t idx,
+                uint32_t *zone);
+    ssize_t (*pread)(minfs_t *fs, const struct inode *node, uint8_t *dst,
+                     size_t len, uint64_t off);
+
+    minfs_trace_t *trace;       // where reads are written down, or NULL
+    uint32_t trace_id;          // this handle in the trace
+
+    // symlink targets by inode, read the first time a lookup goes through
+    // one. slots only ever go from NULL to a target, with atomics, so
+    // the handle can still be shared without a lock
+    char **links;
+};
+
+//functions
+int image_map(minfs_image_t *img, uint64_t off, size_t len,
+              uint8_t *scratch, const uint8_t **data);
+
+int framed_setup(struct framed_image *fr, int nslots,
+                 minfs_cache_t *cache);
+int framed_read(struct framed_image *fr, uint64_t off, size_t len,
+                uint8_t *buf);
+void framed_free(struct framed_image *fr);
+
+void image_advise(minfs_image_t *img, uint64_t off, uint64_t len,
+                  int advice);
+void prefetch_start(minfs_t *fs, uint32_t ino, struct prefetch *pf);
+void prefetch_advance(struct prefetch *pf, uint64_t off);
+void prefetch_end(struct prefetch *pf);
+
+int direct_open(int fd, struct stat *st, int nbufs,
+                struct direct_image **direct);
+int direct_read(struct direct_image *d, uint64_t off, size_t len,
+                uint8_t *out);
+void direct_free(struct direct_image *d);
+
+uint64_t cache_new_id(void);
+int cache_read(minfs_cache_t *cache, uint64_t owner, uint64_t frame,
+               uint64_t in_frame, size_t len, uint8_t *buf);
+void cache_insert(minfs_cache_t *cache, uint64_t owner, uint64_t frame,
+                  uint8_t *data, size_t len);
+void cache_forget(minfs_cache_t *cache, uint64_t owner);
+
+void trace_attach(minfs_t *fs);
+void trace_record(minfs_t *fs, uint8_t type, uint64_t off, uint64_t len);
+
+int columns_load(minfs_t *fs, uint64_t table);
+void columns_inode(const struct minfs_columns *cols, uint32_t i,
+                   struct inode *node);
+void columns_free(struct minfs_columns *cols);
+
+int gz_open(int fd, struct framed_image **framed);
+int zstd_open(int fd, uint64_t file_size, struct framed_image **framed);
+
+//! notes that len bytes at off (from the start of the filesystem) were
+//! read for type. it sits on every zone read, so a handle that isnt
+//! traced only pays for the test (inlined even at -O0, like the zone
+//! readers it is in)
+static inline __attribute__ ((always_inline))
+void trace_access(minfs_t *fs, uint8_t type, uint64_t off, uint64_t len)
+{
+    if (fs->trace) {
+        trace_record(fs, type, off, len);
+    }
+}
+
+//! inode ino for the library itself. it points into the table, or for a
+//! handle with columns it is put back together in buf. NULL if there
+//! isnt an inode ino
+static inline const struct inode *get_inode(minfs_t *fs, uint32_t ino,
+                                            struct inode *buf)
+{
+    if (ino < ROOT_INODE || ino > fs->sb.ninodes) {
+        return NULL;
+    }
+    if (fs->inodes) {
+        return &fs->inodes[ino - 1];
+    }
+    columns_inode(fs->cols, ino - 1, buf);
+    return buf;
+}
+
+#endif
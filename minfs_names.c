@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "minfs_int.h"
+
+/*
+ * The reverse of lookup: for every inode, the directory entries that
+ * point at it. Built with one pass over the directories (each one read
+ * once, breadth first from the root) so tools that find inodes some other
+ * way, like scanning the inode table, can still print paths for them.
+ */
+
+#define NO_LINK 0 // link 0 is never used so it can mean "none"
+
+/* Structures */
+struct name_link {
+    uint32_t parent;                // the directory the entry is in
+    uint32_t next;                  // the inodes next link or NO_LINK
+    char name[DIR_NAME_SIZE + 1];
+};
+
+struct minfs_names {
+    minfs_t *fs;
+    uint32_t *first;            // first link of each inode, by inode number
+    struct name_link *links;
+    uint32_t count;
+    uint32_t cap;
+};
+
+// what the pass hands readdir for each directory
+struct name_pass {
+    minfs_names_t *names;
+    uint32_t dir;
+    uint32_t *queue;            // directories still to read
+    uint32_t tail;
+    uint8_t *queued;            // so a directory is only read once
+    int err;
+};
+
+//! adds one link to ino, keeping an inodes links in directory order
+static int add_link(minfs_names_t *names, uint32_t ino, uint32_t parent,
+                    const char *name)
+{
+    struct name_link *links;
+    struct name_link *link;
+    uint32_t *at;
+
+    if (names->count == names->cap) {
+        names->cap *= 2;
+        links = realloc(names->links, sizeof(struct name_link) * names->cap);
+        if (!links) {
+            return -ENOMEM;
+        }
+        names->links = links;
+    }
+
+    link = &names->links[names->count];
+    link->parent = parent;
+    link->next = NO_LINK;
+    strcpy(link->name, name);
+
+    for (at = &names->first[ino]; *at != NO_LINK;
+         at = &names->links[*at].next) {
+    }
+    *at = names->count++;
+    return 0;
+}
+
+static int name_entry(const struct minfs_dirent *ent, void *arg)
+{
+    struct name_pass *pass = arg;
+    struct inode node_buf;
+    const struct inode *node;
+    int ret;
+
+    if (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")) {
+        return 0;
+    }
+    if ((node = get_inode(pass->names->fs, ent->ino, &node_buf)) == NULL) {
+        pass->err = -MINFS_ECORRUPT;
+        return 1;
+    }
+
+    if ((ret = add_link(pass->names, ent->ino, pass->dir, ent->name)) < 0) {
+        pass->err = ret;
+        return 1;
+    }
+
+    // a directory linked twice (a broken image) is still only read once
+    if ((node->mode & FILE_TYPE) == MASK_DIR && !pass->queued[ent->ino]) {
+        pass->queued[ent->ino] = 1;
+        pass->queue[pass->tail++] = ent->ino;
+    }
+    return 0;
+}
+
+//! reads every directory once and records where each inode is linked
+minfs_names_t *minfs_names_build(minfs_t *fs, int *err)
+{
+    uint32_t ninodes = fs->sb.ninodes;
+    struct name_pass pass;
+    minfs_names_t *names;
+    uint32_t head = 0;
+    int ret = 0;
+
+    memset(&pass, 0, sizeof(pass));
+    if ((names = calloc(1, sizeof(minfs_names_t))) == NULL) {
+        ret = -ENOMEM;
+        goto done;
+    }
+    names->fs = fs;
+    names->cap = 64;
+    names->count = 1;   // skip NO_LINK
+    names->first = calloc(ninodes + 1, sizeof(uint32_t));
+    names->links = malloc(sizeof(struct name_link) * names->cap);
+    pass.queue = malloc(sizeof(uint32_t) * ninodes);
+    pass.queued = calloc(ninodes + 1, 1);
+    if (!names->first || !names->links || !pass.queue || !pass.queued) {
+        ret = -ENOMEM;
+        goto done;
+    }
+
+    pass.names = names;
+    pass.queue[pass.tail++] = ROOT_INODE;
+    pass.queued[ROOT_INODE] = 1;
+
+    while (head < pass.tail) {
+        pass.dir = pass.queue[head++];
+        if ((ret = minfs_readdir(fs, pass.dir, name_entry, &pass)) < 0) {
+            goto done;
+        }
+        if ((ret = pass.err) < 0) {
+            goto done;
+        }
+    }
+    ret = 0;
+
+done:
+    free(pass.queue);
+    free(pass.queued);
+    if (ret < 0) {
+        if (err) {
+            *err = ret;
+        }
+        minfs_names_free(names);
+        return NULL;
+    }
+    return names;
+}
+
+void minfs_names_free(minfs_names_t *names)
+{
+    if (!names) {
+        return;
+    }
+    free(names->first);
+    free(names->links);
+    free(names);
+}
+
+//! how many directory entries point at ino (0 for an orphan or the root)
+int minfs_names_count(minfs_names_t *names, uint32_t ino)
+{
+    uint32_t link;
+    int count = 0;
+
+    if (ino < ROOT_INODE || ino > names->fs->sb.ninodes) {
+        return 0;
+    }
+    for (link = names->first[ino]; link != NO_LINK;
+         link = names->links[link].next) {
+        count++;
+    }
+    return count;
+}
+
+//! puts the full path of link n of ino in buf. the path is put together
+//! backwards from the name, following each directorys first link up to
+//! the root
+
+int minfs_names_path(minfs_names_t *names, uint32_t ino, int n, char *buf,
+                     size_t len)
+{
+    uint32_t ninodes = names->fs->sb.ninodes;
+    const struct name_link *link;
+    uint32_t at;
+    size_t pos = len;
+    size_t name_len;
+    uint32_t depth;
+
+    if (len < 2 || ino < ROOT_INODE || ino > ninodes) {
+        return -EINVAL;
+    }
+
+    if (ino == ROOT_INODE) {
+        strcpy(buf, "/");
+        return 0;
+    }
+
+    for (at = names->first[ino]; at != NO_LINK && n > 0; n--) {
+        at = names->links[at].next;
+    }
+    if (at == NO_LINK) {
+        return -ENOENT;
+    }
+
+    buf[--pos] = '\0';
+    for (depth = 0; ; depth++) {
+        // deeper than there are inodes means the parents go round in a loop
+        if (depth > ninodes) {
+            return -MINFS_ECORRUPT;
+        }
+
+        link = &names->links[at];
+        name_len = strlen(link->name);
+        if (name_len + 1 > pos) {
+            return -ENAMETOOLONG;
+        }
+        pos -= name_len;
+        memcpy(buf + pos, link->name, name_len);
+        buf[--pos] = '/';
+
+        if (link->parent == ROOT_INODE) {
+            break;
+        }
+        if ((at = names->first[link->parent]) == NO_LINK) {
+            return -ENOENT;
+        }
+    }
+
+    memmove(buf, buf + pos, len - pos);
+    return 0;
+}
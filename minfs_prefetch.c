@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "minfs_int.h"
+
+/*
+ * Telling the kernel what we are about to read, and what we are done
+ * with. Before a big file is streamed its zones are mapped (only the
+ * indirect tables get read for that) into runs of contiguous zones, and
+ * as the walk goes along the next PREFETCH_WINDOW bytes of those runs are
+ * handed to madvise(WILLNEED) so the disk is already busy with them when
+ * the walk gets there. With drop_behind the runs the walk has finished
+ * with are dropped from the page cache again, so streaming a huge file
+ * doesnt push everything else out.
+ *
+ * This only matters for mapped images. Direct images do their own read
+ * ahead and keep nothing, and compressed ones are read a frame at a time.
+ * Every call here is a hint, nothing fails if the kernel ignores it.
+ */
+
+#define EXTENTS_START 16
+
+//! hints the kernel about len bytes of the image at off
+void image_advise(minfs_image_t *img, uint64_t off, uint64_t len,
+                  int advice)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t start;
+    uint64_t end;
+
+    if (!img->map || len == 0 || off >= img->size) {
+        return;
+    }
+    len = MIN(len, img->size - off);
+
+    // madvise wants whole pages
+    start = off & ~(uint64_t)(page - 1);
+    end = off + len;
+
+    if (advice == ADVISE_WILLNEED) {
+        madvise((void *)(img->map + start), end - start, MADV_WILLNEED);
+        return;
+    }
+
+    // only whole pages inside the range get dropped, the ones at the
+    // ends might still have someone elses data in them
+    start = (off + page - 1) & ~(uint64_t)(page - 1);
+    end &= ~(uint64_t)(page - 1);
+    if (end <= start) {
+        return;
+    }
+    madvise((void *)(img->map + start), end - start, MADV_DONTNEED);
+    posix_fadvise(img->fd, start, end - start, POSIX_FADV_DONTNEED);
+}
+
+//! adds one zone to the run list, joining it onto the last run when it
+//! is the next zone on disk
+
+static int add_extent(const uint8_t *data, size_t len, uint64_t off,
+                      uint32_t zone, void *arg)
+{
+    struct prefetch *pf = arg;
+    struct extent *extents;
+    struct extent *last;
+    uint64_t disk = pf->fs->start + (uint64_t)zone * pf->fs->zonesize;
+
+    if (zone == 0) {
+        return 0;
+    }
+
+    last = pf->count ? &pf->extents[pf->count - 1] : NULL;
+    if (last && last->disk + last->len == disk &&
+        last->file + last->len == off) {
+        last->len += len;
+        return 0;
+    }
+
+    if (pf->count == pf->cap) {
+        pf->cap = pf->cap ? pf->cap * 2 : EXTENTS_START;
+        extents = realloc(pf->extents, sizeof(struct extent) * pf->cap);
+        if (!extents) {
+            return -ENOMEM;
+        }
+        pf->extents = extents;
+    }
+
+    last = &pf->extents[pf->count++];
+    last->file = off;
+    last->disk = disk;
+    last->len = len;
+    return 0;
+}
+
+//! gets ready to stream file ino. small files are left alone unless
+//! their pages are going to be dropped afterwards
+
+void prefetch_start(minfs_t *fs, uint32_t ino, struct prefetch *pf)
+{
+    struct inode node_buf;
+    const struct inode *node = get_inode(fs, ino, &node_buf);
+
+    memset(pf, 0, sizeof(struct prefetch));
+    pf->fs = fs;
+
+    if (!fs->img->map || !node) {
+        return;
+    }
+    if (node->size <= PREFETCH_MIN_SIZE && !fs->img->drop_behind) {
+        return;
+    }
+
+    if (minfs_map_zones(fs, ino, add_extent, pf) < 0) {
+        prefetch_end(pf);
+        return;
+    }
+    pf->active = 1;
+}
+
+//! drops every run that ends at or before off in the file
+static void drop_behind(struct prefetch *pf, uint64_t off)
+{
+    struct extent *ext;
+
+    while (pf->next_behind < pf->count) {
+        ext = &pf->extents[pf->next_behind];
+        if (ext->file + ext->len > off) {
+            break;
+        }
+        image_advise(pf->fs->img, ext->disk, ext->len, ADVISE_DONTNEED);
+        pf->next_behind++;
+    }
+}
+
+//! called as the walk gets to off in the file: keeps the hints a window
+//! ahead of it and drops the runs it is completely past
+
+void prefetch_advance(struct prefetch *pf, uint64_t off)
+{
+    minfs_image_t *img = pf->fs->img;
+    struct extent *ext;
+    uint64_t skip;
+    uint64_t len;
+
+    if (!pf->active) {
+        return;
+    }
+
+    // hint whole windows at a time, not a syscall per zone
+    if (off + PREFETCH_WINDOW / 2 >= pf->ahead) {
+        while (pf->next_ahead < pf->count &&
+               pf->extents[pf->next_ahead].file < off + PREFETCH_WINDOW) {
+            ext = &pf->extents[pf->next_ahead];
+            skip = pf->ahead > ext->file ? pf->ahead - ext->file : 0;
+            len = MIN(ext->len - skip, off + PREFETCH_WINDOW - ext->file -
+                      skip);
+
+            image_advise(img, ext->disk + skip, len, ADVISE_WILLNEED);
+            pf->ahead = ext->file + skip + len;
+            if (skip + len < ext->len) {
+                break;
+            }
+            pf->next_ahead++;
+        }
+    }
+
+    if (img->drop_behind) {
+        drop_behind(pf, off);
+    }
+}
+
+//! the walk is done, drop whatever is left behind it
+void prefetch_end(struct prefetch *pf)
+{
+    if (pf->active && pf->fs->img->drop_behind) {
+        drop_behind(pf, UINT64_MAX);
+    }
+    free(pf->extents);
+    pf->extents = NULL;
+    pf->active = 0;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "minfs_int.h"
+
+/*
+ * Traces of what a handle reads, for sizing caches and readahead with
+ * mintrace instead of guessing. A trace is a header and then one record
+ * per read:
+ *
+ *   type byte, fs, zone, len
+ *
+ * where fs and len are varints and zone is a zigzag varint of how far it
+ * is from the zone in the record before (most reads are the next zone
+ * along, so most records are four or five bytes). A MINFS_TRACE_FS record
+ * starts each filesystem off, with its zone size instead of the zone and
+ * len.
+ *
+ * Any number of threads and handles write into one trace under its lock,
+ * through a buffer, so tracing costs a copy per read and not a write.
+ */
+
+#define TRACE_MAGIC "MINTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BUF_SIZE (64 * 1024)
+#define TRACE_RECORD_MAX 32     // a type byte and three varints at most
+#define RECORDS_START 4096
+
+/* Structures */
+
+struct minfs_trace {
+    pthread_mutex_t lock;
+    FILE *out;
+    uint32_t next_fs;
+    uint32_t last_zone;
+    int err;                    // the first write that failed
+    size_t used;
+    uint8_t buf[TRACE_BUF_SIZE];
+};
+
+//! starts a trace at path, NULL (with the reason in err) if it cant
+minfs_trace_t *minfs_trace_open(const char *path, int *err)
+{
+    minfs_trace_t *trace;
+    uint8_t version = TRACE_VERSION;
+
+    if ((trace = calloc(1, sizeof(minfs_trace_t))) == NULL) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+    if ((trace->out = fopen(path, "wb")) == NULL) {
+        *err = -errno;
+        free(trace);
+        return NULL;
+    }
+    pthread_mutex_init(&trace->lock, NULL);
+    memcpy(trace->buf, TRACE_MAGIC, strlen(TRACE_MAGIC));
+    trace->buf[strlen(TRACE_MAGIC)] = version;
+    trace->used = strlen(TRACE_MAGIC) + 1;
+    return trace;
+}
+
+//! writes out what is buffered, has to be called with the lock held
+static void trace_flush(minfs_trace_t *trace)
+{
+    if (trace->used && !trace->err &&
+        fwrite(trace->buf, 1, trace->used, trace->out) != trace->used) {
+        trace->err = errno ? -errno : -EIO;
+    }
+    trace->used = 0;
+}
+
+//! finishes the trace off, every handle writing to it has to be closed
+//! first. returns the first error writing it got
+int minfs_trace_close(minfs_trace_t *trace)
+{
+    int err;
+
+    if (!trace) {
+        return 0;
+    }
+    trace_flush(trace);
+    if (fclose(trace->out) < 0 && !trace->err) {
+        trace->err = -errno;
+    }
+    err = trace->err;
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+    return err;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static void put_record(minfs_trace_t *trace, uint8_t type, uint32_t fs,
+                       uint64_t a, uint64_t b)
+{
+    uint8_t *p;
+
+    if (trace->used + TRACE_RECORD_MAX > TRACE_BUF_SIZE) {
+        trace_flush(trace);
+    }
+    p = trace->buf + trace->used;
+    *p++ = type;
+    p = put_varint(p, fs);
+    p = put_varint(p, a);
+    p = put_varint(p, b);
+    trace->used = p - trace->buf;
+}
+
+//! gives a handle being opened its number in the trace, once the zone
+//! size is known
+void trace_attach(minfs_t *fs)
+{
+    minfs_trace_t *trace = fs->trace;
+
+    pthread_mutex_lock(&trace->lock);
+    fs->trace_id = trace->next_fs++;
+    put_record(trace, MINFS_TRACE_FS, fs->trace_id, 0, fs->zonesize);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+//! writes down that len bytes at off (from the start of the filesystem)
+//! were read for type, trace_access only calls it for a traced handle
+void trace_record(minfs_t *fs, uint8_t type, uint64_t off, uint64_t len)
+{
+    minfs_trace_t *trace = fs->trace;
+    uint32_t zone;
+    int64_t step;
+
+    zone = off / fs->zonesize;
+    len += off % fs->zonesize;
+
+    pthread_mutex_lock(&trace->lock);
+    step = (int64_t)zone - trace->last_zone;
+    trace->last_zone = zone;
+    put_record(trace, type, fs->trace_id,
+               ((uint64_t)step << 1) ^ (uint64_t)(step >> 63), len);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+static int get_varint(FILE *in, uint64_t *v)
+{
+    int shift = 0;
+    int c;
+
+    *v = 0;
+    do {
+        if ((c = getc(in)) == EOF || shift > 63) {
+            return -MINFS_ECORRUPT;
+        }
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 0;
+}
+
+//! reads a whole trace into records (from malloc, the caller frees it)
+int minfs_trace_load(const char *path, struct minfs_trace_record **records,
+                     size_t *count)
+{
+    struct minfs_trace_record *recs = NULL;
+    struct minfs_trace_record *r;
+    char magic[sizeof(TRACE_MAGIC)];
+    uint32_t last_zone = 0;
+    uint64_t fs, a, b;
+    size_t n = 0;
+    size_t cap = 0;
+    int type;
+    int ret = 0;
+    FILE *in;
+
+    if ((in = fopen(path, "rb")) == NULL) {
+        return -errno;
+    }
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)) ||
+        magic[strlen(TRACE_MAGIC)] != TRACE_VERSION) {
+        fclose(in);
+        return -MINFS_ECORRUPT;
+    }
+
+    while ((type = getc(in)) != EOF) {
+        if (type >= MINFS_TRACE_TYPES || (ret = get_varint(in, &fs)) < 0 ||
+            (ret = get_varint(in, &a)) < 0 ||
+            (ret = get_varint(in, &b)) < 0) {
+            ret = -MINFS_ECORRUPT;
+            break;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : RECORDS_START;
+            if ((r = realloc(recs, cap * sizeof(*recs))) == NULL) {
+                ret = -ENOMEM;
+                break;
+            }
+            recs = r;
+        }
+
+        r = &recs[n++];
+        r->fs = fs;
+        r->type = type;
+        r->len = b;
+        r->zone = 0;
+        if (type != MINFS_TRACE_FS) {
+            // undo the zigzag
+            last_zone += (int64_t)((a >> 1) ^ -(a & 1));
+            r->zone = last_zone;
+        }
+    }
+
+    fclose(in);
+    if (ret < 0) {
+        free(recs);
+        return ret;
+    }
+    *records = recs;
+    *count = n;
+    return 0;
+}
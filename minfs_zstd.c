@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "minfs_int.h"
+
+/*
+ * seekable zstd images: a run of ordinary zstd frames with a skippable
+ * frame on the end holding a table of every frames compressed and
+ * decompressed size. Each frame decompresses on its own, so the table is
+ * all we need to find any byte. A plain zstd file without the table would
+ * have to be decompressed from the start every time and isnt supported.
+ */
+
+#ifdef MINFS_ZSTD
+
+#include <zstd.h>
+
+// the seek table footer: number of frames, descriptor and magic
+#define SEEK_FOOTER_SIZE 9
+#define SEEK_MAGIC 0x8F92EAB1U
+#define SEEK_SKIPPABLE_MAGIC 0x184D2A5EU
+#define SEEK_SKIPPABLE_HEADER 8
+#define SEEK_CHECKSUM_FLAG 0x80
+
+/* Structures */
+struct zstd_index {
+    int fd;
+    uint64_t *offsets;  // where each frame is in the file, count + 1 of them
+    uint8_t *input;     // one compressed frame, used under the cache lock
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//! reads the seek table off the end of the file
+static int read_seek_table(struct framed_image *fr, struct zstd_index *zs,
+                           uint64_t file_size)
+{
+    uint8_t footer[SEEK_FOOTER_SIZE];
+    uint8_t *table;
+    uint64_t table_size;
+    uint64_t frames;
+    size_t entry_size;
+    size_t in_max = 0;
+    uint64_t i;
+
+    if (file_size < SEEK_FOOTER_SIZE + SEEK_SKIPPABLE_HEADER ||
+        pread(zs->fd, footer, SEEK_FOOTER_SIZE,
+              file_size - SEEK_FOOTER_SIZE) != SEEK_FOOTER_SIZE ||
+        get_le32(footer + 5) != SEEK_MAGIC) {
+        return -MINFS_ENOTSEEKABLE;
+    }
+
+    frames = get_le32(footer);
+    entry_size = (footer[4] & SEEK_CHECKSUM_FLAG) ? 12 : 8;
+    table_size = frames * entry_size + SEEK_FOOTER_SIZE;
+    if (frames == 0 || table_size + SEEK_SKIPPABLE_HEADER > file_size) {
+        return -MINFS_EDAMAGED;
+    }
+
+    if ((table = malloc(table_size + SEEK_SKIPPABLE_HEADER)) == NULL) {
+        return -ENOMEM;
+    }
+    if (pread(zs->fd, table, table_size + SEEK_SKIPPABLE_HEADER,
+              file_size - table_size - SEEK_SKIPPABLE_HEADER) !=
+        (ssize_t)(table_size + SEEK_SKIPPABLE_HEADER) ||
+        get_le32(table) != SEEK_SKIPPABLE_MAGIC ||
+        get_le32(table + 4) != table_size) {
+        free(table);
+        return -MINFS_EDAMAGED;
+    }
+
+    fr->starts = malloc(sizeof(uint64_t) * (frames + 1));
+    zs->offsets = malloc(sizeof(uint64_t) * (frames + 1));
+    if (!fr->starts || !zs->offsets) {
+        free(table);
+        return -ENOMEM;
+    }
+
+    // the table only has sizes, add them up to get where things are
+    fr->starts[0] = 0;
+    zs->offsets[0] = 0;
+    for (i = 0; i < frames; i++) {
+        const uint8_t *entry = table + SEEK_SKIPPABLE_HEADER + i * entry_size;
+        uint32_t in_size = get_le32(entry);
+
+        zs->offsets[i + 1] = zs->offsets[i] + in_size;
+        fr->starts[i + 1] = fr->starts[i] + get_le32(entry + 4);
+        in_max = MAX(in_max, in_size);
+    }
+    fr->count = frames;
+    free(table);
+
+    // the frames cant run into the seek table
+    if (zs->offsets[frames] > file_size - table_size - SEEK_SKIPPABLE_HEADER ||
+        fr->starts[frames] == 0) {
+        return -MINFS_EDAMAGED;
+    }
+
+    if ((zs->input = malloc(in_max ? in_max : 1)) == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+//! decompresses one frame into out
+static int zstd_load(struct framed_image *fr, uint64_t frame, uint8_t *out)
+{
+    struct zstd_index *zs = fr->priv;
+    size_t in_size = zs->offsets[frame + 1] - zs->offsets[frame];
+    size_t out_size = fr->starts[frame + 1] - fr->starts[frame];
+    size_t got;
+
+    if (pread(zs->fd, zs->input, in_size, zs->offsets[frame]) !=
+        (ssize_t)in_size) {
+        return -MINFS_EDAMAGED;
+    }
+
+    got = ZSTD_decompress(out, out_size, zs->input, in_size);
+    if (ZSTD_isError(got) || got != out_size) {
+        return -MINFS_EDAMAGED;
+    }
+    return 0;
+}
+
+static void zstd_release(struct framed_image *fr)
+{
+    struct zstd_index *zs = fr->priv;
+
+    if (zs) {
+        free(zs->offsets);
+        free(zs->input);
+        free(zs);
+    }
+}
+
+//! sets up a seekable zstd image from its seek table
+int zstd_open(int fd, uint64_t file_size, struct framed_image **framed)
+{
+    struct framed_image *fr;
+    struct zstd_index *zs;
+
+    if ((fr = calloc(1, sizeof(struct framed_image))) == NULL) {
+        return -ENOMEM;
+    }
+    if ((zs = calloc(1, sizeof(struct zstd_index))) == NULL) {
+        free(fr);
+        return -ENOMEM;
+    }
+
+    zs->fd = fd;
+    fr->priv = zs;
+    fr->load = zstd_load;
+    fr->release = zstd_release;
+    *framed = fr;
+
+    return read_seek_table(fr, zs, file_size);
+}
+
+#else
+
+int zstd_open(int fd, uint64_t file_size, struct framed_image **framed)
+{
+    return -MINFS_EFORMAT;
+}
+
+#endif
@@ -3,6 +3,30 @@
 
 #include <stdint.h>
 
+/* On disk layout of a minix (v3) filesystem */
+
+#define IZT_ENTRY_SIZE 4 //indirect zone table entry size
+
+#define DIRECT_ZONES 7
+#define PARTITION_TABLE_LOCATION 0x1BE
+#define SECTOR_SIZE 512
+#define BLOCK_SIZE 1024 // the size of a block
+#define SUPERBLOCK_MAGIC 19802
+
+#define ROOT_INODE 1 // inodes are numbered from 1 and the root is first
+#define DIR_NAME_SIZE 60
+
+// the type of the partition (needs to be minix type)
+#define FILETYPE_MINIX 0x81
+#define PT_510 0x55 // checks for the valid partition table signature
+#define PT_511 0xAA // samesies
+
+// file types out of the inode mode
+#define FILE_TYPE 0170000
+#define SYM_LINK_TYPE 0120000
+#define REGULAR_FILE 0100000
+#define MASK_DIR  0040000
+
 
 /* Partition Structure */
 struct __attribute__ ((__packed__)) partition {
@@ -18,29 +42,41 @@ struct __attribute__ ((__packed__)) partition {
     uint32_t size;
 };
 
-/* Global Variables */
-extern struct partition partition;
-extern struct superblock sb;
-extern struct inode *inodes;
-
-extern unsigned int zonesize;
-
-extern short p_flag;
-extern short s_flag;
-extern short h_flag;
-extern short v_flag;
-
-extern int prim_part, sub_part;
-extern uint32_t part_start;
+struct __attribute__ ((__packed__)) superblock {
+    uint32_t ninodes;         // number of inodes in this filesystem
+    uint16_t pad1;            // make things line up properly
+    int16_t i_blocks;         // # of blocks used by inode bit map
+    int16_t z_blocks;         // # of blocks used by zone bit map
+    uint16_t firstdata;       // number of first data zone
+    int16_t log_zone_size;    // log2 of blocks per zone
+    int16_t pad2;             // make things line up again
+    uint32_t max_file;        // maximum file size
+    uint32_t zones;           // number of zones on disk
+    int16_t magic;            // magic number */
+    int16_t pad3;             // make things line up again
+    uint16_t blocksize;       // block size in bytes
+    uint8_t subversion;       // filesystem sub–version
+};
 
-extern char *image_file;
-extern char **src_path;
-extern char *src_path_string;
-extern char **dst_path;
-extern char *dst_path_string;
+struct __attribute__ ((__packed__)) inode {
+    uint16_t mode;
+    uint16_t links;
+    uint16_t uid;
+    uint16_t gid;
+    uint32_t size;
+    int32_t atime;
+    int32_t mtime;
+    int32_t ctime;
+    uint32_t zone[DIRECT_ZONES];
+    uint32_t indirect;
+    uint32_t two_indirect;
+    uint32_t unused;
+};
 
-extern int path_arg_count;
-extern int destination_path_args;
+struct __attribute__ ((__packed__)) directory {
+    uint32_t inode;
+    unsigned char name[DIR_NAME_SIZE];
+};
 
 
 #endif
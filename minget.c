@@ -1,109 +1,539 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "minfunc.h"
 #include "print.h"
 #include "helper.h"
+#include "hash.h"
+#include "export.h"
+#include "extract.h"
+#include "partscan.h"
+#include "pipeline.h"
 
+#define TOUCH_STEP 512 // bench reads one byte in this many
+#define MIB (1024.0 * 1024.0)
 
-int main(int argc, char *argv[]) {
+// where a streamed file goes: an output file, a hash, or both. the
+// output is written on its own thread through pipe unless -D 0 was given
+struct stream_target {
+    FILE *out;
+    struct pipeline *pipe;
+    struct hasher hash;
+};
 
-    // get dat disk brahhh
-    FILE *disk_image;
+// what recursive hashing remembers, so a file with several names is
+// only read for the first one
+struct hash_tree {
+    char **digests;     // by inode, only for ones with more than one link
+    uint64_t saved;     // bytes not read again because of that
+};
 
-    // pointer to where the file data will start
-    uint8_t *file_data;
+// what one timed bench pass read
+struct bench_pass {
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t sum;   // so the reads cant be optimised away
+};
 
-    // will hold the node we want to write data from
-    struct inode *node;
+//! takes each zone as it comes off the disk, hashes it, and writes it out
+//! holes are hashed and written as zeros without anything being read
+static int stream_zone_out(const uint8_t *data, size_t len, uint64_t off,
+                           uint32_t zone, void *arg) {
+    static const uint8_t zeros[BLOCK_SIZE];
+    struct stream_target *target = arg;
+    size_t chunk;
 
-    // same thing make sure that there is a disk image provided 
-    if (argc < 2)
-    {
-        print_usage(argv);
+    if (hash_algo != HASH_NONE && data) {
+        hash_update(&target->hash, data, len);
+    }
+    else if (hash_algo != HASH_NONE) {
+        hash_update_zeros(&target->hash, len);
+    }
+
+    // the writer thread takes it from here, and says if it went wrong
+    if (target->pipe) {
+        return pipeline_write(target->pipe, data, len);
+    }
+    if (!target->out) {
         return SUCCESS;
     }
 
-    // then parse through it 
-    parse_cmd_line(argc, argv);
+    if (data) {
+        fwrite(data, 1, len, target->out);
+        return SUCCESS;
+    }
 
-    // if the disk image does not open return an error 
-    if ((disk_image = fopen(image_file, "r")) == NULL) 
-    {
-        perror("open");
+    // write the hole out a block of zeros at a time
+    while (len > 0) {
+        chunk = MIN(len, sizeof(zeros));
+        fwrite(zeros, 1, chunk, target->out);
+        len -= chunk;
+    }
+    return SUCCESS;
+}
+
+//! streams one file into out if it is not NULL, and with -H through the
+//! hash too, then prints the digest the same way sha256sum does (it is
+//! left in digest as well). zones are read on this thread and written
+//! out on another, so the image keeps being read while out is busy
+
+static void stream_file(minfs_t *fs, uint32_t ino, const char *path,
+                        FILE *out, char *digest) {
+    struct stream_target target;
+    struct pipeline pipe;
+    int write_err;
+    int err;
+
+    target.out = out;
+    target.pipe = NULL;
+    if (hash_algo != HASH_NONE) {
+        hash_init(&target.hash, hash_algo);
+    }
+
+    // anything already buffered in out has to go before the writer starts
+    if (out && pipe_depth) {
+        fflush(out);
+        if ((err = pipeline_start(&pipe, fileno(out), pipe_depth)) < 0) {
+            fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+            exit(ERROR);
+        }
+        target.pipe = &pipe;
+    }
+
+    err = minfs_read_zones(fs, ino, stream_zone_out, &target);
+    if (target.pipe) {
+        // a failed write stops the reading, so report that and not the
+        // error the reading was stopped with
+        if ((write_err = pipeline_finish(&pipe)) < 0) {
+            err = write_err;
+        }
+        if (v_flag) {
+            fprintf(stderr, "%u buffers: reading waited %llu times, "
+                    "writing waited %llu times\n", pipe_depth,
+                    (unsigned long long)pipe.full,
+                    (unsigned long long)pipe.empty);
+        }
+    }
+    if (err < 0) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
+        exit(ERROR);
+    }
+    if (hash_algo == HASH_NONE) {
+        return;
+    }
+    hash_final(&target.hash, digest);
+
+    // if the file data went to stdout the digest cant go there too
+    fprintf(out == stdout ? stderr : stdout, "%s  %s\n", digest, path);
+}
+
+//! called for everything under the directory in recursive mode
+static int hash_tree_entry(minfs_t *fs, uint32_t ino,
+                           const struct inode *node, const char *path,
+                           void *arg) {
+    struct hash_tree *tree = arg;
+    char digest[HASH_HEX_MAX];
+
+    if ((node->mode & FILE_TYPE) != REGULAR_FILE) {
+        return SUCCESS;
+    }
+
+    // another name for a file that was already hashed
+    if (node->links > 1 && tree->digests[ino]) {
+        printf("%s  %s\n", tree->digests[ino], path);
+        tree->saved += node->size;
+        return SUCCESS;
+    }
+
+    stream_file(fs, ino, path, NULL, digest);
+    if (node->links > 1 && (tree->digests[ino] = strdup(digest)) == NULL) {
+        perror("strdup");
+        exit(ERROR);
+    }
+    return SUCCESS;
+}
+
+//! hashes every regular file under directory ino
+static void hash_tree(minfs_t *fs, uint32_t ino) {
+    struct hash_tree tree;
+    uint32_t i;
+    int err;
+
+    tree.saved = 0;
+    if ((tree.digests = calloc(minfs_ninodes(fs) + 1, sizeof(char *))) ==
+        NULL) {
+        perror("calloc");
+        exit(ERROR);
+    }
+
+    err = minfs_walk(fs, ino, path_arg_count ? src_path_string : "/",
+                     hash_tree_entry, &tree);
+    if (err < 0) {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
+
+    if (v_flag) {
+        fprintf(stderr, "%llu bytes of hardlinked files not read again\n",
+                (unsigned long long)tree.saved);
+    }
+    for (i = 0; i <= minfs_ninodes(fs); i++) {
+        free(tree.digests[i]);
+    }
+    free(tree.digests);
+}
+
+//! extracts everything under directory ino into dstpath (with -m only
+//! what changed since the manifest was written)
+
+static void extract_to_host(minfs_t *fs, uint32_t ino) {
+    struct extract_stats stats;
+    int err;
+
+    if (manifest_file) {
+        err = extract_changed(fs, ino, dst_path_string, manifest_file,
+                              hash_algo, &stats);
+    }
+    else {
+        err = extract_tree(fs, ino, dst_path_string, &stats);
+    }
+    if (err < 0) {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
+
+    if (v_flag && manifest_file) {
+        fprintf(stderr, "%llu inodes changed, %llu names unchanged, "
+                "%llu removed\n", (unsigned long long)stats.changed,
+                (unsigned long long)stats.unchanged,
+                (unsigned long long)stats.removed);
+    }
+    if (v_flag) {
+        fprintf(stderr, "%llu files (%llu bytes read), %llu directories, "
+                "%llu symlinks, %llu hardlinks (%llu bytes not read again)",
+                (unsigned long long)stats.files,
+                (unsigned long long)stats.bytes,
+                (unsigned long long)stats.dirs,
+                (unsigned long long)stats.symlinks,
+                (unsigned long long)stats.links,
+                (unsigned long long)stats.saved);
+        if (stats.skipped) {
+            fprintf(stderr, ", %llu skipped",
+                    (unsigned long long)stats.skipped);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+
+//! takes each zone in a bench pass, touching every block of it so a
+//! mapped image has to actually fault the pages in
+
+static int bench_zone(const uint8_t *data, size_t len, uint64_t off,
+                      uint32_t zone, void *arg) {
+    struct bench_pass *pass = arg;
+    size_t i;
+
+    if (data) {
+        for (i = 0; i < len; i += TOUCH_STEP) {
+            pass->sum += data[i];
+        }
+        pass->bytes += len;
+    }
+    return SUCCESS;
+}
+
+static int bench_file(minfs_t *fs, uint32_t ino, const struct inode *node,
+                      const char *path, void *arg) {
+    struct bench_pass *pass = arg;
+    int err;
+
+    if ((node->mode & FILE_TYPE) != REGULAR_FILE) {
+        return SUCCESS;
+    }
+    if ((err = minfs_read_zones(fs, ino, bench_zone, pass)) < 0) {
+        fprintf(stderr, "%s: %s\n", path, minfs_strerror(err));
         exit(ERROR);
     }
+    pass->files++;
+    return SUCCESS;
+}
+
+//! asks the kernel to drop whatever it has cached of the image, so both
+//! passes start cold (it only drops clean pages nobody has mapped)
 
-    // get the partition info 
-    partition_info(disk_image);
+static void evict_image(void) {
+    int fd = open(image_file, O_RDONLY);
+
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
 
-    // if  there is verbose flag, then print that out
-    if (v_flag) 
+//! reads srcpath (everything under it for a directory) once through the
+//! page cache and once with O_DIRECT and prints how fast each went
+
+static void bench_filesystem(struct fs_location *loc)
+{
+    static const char *names[] = { "buffered", "direct" };
+    struct bench_pass pass;
+    struct timespec t0, t1;
+    const struct inode *node;
+    minfs_t *fs;
+    uint32_t ino;
+    double secs;
+    int err;
+    int i;
+
+    for (i = 0; i < 2; i++)
     {
-        printf("Partition %d:\n", prim_part);
-        print_partition(partition);
+        memset(&pass, 0, sizeof(pass));
+        d_flag = i;
+        evict_image();
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        fs = open_filesystem();
+        ino = lookup_src_path(fs);
+        node = minfs_inode(fs, ino);
+
+        if ((node->mode & FILE_TYPE) == MASK_DIR)
+        {
+            err = minfs_walk(fs, ino, path_arg_count ? src_path_string : "/",
+                             bench_file, &pass);
+            if (err < 0)
+            {
+                fprintf(stderr, "%s\n", minfs_strerror(err));
+                exit(ERROR);
+            }
+        }
+        else
+        {
+            bench_file(fs, ino, node, src_path_string, &pass);
+        }
+        minfs_close(fs);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("%-8s %12llu bytes %6llu files %9.4f s %9.1f MiB/s\n",
+               names[i], (unsigned long long)pass.bytes,
+               (unsigned long long)pass.files, secs,
+               secs > 0 ? pass.bytes / MIB / secs : 0.0);
     }
+}
+
+//! gets the file out of one filesystem, the partition flags are set
+static void get_from_filesystem(struct fs_location *loc)
+{
+    // the filesystem we are reading from
+    minfs_t *fs;
 
-    // get superblock info 
-    read_superblock(disk_image);
+    // will hold the node we want to write data from
+    const struct inode *node;
+    char digest[HASH_HEX_MAX];
+    FILE *out = stdout;
+    uint32_t ino;
+    int err;
+
+    // with -a every filesystem writes to its own copy of dstpath (and
+    // keeps its own manifest)
+    if (loc && destination_path_args)
+    {
+        char *own_dst = malloc(strlen(dst_path_string) + PREFIX_LEN + 2);
+
+        if (!own_dst)
+        {
+            perror("malloc");
+            exit(ERROR);
+        }
+        sprintf(own_dst, "%s.%s", dst_path_string, loc->prefix);
+        dst_path_string = own_dst;
+    }
+    if (loc && manifest_file)
+    {
+        char *own_manifest = malloc(strlen(manifest_file) + PREFIX_LEN + 2);
 
-    // store the inodes 
-    read_store_inodes(disk_image);
+        if (!own_manifest)
+        {
+            perror("malloc");
+            exit(ERROR);
+        }
+        sprintf(own_manifest, "%s.%s", manifest_file, loc->prefix);
+        manifest_file = own_manifest;
+    }
 
-    // if V print out indoes 
-    if (v_flag) 
+    // open it up, and print the partition, superblock and root for -v
+    fs = open_filesystem();
+    if (v_flag)
     {
-        print_inode(&inodes[0]);
+        print_filesystem(fs);
     }
 
-    // make sure the path was given 
-    if (!path_arg_count) 
+    // make sure the path was given (recursive and export modes can start
+    // at the root)
+    if (!path_arg_count && !r_flag && export_format == EXPORT_NONE) 
     {
         fprintf(stderr, "No path specified.\n");
         exit(ERROR);
     }
 
-    // find the node we want from the given path
-    node = find_inode_from_path(disk_image, &inodes[0], 0);
+    // find the node we want from the given path, through any symlinks
+    ino = resolve_src_path(fs);
+    node = minfs_inode(fs, ino);
 
-    // if there is no node there, say u didnt find it
-    if (!node) 
+    // export mode streams the whole subtree out as one archive
+    if (export_format != EXPORT_NONE)
     {
-        fprintf(stderr, "File not found\n");
-        exit(ERROR);
+        if (destination_path_args &&
+            (out = fopen(dst_path_string, "w")) == NULL)
+        {
+            perror("open");
+            exit(ERROR);
+        }
+
+        err = export_tree(fs, ino, path_arg_count ? src_path_string : "/",
+                          export_format, out);
+        if (err < 0)
+        {
+            fprintf(stderr, "%s\n", minfs_strerror(err));
+            exit(ERROR);
+        }
+
+        if (out != stdout)
+        {
+            fclose(out);
+        }
+        minfs_close(fs);
+        return;
+    }
+
+    // recursive mode extracts (or hashes) everything under a directory
+    if (r_flag)
+    {
+        if (!destination_path_args && hash_algo == HASH_NONE)
+        {
+            fprintf(stderr, "-r needs a dstpath or a hash "
+                    "(-H xxh64|sha256)\n");
+            exit(ERROR);
+        }
+        if (manifest_file && !destination_path_args)
+        {
+            fprintf(stderr, "-m needs a dstpath to extract into\n");
+            exit(ERROR);
+        }
+
+        if ((node->mode & FILE_TYPE) != MASK_DIR)
+        {
+            fprintf(stderr, "Not a directory\n");
+            exit(ERROR);
+        }
+
+        if (destination_path_args)
+        {
+            extract_to_host(fs, ino);
+        }
+        else
+        {
+            hash_tree(fs, ino);
+        }
+        minfs_close(fs);
+        return;
     }
 
     // if its not a regular file, exit
-    if ((node->mode & MASK_DIR) || (node->mode & FILE_TYPE) == SYM_LINK_TYPE) 
+    if ((node->mode & FILE_TYPE) != REGULAR_FILE) 
     {
         fprintf(stderr, "Not a regular file\n");
         exit(ERROR);
     }
 
-    // read the file data
-    file_data = malloc(node->size);
+    // stream it zone by zone instead of buffering the whole file (-n only
+    // means something with a hash)
+    if (n_flag && hash_algo != HASH_NONE)
+    {
+        out = NULL;
+    }
+    else if (destination_path_args)
+    {
+        if ((out = fopen(dst_path_string, "w")) == NULL)
+        {
+            perror("open");
+            exit(ERROR);
+        }
+    }
+
+    stream_file(fs, ino, src_path_string, out, digest);
 
-    if (!file_data) 
+    if (out && out != stdout)
     {
-        perror("malloc");
-        exit(ERROR);
+        fclose(out);
     }
+    minfs_close(fs); // free em
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // get dat disk brahhh
+    minfs_image_t *disk_image;
+    int err;
 
-    read_full_file_data(disk_image, node, file_data);
+    // every minix filesystem on the disk for -a
+    struct fs_location *locs;
+    fs_job_fn job = get_from_filesystem;
+    int count;
+    int ret;
 
-    // Write the file data to the specified destination or stdout
-    if (destination_path_args) 
+    // same thing make sure that there is a disk image provided 
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    // then parse through it 
+    parse_cmd_line(argc, argv);
+
+    // bench mode only reads, and times it
+    if (b_flag)
+    {
+        job = bench_filesystem;
+    }
+
+    // with -a get the file from every filesystem in the partition tree
+    if (a_flag)
+    {
+        // raw file data from several filesystems cant share stdout
+        if (!b_flag && !destination_path_args &&
+            !(hash_algo != HASH_NONE && (n_flag || r_flag)))
         {
-            write_to_output(file_data, node->size, dst_path_string);
-        } 
-    
-    else 
+            fprintf(stderr, "-a needs a dstpath or -H with -n or -r\n");
+            exit(ERROR);
+        }
+
+        // if the disk image does not open return an error 
+        if ((disk_image = minfs_image_open(image_file, NULL, &err)) == NULL)
         {
-            write_to_output(file_data, node->size, NULL);
+            fprintf(stderr, "%s: %s\n", image_file, minfs_strerror(err));
+            exit(ERROR);
         }
 
-    free(file_data); // free my 
-    fclose(disk_image); // free em
+        if ((count = scan_partitions(disk_image, &locs)) == 0)
+        {
+            fprintf(stderr, "No minix partitions found\n");
+            exit(ERROR);
+        }
+        minfs_image_close(disk_image);
+
+        ret = run_on_all_partitions(locs, count, job);
+        free(locs);
+        return ret;
+    }
+
+    job(NULL);
     return SUCCESS;
-}
\ No newline at end of file
+}
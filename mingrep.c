@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+#include "pool.h"
+#include "match.h"
+
+#define NO_MATCH 1  // exit status when nothing matched, like grep
+#define HITS_START 16
+
+/* Structures */
+
+// one place a pattern was found
+struct hit {
+    uint64_t off;
+    int which;
+};
+
+// what every file job shares
+struct grep_state {
+    minfs_t *fs;
+    const uint8_t *zeros;       // a zone of them, for searching holes
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t matched;           // files with at least one hit
+    int failed;
+};
+
+// what the walk hands queue_file
+struct grep_walk {
+    struct pool *pool;
+    struct grep_state *st;
+};
+
+// one file being searched, zone by zone
+struct grep_file {
+    struct grep_state *st;
+    uint32_t ino;
+    char *path;
+
+    // the end of what has been searched so far, for matches that start
+    // in one zone and end in the next
+    uint8_t carry[MATCH_MAX_LEN - 1];
+    size_t carry_len;
+    uint64_t carry_off;         // where carry starts in the file
+
+    uint64_t base;              // file offset of what match_all is on
+    size_t boundary;            // only take hits across this (or 0)
+    struct hit *hits;
+    size_t nhits;
+    size_t cap;
+};
+
+static struct pattern *pats;
+static int npats;
+static size_t longest;
+
+static void add_hit(size_t at, int which, void *arg) {
+    struct grep_file *gf = arg;
+    struct hit *hits;
+
+    // in the stitched boundary only the ones that run across it count,
+    // the rest are found in one zone or the other on its own
+    if (gf->boundary && (at >= gf->boundary ||
+                         at + pats[which].len <= gf->boundary)) {
+        return;
+    }
+
+    if (gf->nhits == gf->cap) {
+        gf->cap = gf->cap ? gf->cap * 2 : HITS_START;
+        if ((hits = realloc(gf->hits, sizeof(struct hit) * gf->cap)) ==
+            NULL) {
+            perror("realloc");
+            exit(ERROR);
+        }
+        gf->hits = hits;
+    }
+    gf->hits[gf->nhits].off = gf->base + at;
+    gf->hits[gf->nhits].which = which;
+    gf->nhits++;
+}
+
+//! searches one zone, and the seam between it and the one before
+static int grep_zone(const uint8_t *data, size_t len, uint64_t off,
+                     uint32_t zone, void *arg) {
+    struct grep_file *gf = arg;
+    uint8_t seam[2 * (MATCH_MAX_LEN - 1)];
+    size_t head;
+    size_t keep;
+
+    // a hole is searched as the zeros it reads as
+    if (!data) {
+        data = gf->st->zeros;
+    }
+
+    // the end of the last zone with the start of this one
+    if (gf->carry_len) {
+        head = MIN(len, longest - 1);
+        memcpy(seam, gf->carry, gf->carry_len);
+        memcpy(seam + gf->carry_len, data, head);
+
+        gf->base = gf->carry_off;
+        gf->boundary = gf->carry_len;
+        match_all(seam, gf->carry_len + head, pats, npats, add_hit, gf);
+    }
+
+    gf->base = off;
+    gf->boundary = 0;
+    match_all(data, len, pats, npats, add_hit, gf);
+
+    // zones are always longer than a pattern, except the last one of a
+    // file which has nothing after it anyway
+    keep = MIN(len, longest - 1);
+    memcpy(gf->carry, data + len - keep, keep);
+    gf->carry_len = keep;
+    gf->carry_off = off + len - keep;
+    return SUCCESS;
+}
+
+static int compare_hits(const void *a, const void *b) {
+    const struct hit *x = a;
+    const struct hit *y = b;
+
+    if (x->off != y->off) {
+        return x->off < y->off ? -1 : 1;
+    }
+    return x->which - y->which;
+}
+
+//! searches one file, then prints its hits in order all in one go
+static void grep_file(void *arg) {
+    struct grep_file *gf = arg;
+    struct grep_state *st = gf->st;
+    size_t i;
+    int err;
+
+    if ((err = minfs_read_zones(st->fs, gf->ino, grep_zone, gf)) < 0) {
+        fprintf(stderr, "%s: %s\n", gf->path, minfs_strerror(err));
+        __atomic_store_n(&st->failed, TRUE, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&st->files, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->bytes, minfs_inode(st->fs, gf->ino)->size,
+                       __ATOMIC_RELAXED);
+
+    if (gf->nhits) {
+        __atomic_add_fetch(&st->matched, 1, __ATOMIC_RELAXED);
+        qsort(gf->hits, gf->nhits, sizeof(struct hit), compare_hits);
+
+        // one files lines stay together
+        flockfile(stdout);
+        for (i = 0; i < gf->nhits; i++) {
+            if (npats > 1) {
+                printf("%s:%llu:%.*s\n", gf->path,
+                       (unsigned long long)gf->hits[i].off,
+                       (int)pats[gf->hits[i].which].len,
+                       pats[gf->hits[i].which].bytes);
+            }
+            else {
+                printf("%s:%llu\n", gf->path,
+                       (unsigned long long)gf->hits[i].off);
+            }
+        }
+        funlockfile(stdout);
+    }
+
+    free(gf->hits);
+    free(gf->path);
+    free(gf);
+}
+
+//! queues every regular file the walk finds
+static int queue_file(minfs_t *fs, uint32_t ino, const struct inode *node,
+                      const char *path, void *arg) {
+    struct grep_walk *walk = arg;
+    struct grep_file *gf;
+
+    if ((node->mode & FILE_TYPE) != REGULAR_FILE) {
+        return SUCCESS;
+    }
+
+    if ((gf = calloc(1, sizeof(struct grep_file))) == NULL ||
+        (gf->path = strdup(path)) == NULL) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    gf->st = walk->st;
+    gf->ino = ino;
+    pool_submit(walk->pool, grep_file, gf);
+    return SUCCESS;
+}
+
+//! splits the pattern argument up at newlines, like grep -F
+static void parse_patterns(char *arg) {
+    char *line;
+    char *next;
+
+    for (line = arg; line; line = next) {
+        if ((next = strchr(line, '\n')) != NULL) {
+            *next++ = '\0';
+        }
+        if (!*line) {
+            continue;
+        }
+        if (strlen(line) > MATCH_MAX_LEN) {
+            fprintf(stderr, "mingrep: patterns are at most %d bytes\n",
+                    MATCH_MAX_LEN);
+            exit(ERROR);
+        }
+
+        if ((pats = realloc(pats, sizeof(struct pattern) * (npats + 1))) ==
+            NULL) {
+            perror("realloc");
+            exit(ERROR);
+        }
+        pats[npats].bytes = (const uint8_t *)line;
+        pats[npats].len = strlen(line);
+        longest = MAX(longest, pats[npats].len);
+        npats++;
+    }
+
+    if (!npats) {
+        fprintf(stderr, "mingrep: no pattern\n");
+        exit(ERROR);
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    struct grep_state st;
+    struct grep_walk walk;
+    uint32_t ino;
+    int pattern_at;
+    int i;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    // the pattern comes first like grep, take it out before getopt sees
+    // it so the image and path are where parse_cmd_line expects them
+    for (pattern_at = 1; pattern_at < argc; pattern_at++)
+    {
+        if (argv[pattern_at][0] != '-')
+        {
+            break;
+        }
+        if (option_takes_value(argv[pattern_at]))
+        {
+            pattern_at++;
+        }
+    }
+    if (pattern_at >= argc)
+    {
+        print_usage(argv);
+        exit(ERROR);
+    }
+    parse_patterns(argv[pattern_at]);
+    for (i = pattern_at; i < argc - 1; i++)
+    {
+        argv[i] = argv[i + 1];
+    }
+    parse_cmd_line(argc - 1, argv);
+
+    memset(&st, 0, sizeof(st));
+    st.fs = open_filesystem();
+    ino = lookup_src_path(st.fs);
+    if ((st.zeros = calloc(1, minfs_zonesize(st.fs))) == NULL)
+    {
+        perror("calloc");
+        exit(ERROR);
+    }
+
+    // the walk stays on this thread, the searching goes to the pool
+    walk.pool = pool_create(jobs);
+    walk.st = &st;
+    if ((minfs_inode(st.fs, ino)->mode & FILE_TYPE) == MASK_DIR)
+    {
+        i = minfs_walk(st.fs, ino, path_arg_count ? src_path_string : "/",
+                       queue_file, &walk);
+        if (i < 0)
+        {
+            fprintf(stderr, "%s\n", minfs_strerror(i));
+            exit(ERROR);
+        }
+    }
+    else
+    {
+        queue_file(st.fs, ino, minfs_inode(st.fs, ino), src_path_string,
+                   &walk);
+    }
+    pool_wait(walk.pool);
+    pool_destroy(walk.pool);
+
+    if (v_flag)
+    {
+        fprintf(stderr, "%llu files, %llu bytes searched, %llu matched\n",
+                (unsigned long long)st.files, (unsigned long long)st.bytes,
+                (unsigned long long)st.matched);
+    }
+
+    free((void *)st.zeros);
+    free(pats);
+    minfs_close(st.fs);
+
+    if (st.failed)
+    {
+        exit(ERROR);
+    }
+    return st.matched ? SUCCESS : NO_MATCH;
+}
@@ -4,98 +4,236 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
 
 #include "minfunc.h"
 #include "print.h"
 #include "helper.h"
+#include "partscan.h"
 
+#define CURSOR_LEN 32  // hex digits in a cursor token
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
 
-int main(int argc, char *argv[])
+//! prints one directory entry the way ls -l would (ish)
+static int print_entry(const struct minfs_dirent *ent, void *arg)
 {
+    minfs_t *fs = arg;
+    const struct inode *node = minfs_inode(fs, ent->ino);
 
-    // the disk iamge file
-    FILE *disk_image;
+    if (!node) {
+        fprintf(stderr, "%s: bad inode %u\n", ent->name, ent->ino);
+        return SUCCESS;
+    }
 
-    // count for moving through directory entries
-    int i;
+    print_file(node, ent->name);
+    printf("\n");
 
+    // every entry is its own little request
+    arena_reset(&request_arena);
+    return SUCCESS;
+}
 
-    // if no disk image given then just print out the usage statement 
-    if (argc < 2)
-    {
-        print_usage(argv);
-        return SUCCESS;
+//! what a cursor token is checked against: the directory it is in and
+//! how that directory looked, so a token for some other directory (or
+//! this one since it changed) isnt taken
+
+static uint32_t cursor_check(uint32_t ino, const struct inode *node,
+                             const struct minfs_dircursor *cur) {
+    uint32_t fields[5];
+    const uint8_t *p = (const uint8_t *)fields;
+    uint32_t h = FNV_OFFSET;
+    size_t i;
+
+    fields[0] = ino;
+    fields[1] = cur->zone;
+    fields[2] = cur->entry;
+    fields[3] = node->mtime;
+    fields[4] = node->size;
+    for (i = 0; i < sizeof(fields); i++) {
+        h = (h ^ p[i]) * FNV_PRIME;
     }
+    return h;
+}
 
-    // if there is more to do, parse through the command line
-    parse_cmd_line(argc, argv);
+//! turns a cursor into the token printed at the end of a page
+static void encode_cursor(uint32_t ino, const struct inode *node,
+                          const struct minfs_dircursor *cur, char *token) {
+    sprintf(token, "%08x%08x%08x%08x", ino, cur->zone, cur->entry,
+            cursor_check(ino, node, cur));
+}
 
-    // open the disk image, but if it can't be opened return error
-    if ((disk_image = fopen(image_file, "r")) == NULL)
-    {
-        perror("open");
+//! the cursor a token from an earlier page stands for, or exits saying
+//! why it cant be used
+
+static void decode_cursor(const char *token, uint32_t ino,
+                          const struct inode *node,
+                          struct minfs_dircursor *cur) {
+    unsigned int tok_ino, zone, entry, check;
+    int used = 0;
+
+    if (strlen(token) != CURSOR_LEN ||
+        sscanf(token, "%8x%8x%8x%8x%n", &tok_ino, &zone, &entry, &check,
+               &used) != 4 || used != CURSOR_LEN) {
+        fprintf(stderr, "%s: not a cursor\n", token);
         exit(ERROR);
     }
 
+    cur->zone = zone;
+    cur->entry = entry;
+    if (tok_ino != ino || check != cursor_check(ino, node, cur)) {
+        fprintf(stderr, "%s: cursor is for another directory, or this "
+                "one changed since\n", token);
+        exit(ERROR);
+    }
+}
 
-    // find the partition table information and read it into struct 
-    partition_info(disk_image);
+//! lists one page of directory ino from cur and prints the token for the
+//! next one to stderr, if there is more. only the zones on the page are
+//! read
 
-    // if the verbose flag is given here, then print the partition 
-    if (v_flag)
-    {
-        printf("Partition %d:\n", prim_part);
-        print_partition(partition);
-    }
+static void list_page(minfs_t *fs, uint32_t ino, const struct inode *node,
+                      struct minfs_dircursor cur) {
+    char token[CURSOR_LEN + 1];
+    int err;
 
-    // next, read the superblock 
-    read_superblock(disk_image);
+    err = minfs_readdir_page(fs, ino, &cur,
+                             page_limit ? page_limit : UINT32_MAX,
+                             print_entry, fs);
+    if (err < 0) {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
 
-    // then read all the inodes and store them 
-    read_store_inodes(disk_image);
+    // the cursor goes to stderr, so stdout is only ever the listing
+    if (cur.zone != MINFS_DIR_END) {
+        encode_cursor(ino, node, &cur, token);
+        fflush(stdout);
+        fprintf(stderr, "next cursor: %s\n", token);
+    }
+}
 
-    // if the vflag is on, we want to print everything so print inode info too
+//! lists the path in one filesystem, the partition flags are already set
+static void list_filesystem(struct fs_location *loc)
+{
+    // the filesystem and the inode the path leads to
+    minfs_t *fs;
+    const struct inode *node;
+    struct minfs_dircursor cur = { 0, 0 };
+    char target[PATH_MAX];
+    uint32_t ino;
+    int err;
+
+    // open it up, and print the partition, superblock and root for -v
+    fs = open_filesystem();
     if (v_flag) {
-        print_inode(&inodes[0]);
+        print_filesystem(fs);
     }
 
-   struct inode *node = find_inode_from_path(disk_image, &inodes[0], 0);
-    if (!node) {
-        fprintf(stderr, "Path not found");
-        exit(ERROR);
-    }
+    ino = lookup_src_path(fs);
+    node = minfs_inode(fs, ino);
 
     // if the inode found is of type directory, list its stuff
-    if ((node->mode & MASK_DIR) == MASK_DIR) {
+    if ((node->mode & FILE_TYPE) == MASK_DIR) {
+        if (cursor_token) {
+            decode_cursor(cursor_token, ino, node, &cur);
+        }
         print_path();
         printf(":\n");
 
-        // get all the entries out from that inode 
-        struct directory *dir = read_entries_from_inode(disk_image, node);
-
-        for (i = 0; i < node->size / sizeof(struct directory); i++) {
+        // a page at a time when there is a limit or a cursor
+        if (page_limit || cursor_token) {
+            list_page(fs, ino, node, cur);
+        }
 
-            // go through and print evey directory entry
-            if (dir[i].inode != 0) {
-                print_file(&inodes[dir[i].inode - 1], (char *)dir[i].name);
-                printf("\n");
-            }
+        // go through and print evey directory entry
+        else if ((err = minfs_readdir(fs, ino, print_entry, fs)) < 0) {
+            fprintf(stderr, "%s\n", minfs_strerror(err));
+            exit(ERROR);
         }
-        free(dir); // free my homie
     }
 
     //  if the path is a regular file, then just print its permissions and size
-    else if ((node->mode & REGULAR_FILE) == REGULAR_FILE) {
+    else if ((node->mode & FILE_TYPE) == REGULAR_FILE) {
         print_single_file_contents(node);
         printf(" %s\n", src_path_string);
     }
+    // a symlink also says where it goes, like ls -l
+    else if ((node->mode & FILE_TYPE) == SYM_LINK_TYPE) {
+        if ((err = minfs_readlink(fs, ino, target, sizeof(target) - 1)) <
+            0) {
+            fprintf(stderr, "%s: %s\n", src_path_string,
+                    minfs_strerror(err));
+            exit(ERROR);
+        }
+        target[MIN(err, (int)sizeof(target) - 1)] = '\0';
+        print_single_file_contents(node);
+        printf(" %s -> %s\n", src_path_string, target);
+    }
     // if its neither a file or a directory just exit
     else {
         fprintf(stderr, "Not file or directory");
         exit(ERROR);
     }
 
-    // close the disk
-    fclose(disk_image);
+    arena_reset(&request_arena);
+    minfs_close(fs);
+}
+
+
+int main(int argc, char *argv[])
+{
+
+    // the disk iamge file
+    minfs_image_t *disk_image;
+    int err;
+
+    // every minix filesystem on the disk for -a
+    struct fs_location *locs;
+    int count;
+    int ret;
+
+
+    // if no disk image given then just print out the usage statement 
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    // if there is more to do, parse through the command line
+    parse_cmd_line(argc, argv);
+
+    // with -a list the path on every filesystem in the partition tree
+    if (a_flag)
+    {
+        // a cursor is a place in one directory of one filesystem
+        if (cursor_token)
+        {
+            fprintf(stderr, "-C cant be used with -a\n");
+            exit(ERROR);
+        }
+
+        // open the disk image, but if it can't be opened return error
+        if ((disk_image = minfs_image_open(image_file, NULL, &err)) == NULL)
+        {
+            fprintf(stderr, "%s: %s\n", image_file, minfs_strerror(err));
+            exit(ERROR);
+        }
+
+        if ((count = scan_partitions(disk_image, &locs)) == 0)
+        {
+            fprintf(stderr, "No minix partitions found\n");
+            exit(ERROR);
+        }
+        minfs_image_close(disk_image);
+
+        ret = run_on_all_partitions(locs, count, list_filesystem);
+        free(locs);
+        return ret;
+    }
+
+    list_filesystem(NULL);
     return SUCCESS;
 }
@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+
+/*
+ * minpack writes a copy of a filesystem where everything is in order.
+ * The tree is laid out depth first: a directory, then the files in it,
+ * then its subdirectories the same way. Each file gets its zones in the
+ * order they are read, with an indirect table right before the zones it
+ * points at, so reading a file (or a whole subtree) back is one pass
+ * forwards over the image. Holes stay holes, deleted entries and unused
+ * inodes are left out, and inodes are numbered in the same order.
+ *
+ * The tree is packed twice. The first time nothing is written, it only
+ * counts the inodes and zones so the superblock, bitmaps and inode table
+ * can be sized. The second time zones are handed out from the first data
+ * zone and written as they are placed.
+ */
+
+#define OUT_BUF_SIZE (1 << 20)  // zones are written out this many at once
+#define ENTRIES_START 16
+
+/* Structures */
+
+// the data zones being written, zones mostly come one after the other so
+// they are gathered up into one big write
+struct pack_out {
+    int fd;
+    uint8_t *buf;
+    uint64_t start;     // where in the new image buf goes
+    size_t len;
+};
+
+struct pack_state {
+    minfs_t *fs;
+    uint32_t zonesize;
+    uint32_t per_table;     // zone numbers in an indirect table
+    int writing;            // FALSE while only counting
+
+    uint32_t *renumber;     // old inode number to new one, 0 for not yet
+    struct inode *table;    // the new inode table
+    uint32_t ninodes;       // inodes handed out so far
+    uint32_t next_zone;     // the next zone to hand out
+
+    // the tables of the file being packed, written once it is done
+    uint32_t *indirect;
+    uint32_t *two_indirect;
+    uint32_t *table_buf;    // the double indirect table being filled
+    uint32_t table_zone;    // and where it goes
+
+    struct pack_out out;
+};
+
+// what pack_dir keeps about each entry
+struct pack_dir {
+    struct directory *ents; // already in the on disk format
+    uint32_t *old;          // the inode each entry had in the old image
+    uint8_t *fresh;         // this is the first link to it
+    uint32_t count;
+    uint32_t cap;
+};
+
+//! writes out the gathered zones
+static void out_flush(struct pack_out *out) {
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < out->len) {
+        ret = pwrite(out->fd, out->buf + done, out->len - done,
+                     out->start + done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            exit(ERROR);
+        }
+        done += ret;
+    }
+    out->start += out->len;
+    out->len = 0;
+}
+
+//! puts len bytes of data in zone, zero filled to the end of the zone
+static void write_zone(struct pack_state *st, uint32_t zone,
+                       const uint8_t *data, size_t len) {
+    struct pack_out *out = &st->out;
+    uint64_t off = (uint64_t)zone * st->zonesize;
+
+    if (!st->writing) {
+        return;
+    }
+
+    if (off != out->start + out->len ||
+        out->len + st->zonesize > OUT_BUF_SIZE) {
+        out_flush(out);
+        out->start = off;
+    }
+    if (len) {
+        memcpy(out->buf + out->len, data, len);
+    }
+    memset(out->buf + out->len + len, 0, st->zonesize - len);
+    out->len += st->zonesize;
+}
+
+//! fills in a zone that was written earlier (an indirect table, once all
+//! of it is known). it is usually still in the buffer
+static void patch_zone(struct pack_state *st, uint32_t zone,
+                       const void *data) {
+    struct pack_out *out = &st->out;
+    uint64_t off = (uint64_t)zone * st->zonesize;
+
+    if (!st->writing) {
+        return;
+    }
+
+    if (off >= out->start && off < out->start + out->len) {
+        memcpy(out->buf + (off - out->start), data, st->zonesize);
+        return;
+    }
+    if (pwrite(out->fd, data, st->zonesize, off) !=
+        (ssize_t)st->zonesize) {
+        perror("write");
+        exit(ERROR);
+    }
+}
+
+//! hands out the next zone for an indirect table, which is filled in later
+static uint32_t table_zone(struct pack_state *st, uint32_t *table) {
+    uint32_t zone = st->next_zone++;
+
+    memset(table, 0, st->zonesize);
+    write_zone(st, zone, NULL, 0);
+    return zone;
+}
+
+//! gives zone idx of the file in node the next zone in the new image and
+//! writes data there, after any table it needs to be found through
+
+static int place_zone(struct pack_state *st, struct inode *node,
+                      uint64_t idx, const uint8_t *data, size_t len) {
+    uint32_t per = st->per_table;
+    uint32_t zone;
+
+    if (idx < DIRECT_ZONES) {
+        zone = node->zone[idx] = st->next_zone++;
+    }
+    else if ((idx -= DIRECT_ZONES) < per) {
+        if (!node->indirect) {
+            node->indirect = table_zone(st, st->indirect);
+        }
+        zone = st->indirect[idx] = st->next_zone++;
+    }
+    else {
+        idx -= per;
+        if (idx >= (uint64_t)per * per) {
+            return -EFBIG;
+        }
+        if (!node->two_indirect) {
+            node->two_indirect = table_zone(st, st->two_indirect);
+        }
+
+        // zones come in order, so a new second level table means the
+        // last one is full
+        if (!st->two_indirect[idx / per]) {
+            if (st->table_zone) {
+                patch_zone(st, st->table_zone, st->table_buf);
+            }
+            st->table_zone = table_zone(st, st->table_buf);
+            st->two_indirect[idx / per] = st->table_zone;
+        }
+        zone = st->table_buf[idx % per] = st->next_zone++;
+    }
+
+    write_zone(st, zone, data, len);
+    return SUCCESS;
+}
+
+//! writes out the tables of the file that was just packed
+static void finish_file(struct pack_state *st, const struct inode *node) {
+    if (st->table_zone) {
+        patch_zone(st, st->table_zone, st->table_buf);
+        st->table_zone = 0;
+    }
+    if (node->two_indirect) {
+        patch_zone(st, node->two_indirect, st->two_indirect);
+    }
+    if (node->indirect) {
+        patch_zone(st, node->indirect, st->indirect);
+    }
+}
+
+// what copy_zone needs
+struct pack_file {
+    struct pack_state *st;
+    struct inode *node;
+};
+
+static int copy_zone(const uint8_t *data, size_t len, uint64_t off,
+                     uint32_t zone, void *arg) {
+    struct pack_file *pf = arg;
+
+    // holes stay holes
+    if (zone == 0) {
+        return SUCCESS;
+    }
+    return place_zone(pf->st, pf->node, off / pf->st->zonesize, data, len);
+}
+
+//! moves the zones of a file or symlink over. while counting only where
+//! they are is needed, not what is in them
+
+static int pack_data(struct pack_state *st, uint32_t old, uint32_t new) {
+    struct pack_file pf;
+    int err;
+
+    pf.st = st;
+    pf.node = &st->table[new - 1];
+
+    if (st->writing) {
+        err = minfs_read_zones(st->fs, old, copy_zone, &pf);
+    }
+    else {
+        err = minfs_map_zones(st->fs, old, copy_zone, &pf);
+    }
+    if (err < 0) {
+        return err;
+    }
+    finish_file(st, pf.node);
+    return SUCCESS;
+}
+
+//! the next inode number, with a copy of the old inode in it
+static uint32_t new_inode(struct pack_state *st, uint32_t old) {
+    struct inode *node = &st->table[st->ninodes];
+    uint16_t type;
+
+    *node = *minfs_inode(st->fs, old);
+    node->links = 0;
+
+    // devices keep their numbers in the zones, everything else gets its
+    // zones handed out again
+    type = node->mode & FILE_TYPE;
+    if (type == REGULAR_FILE || type == MASK_DIR || type == SYM_LINK_TYPE) {
+        memset(node->zone, 0, sizeof(node->zone));
+        node->indirect = 0;
+        node->two_indirect = 0;
+    }
+
+    st->renumber[old] = ++st->ninodes;
+    return st->ninodes;
+}
+
+static int add_entry(const struct minfs_dirent *ent, void *arg) {
+    struct pack_dir *dir = arg;
+
+    if (dir->count == dir->cap) {
+        dir->cap = dir->cap ? dir->cap * 2 : ENTRIES_START;
+        dir->ents = realloc(dir->ents, sizeof(struct directory) * dir->cap);
+        dir->old = realloc(dir->old, sizeof(uint32_t) * dir->cap);
+        dir->fresh = realloc(dir->fresh, dir->cap);
+        if (!dir->ents || !dir->old || !dir->fresh) {
+            perror("realloc");
+            exit(ERROR);
+        }
+    }
+
+    memset(&dir->ents[dir->count], 0, sizeof(struct directory));
+    strncpy((char *)dir->ents[dir->count].name, ent->name, DIR_NAME_SIZE);
+    dir->old[dir->count] = ent->ino;
+    dir->fresh[dir->count] = FALSE;
+    dir->count++;
+    return SUCCESS;
+}
+
+//! packs directory old (new in the new image): its entries, then the
+//! files first linked from it, then its subdirectories
+
+static int pack_dir(struct pack_state *st, uint32_t old, uint32_t new,
+                    uint32_t parent) {
+    struct pack_dir dir;
+    struct inode *node;
+    const struct inode *child;
+    const char *name;
+    uint32_t zones;
+    uint32_t i;
+    int err;
+
+    memset(&dir, 0, sizeof(dir));
+    if ((err = minfs_readdir(st->fs, old, add_entry, &dir)) < 0) {
+        goto done;
+    }
+
+    // every entry gets its new number, and counts as a link to it
+    for (i = 0; i < dir.count; i++) {
+        name = (const char *)dir.ents[i].name;
+        if (!strcmp(name, ".")) {
+            dir.ents[i].inode = new;
+        }
+        else if (!strcmp(name, "..")) {
+            dir.ents[i].inode = parent;
+        }
+        else if (minfs_inode(st->fs, dir.old[i]) == NULL) {
+            err = -MINFS_ECORRUPT;
+            goto done;
+        }
+        else {
+            if (!st->renumber[dir.old[i]]) {
+                new_inode(st, dir.old[i]);
+                dir.fresh[i] = TRUE;
+            }
+            dir.ents[i].inode = st->renumber[dir.old[i]];
+        }
+        st->table[dir.ents[i].inode - 1].links++;
+    }
+
+    // the directory itself, with only the live entries
+    node = &st->table[new - 1];
+    node->size = dir.count * sizeof(struct directory);
+    zones = (node->size + st->zonesize - 1) / st->zonesize;
+    for (i = 0; i < zones; i++) {
+        if ((err = place_zone(st, node, i, (uint8_t *)dir.ents +
+                              (uint64_t)i * st->zonesize,
+                              MIN(st->zonesize,
+                                  node->size - i * st->zonesize))) < 0) {
+            goto done;
+        }
+    }
+    finish_file(st, node);
+
+    // the files right after it
+    for (i = 0; i < dir.count; i++) {
+        child = minfs_inode(st->fs, dir.old[i]);
+        if (dir.fresh[i] && ((child->mode & FILE_TYPE) == REGULAR_FILE ||
+                             (child->mode & FILE_TYPE) == SYM_LINK_TYPE)) {
+            if ((err = pack_data(st, dir.old[i], dir.ents[i].inode)) < 0) {
+                goto done;
+            }
+        }
+    }
+
+    // and then each subdirectory with everything under it
+    for (i = 0; i < dir.count; i++) {
+        child = minfs_inode(st->fs, dir.old[i]);
+        if (dir.fresh[i] && (child->mode & FILE_TYPE) == MASK_DIR) {
+            if ((err = pack_dir(st, dir.old[i], dir.ents[i].inode,
+                                new)) < 0) {
+                goto done;
+            }
+        }
+    }
+    err = SUCCESS;
+
+done:
+    free(dir.ents);
+    free(dir.old);
+    free(dir.fresh);
+    return err;
+}
+
+//! packs the whole tree once, from first_zone on
+static int pack_tree(struct pack_state *st, uint32_t first_zone) {
+    memset(st->renumber, 0, sizeof(uint32_t) *
+           (minfs_ninodes(st->fs) + 1));
+    memset(st->table, 0, sizeof(struct inode) * minfs_ninodes(st->fs));
+    st->ninodes = 0;
+    st->next_zone = first_zone;
+
+    new_inode(st, ROOT_INODE);
+    return pack_dir(st, ROOT_INODE, ROOT_INODE, ROOT_INODE);
+}
+
+//! sets the bits from up to (not including) to
+static void set_bits(uint8_t *map, uint64_t from, uint64_t to) {
+    for (; from < to; from++) {
+        map[from / 8] |= 1 << (from % 8);
+    }
+}
+
+//! writes the boot block, superblock, bitmaps and inode table in front of
+//! the data zones. used is how many inodes and zones were handed out
+
+static void write_metadata(struct pack_state *st, struct superblock *sb,
+                           uint32_t used_inodes, uint32_t used_zones) {
+    uint64_t size = (uint64_t)sb->firstdata * st->zonesize;
+    uint64_t bits = (uint64_t)sb->blocksize * 8;
+    uint8_t *imap;
+    uint8_t *zmap;
+    uint8_t *head;
+
+    if ((head = calloc(1, size)) == NULL) {
+        perror("calloc");
+        exit(ERROR);
+    }
+    memcpy(head + BLOCK_SIZE, sb, sizeof(struct superblock));
+
+    // bit 0 of both maps is never used, and nor is anything past the end
+    imap = head + 2 * sb->blocksize;
+    set_bits(imap, 0, used_inodes + 1);
+    set_bits(imap, (uint64_t)sb->ninodes + 1, sb->i_blocks * bits);
+
+    zmap = imap + (uint64_t)sb->i_blocks * sb->blocksize;
+    set_bits(zmap, 0, used_zones + 1);
+    set_bits(zmap, (uint64_t)sb->zones - sb->firstdata + 1,
+             sb->z_blocks * bits);
+
+    memcpy(zmap + (uint64_t)sb->z_blocks * sb->blocksize, st->table,
+           sizeof(struct inode) * used_inodes);
+
+    if (pwrite(st->out.fd, head, size, 0) != (ssize_t)size) {
+        perror("write");
+        exit(ERROR);
+    }
+    free(head);
+}
+
+//! works out the new superblock for this many inodes and data zones
+static int layout(const struct superblock *old, uint32_t inodes,
+                  uint32_t data_zones, struct superblock *sb) {
+    uint32_t per_block = old->blocksize / sizeof(struct inode);
+    uint64_t bits = (uint64_t)old->blocksize * 8;
+    uint64_t blocks;
+    uint64_t firstdata;
+
+    memset(sb, 0, sizeof(struct superblock));
+    sb->magic = SUPERBLOCK_MAGIC;
+    sb->blocksize = old->blocksize;
+    sb->log_zone_size = old->log_zone_size;
+    sb->max_file = old->max_file;
+    sb->subversion = old->subversion;
+
+    // the last block of the inode table may as well be full
+    sb->ninodes = (inodes + per_block - 1) / per_block * per_block;
+    sb->i_blocks = (sb->ninodes + bits) / bits;
+    sb->z_blocks = (data_zones + bits) / bits;
+
+    // boot block, superblock, bitmaps and inode table, in whole zones
+    blocks = 2 + (uint64_t)sb->i_blocks + sb->z_blocks +
+             sb->ninodes / per_block;
+    firstdata = (blocks + (1 << sb->log_zone_size) - 1) >>
+                sb->log_zone_size;
+    if (firstdata > UINT16_MAX ||
+        firstdata + data_zones > UINT32_MAX) {
+        return -EFBIG;
+    }
+    sb->firstdata = firstdata;
+    sb->zones = firstdata + data_zones;
+    return SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    struct pack_state st;
+    struct superblock sb;
+    struct stat in_stat;
+    struct stat out_stat;
+    uint32_t inodes;
+    uint32_t data_zones;
+    int err;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    parse_cmd_line(argc, argv);
+    if (src_path_string == NULL)
+    {
+        print_usage(argv);
+        exit(ERROR);
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.fs = open_filesystem();
+    st.zonesize = minfs_zonesize(st.fs);
+    st.per_table = st.zonesize / IZT_ENTRY_SIZE;
+
+    st.renumber = malloc(sizeof(uint32_t) * (minfs_ninodes(st.fs) + 1));
+    st.table = malloc(sizeof(struct inode) * minfs_ninodes(st.fs));
+    st.indirect = malloc(st.zonesize);
+    st.two_indirect = malloc(st.zonesize);
+    st.table_buf = malloc(st.zonesize);
+    st.out.buf = malloc(OUT_BUF_SIZE);
+    if (!st.renumber || !st.table || !st.indirect || !st.two_indirect ||
+        !st.table_buf || !st.out.buf)
+    {
+        perror("malloc");
+        exit(ERROR);
+    }
+
+    // first only count what the new image needs
+    if ((err = pack_tree(&st, 0)) < 0)
+    {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
+    inodes = st.ninodes;
+    data_zones = st.next_zone;
+    if ((err = layout(minfs_superblock(st.fs), inodes, data_zones,
+                      &sb)) < 0)
+    {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
+
+    // writing over the image while it is mapped would end badly
+    st.out.fd = open(src_path_string, O_WRONLY | O_CREAT, 0644);
+    if (st.out.fd < 0)
+    {
+        perror(src_path_string);
+        exit(ERROR);
+    }
+    if (stat(image_file, &in_stat) == 0 && fstat(st.out.fd, &out_stat) == 0
+        && in_stat.st_dev == out_stat.st_dev &&
+        in_stat.st_ino == out_stat.st_ino)
+    {
+        fprintf(stderr, "minpack: %s is the image being packed\n",
+                src_path_string);
+        exit(ERROR);
+    }
+    if (ftruncate(st.out.fd, 0) < 0)
+    {
+        perror(src_path_string);
+        exit(ERROR);
+    }
+
+    // then do it again for real, right after the metadata
+    st.writing = TRUE;
+    st.out.start = (uint64_t)sb.firstdata * st.zonesize;
+    if ((err = pack_tree(&st, sb.firstdata)) < 0)
+    {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
+    out_flush(&st.out);
+    write_metadata(&st, &sb, inodes, data_zones);
+
+    if (ftruncate(st.out.fd, (uint64_t)sb.zones * st.zonesize) < 0 ||
+        close(st.out.fd) < 0)
+    {
+        perror(src_path_string);
+        exit(ERROR);
+    }
+
+    if (v_flag)
+    {
+        fprintf(stderr, "%u inodes (of %u), %u data zones of %u bytes, "
+                "%llu bytes (was %llu)\n", inodes, minfs_ninodes(st.fs),
+                data_zones, st.zonesize,
+                (unsigned long long)sb.zones * st.zonesize,
+                (unsigned long long)minfs_superblock(st.fs)->zones *
+                minfs_zonesize(st.fs));
+    }
+
+    free(st.renumber);
+    free(st.table);
+    free(st.indirect);
+    free(st.two_indirect);
+    free(st.table_buf);
+    free(st.out.buf);
+    minfs_close(st.fs);
+    return SUCCESS;
+}
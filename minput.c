@@ -0,0 +1,655 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "minfunc.h"
+#include "print.h"
+#include "helper.h"
+
+/*
+ * minput copies a file from the host into an image. Reading (finding the
+ * directory, checking the name is free) goes through libminfs as usual,
+ * writing goes straight to the image file.
+ *
+ * The bitmaps are read in whole and scanned a 64 bit word at a time:
+ * words with every bit set are skipped in one compare and the first free
+ * bit in a word is one count trailing zeros. Zones come from the first
+ * free run that holds all of the file (its data and indirect tables),
+ * and only when there is none from the longest runs there are, so a file
+ * ends up in as few pieces as the free space allows. Tables go right
+ * before the zones they point at, like minpack lays them out.
+ *
+ * The data zones are written first. Every metadata change (bitmaps,
+ * inode table blocks, indirect tables, the directory) is made on a copy
+ * in memory, and they all go out together at the end followed by one
+ * fsync, so the image never has metadata pointing at data that isnt
+ * there yet.
+ */
+
+#define OUT_BUF_SIZE (1 << 20)  // data zones are written this many at once
+#define META_START 8
+
+/* Structures */
+
+// a piece of metadata waiting to be written
+struct meta {
+    uint64_t off;       // in the image
+    size_t len;
+    uint8_t *data;
+};
+
+// one of the bitmaps, as it is in the image
+struct bitmap {
+    uint64_t *words;    // points into its meta copy
+    uint64_t nbits;     // bits that mean something, bit 0 included
+};
+
+struct put_state {
+    minfs_t *fs;
+    const struct superblock *sb;
+    int fd;             // the image, open for writing
+    uint64_t start;     // where the filesystem starts in it
+    uint32_t zonesize;
+    uint32_t per_table;
+    struct bitmap imap;
+    struct bitmap zmap;
+    struct meta *meta;
+    int nmeta;
+    int cap;
+};
+
+// where the new directory entry goes
+struct dir_slot {
+    uint32_t zone;      // a free entry was found in this zone
+    uint32_t at;        // this far into it
+    int found;
+    uint32_t last_zone; // the zone the directory ends in
+};
+
+//! the copy of len bytes at off in the image that gets written at the
+//! end. the same off always gets the same copy, read in the first time
+//! when read_it is set (and zeroed otherwise)
+
+static uint8_t *meta_get(struct put_state *st, uint64_t off, size_t len,
+                         int read_it) {
+    struct meta *m;
+    int i;
+
+    for (i = 0; i < st->nmeta; i++) {
+        if (st->meta[i].off == off) {
+            return st->meta[i].data;
+        }
+    }
+
+    if (st->nmeta == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : META_START;
+        if ((st->meta = realloc(st->meta, sizeof(struct meta) * st->cap)) ==
+            NULL) {
+            perror("realloc");
+            exit(ERROR);
+        }
+    }
+    m = &st->meta[st->nmeta++];
+    m->off = off;
+    m->len = len;
+    if ((m->data = calloc(1, len)) == NULL) {
+        perror("calloc");
+        exit(ERROR);
+    }
+    if (read_it && pread(st->fd, m->data, len, off) != (ssize_t)len) {
+        perror("read");
+        exit(ERROR);
+    }
+    return m->data;
+}
+
+static int compare_meta(const void *a, const void *b) {
+    const struct meta *x = a;
+    const struct meta *y = b;
+
+    return x->off < y->off ? -1 : x->off > y->off;
+}
+
+//! writes every piece of metadata in image order, then syncs once
+static void meta_flush(struct put_state *st) {
+    int i;
+
+    qsort(st->meta, st->nmeta, sizeof(struct meta), compare_meta);
+    for (i = 0; i < st->nmeta; i++) {
+        if (pwrite(st->fd, st->meta[i].data, st->meta[i].len,
+                   st->meta[i].off) != (ssize_t)st->meta[i].len) {
+            perror("write");
+            exit(ERROR);
+        }
+        free(st->meta[i].data);
+    }
+    if (fsync(st->fd) < 0) {
+        perror("fsync");
+        exit(ERROR);
+    }
+    free(st->meta);
+}
+
+//! where block n of the filesystem is in the image
+static uint64_t block_off(struct put_state *st, uint64_t n) {
+    return st->start + n * st->sb->blocksize;
+}
+
+//! the first bit at or after from that is set (or clear), nbits if none.
+//! a word at a time, so full (or empty) stretches go by 64 bits a step
+
+static uint64_t next_bit(const struct bitmap *map, uint64_t from, int set) {
+    uint64_t w;
+    uint64_t word;
+
+    if (from >= map->nbits) {
+        return map->nbits;
+    }
+    w = from / 64;
+    word = (set ? map->words[w] : ~map->words[w]) & (~0ULL << (from % 64));
+
+    while (!word) {
+        if (++w * 64 >= map->nbits) {
+            return map->nbits;
+        }
+        word = set ? map->words[w] : ~map->words[w];
+    }
+    return MIN(w * 64 + __builtin_ctzll(word), map->nbits);
+}
+
+static void mark_bits(struct bitmap *map, uint64_t from, uint64_t count) {
+    for (; count; from++, count--) {
+        map->words[from / 64] |= 1ULL << (from % 64);
+    }
+}
+
+//! reads a bitmap blocks long starting at block first
+static void load_bitmap(struct put_state *st, struct bitmap *map,
+                        uint64_t first, uint64_t blocks, uint64_t nbits) {
+    uint64_t len = blocks * st->sb->blocksize;
+
+    if (nbits > len * 8) {
+        fprintf(stderr, "%s: %s\n", image_file,
+                minfs_strerror(-MINFS_ECORRUPT));
+        exit(ERROR);
+    }
+    map->words = (uint64_t *)meta_get(st, block_off(st, first), len, TRUE);
+    map->nbits = nbits;
+}
+
+//! takes need zones, from the first free run big enough for all of them
+//! or else the longest runs there are. they go in zones in disk order
+
+static int alloc_zones(struct put_state *st, uint32_t need,
+                       uint32_t *zones) {
+    struct bitmap *map = &st->zmap;
+    uint64_t best;
+    uint64_t best_len;
+    uint64_t a;
+    uint64_t b;
+    uint32_t got = 0;
+
+    while (got < need) {
+        best = 0;
+        best_len = 0;
+        for (a = next_bit(map, 1, FALSE); a < map->nbits;
+             a = next_bit(map, b, FALSE)) {
+            b = next_bit(map, a, TRUE);
+            if (b - a >= need - got) {
+                best = a;
+                best_len = need - got;
+                break;
+            }
+            if (b - a > best_len) {
+                best = a;
+                best_len = b - a;
+            }
+        }
+        if (!best_len) {
+            return -ENOSPC;
+        }
+
+        mark_bits(map, best, best_len);
+        for (; best_len; best++, best_len--) {
+            zones[got++] = st->sb->firstdata + best - 1;
+        }
+    }
+    return SUCCESS;
+}
+
+//! the copy of inode ino that gets written back
+static struct inode *inode_get(struct put_state *st, uint32_t ino) {
+    uint64_t table = 2 + (uint64_t)st->sb->i_blocks + st->sb->z_blocks;
+    uint64_t at = (uint64_t)(ino - 1) * sizeof(struct inode);
+    uint8_t *block;
+
+    block = meta_get(st, block_off(st, table + at / st->sb->blocksize),
+                     st->sb->blocksize, TRUE);
+    return (struct inode *)(block + at % st->sb->blocksize);
+}
+
+//! the copy of an indirect table (or directory zone) that gets written
+static uint32_t *zone_get(struct put_state *st, uint32_t zone,
+                          int read_it) {
+    return (uint32_t *)meta_get(st, st->start +
+                                (uint64_t)zone * st->zonesize,
+                                st->zonesize, read_it);
+}
+
+//! how many zones a file of size bytes needs, its tables included
+static uint64_t zones_needed(struct put_state *st, uint64_t size,
+                             uint64_t *data) {
+    uint64_t per = st->per_table;
+    uint64_t n = (size + st->zonesize - 1) / st->zonesize;
+    uint64_t total = n;
+
+    *data = n;
+    if (n > DIRECT_ZONES) {
+        total++;
+    }
+    if (n > DIRECT_ZONES + per) {
+        total += 1 + (n - DIRECT_ZONES - per + per - 1) / per;
+    }
+    return total;
+}
+
+//! reads exactly len bytes of the host file (less only at its end)
+static ssize_t read_full(int fd, uint8_t *buf, size_t len) {
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < len) {
+        if ((ret = read(fd, buf + done, len - done)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+//! hands out the zones to the file in node in read order, each table just
+//! before the zones it points at, and copies the host file into them
+
+static int write_file(struct put_state *st, int in, struct inode *node,
+                      const uint32_t *zones, uint64_t count) {
+    uint32_t per = st->per_table;
+    uint32_t *indirect = NULL;
+    uint32_t *two_indirect = NULL;
+    uint32_t *table = NULL;
+    uint8_t *buf;
+    uint64_t run_start = 0;     // zone the buffer goes at
+    size_t run_len = 0;
+    uint64_t idx;
+    uint64_t j;
+    uint32_t zone;
+    ssize_t got;
+    uint64_t k = 0;
+
+    if ((buf = malloc(OUT_BUF_SIZE)) == NULL) {
+        return -ENOMEM;
+    }
+
+    for (idx = 0; idx < count; idx++) {
+        // the tables come first
+        if (idx < DIRECT_ZONES) {
+            zone = node->zone[idx] = zones[k++];
+        }
+        else if ((j = idx - DIRECT_ZONES) < per) {
+            if (j == 0) {
+                node->indirect = zones[k++];
+                indirect = zone_get(st, node->indirect, FALSE);
+            }
+            zone = indirect[j] = zones[k++];
+        }
+        else {
+            j -= per;
+            if (j == 0) {
+                node->two_indirect = zones[k++];
+                two_indirect = zone_get(st, node->two_indirect, FALSE);
+            }
+            if (j % per == 0) {
+                two_indirect[j / per] = zones[k++];
+                table = zone_get(st, two_indirect[j / per], FALSE);
+            }
+            zone = table[j % per] = zones[k++];
+        }
+
+        // zones that follow each other on disk are written together
+        if (run_len && (zone != run_start + run_len / st->zonesize ||
+                        run_len + st->zonesize > OUT_BUF_SIZE)) {
+            if (pwrite(st->fd, buf, run_len, st->start + run_start *
+                       st->zonesize) != (ssize_t)run_len) {
+                free(buf);
+                return -errno;
+            }
+            run_len = 0;
+        }
+        if (!run_len) {
+            run_start = zone;
+        }
+
+        memset(buf + run_len, 0, st->zonesize);
+        if ((got = read_full(in, buf + run_len, st->zonesize)) < 0) {
+            free(buf);
+            return got;
+        }
+        run_len += st->zonesize;
+    }
+
+    if (run_len && pwrite(st->fd, buf, run_len, st->start + run_start *
+                          st->zonesize) != (ssize_t)run_len) {
+        free(buf);
+        return -errno;
+    }
+    free(buf);
+    return SUCCESS;
+}
+
+static int find_slot(const uint8_t *data, size_t len, uint64_t off,
+                     uint32_t zone, void *arg) {
+    struct dir_slot *slot = arg;
+    struct directory ent;
+    size_t at;
+
+    slot->last_zone = zone;
+    if (!data) {
+        return SUCCESS;
+    }
+
+    for (at = 0; at + sizeof(struct directory) <= len;
+         at += sizeof(struct directory)) {
+        memcpy(&ent, data + at, sizeof(struct directory));
+        if (ent.inode == 0) {
+            slot->zone = zone;
+            slot->at = at;
+            slot->found = TRUE;
+            return 1;   // stops the walk
+        }
+    }
+    return SUCCESS;
+}
+
+//! links ino into directory dir as name, in a free entry if there is one
+//! and at the end (in a new zone if it has to be) if not
+
+static int add_entry(struct put_state *st, uint32_t dir, const char *name,
+                     uint32_t ino) {
+    struct inode *node = inode_get(st, dir);
+    struct directory *ent;
+    struct dir_slot slot;
+    uint64_t idx = 0;
+    uint32_t zone;
+    uint32_t *indirect;
+    uint32_t new_zones[2];
+    int err;
+
+    memset(&slot, 0, sizeof(slot));
+    if ((err = minfs_read_zones(st->fs, dir, find_slot, &slot)) < 0) {
+        return err;
+    }
+
+    // past the end, in the last zone if there is room in it
+    if (!slot.found) {
+        idx = node->size / st->zonesize;
+        slot.at = node->size % st->zonesize;
+        slot.zone = slot.at ? slot.last_zone : 0;
+        node->size += sizeof(struct directory);
+    }
+
+    // or in a new one (with an indirect table too maybe)
+    if (slot.zone == 0) {
+        if (idx >= DIRECT_ZONES + st->per_table) {
+            return -EFBIG;
+        }
+        if (idx == DIRECT_ZONES ||
+            (idx > DIRECT_ZONES && !node->indirect)) {
+            if ((err = alloc_zones(st, 2, new_zones)) < 0) {
+                return err;
+            }
+            node->indirect = new_zones[0];
+            zone_get(st, node->indirect, FALSE);
+            zone = new_zones[1];
+        }
+        else if ((err = alloc_zones(st, 1, &zone)) < 0) {
+            return err;
+        }
+
+        if (idx < DIRECT_ZONES) {
+            node->zone[idx] = zone;
+        }
+        else {
+            indirect = zone_get(st, node->indirect, TRUE);
+            indirect[idx - DIRECT_ZONES] = zone;
+        }
+        zone_get(st, zone, FALSE);
+        slot.zone = zone;
+    }
+
+    ent = (struct directory *)((uint8_t *)zone_get(st, slot.zone, TRUE) +
+                               slot.at);
+    memset(ent, 0, sizeof(struct directory));
+    ent->inode = ino;
+    strncpy((char *)ent->name, name, DIR_NAME_SIZE);
+
+    node->mtime = node->ctime = time(NULL);
+    return SUCCESS;
+}
+
+//! splits the destination into the directory the file goes in and its
+//! name there. a directory that already exists gets the host files name
+
+static void find_destination(minfs_t *fs, char *dst, const char *host,
+                             uint32_t *dir, const char **name) {
+    const struct inode *node;
+    char *slash;
+    uint32_t ino;
+    int err;
+
+    if (minfs_lookup(fs, dst, &ino) == 0) {
+        node = minfs_inode(fs, ino);
+        if ((node->mode & FILE_TYPE) != MASK_DIR) {
+            fprintf(stderr, "%s: %s\n", dst, strerror(EEXIST));
+            exit(ERROR);
+        }
+        *dir = ino;
+        *name = (slash = strrchr(host, '/')) ? slash + 1 : host;
+    }
+    else {
+        slash = strrchr(dst, '/');
+        *name = slash ? slash + 1 : dst;
+        if (slash) {
+            *slash = '\0';
+        }
+        // the directory can be reached through a symlink like any other
+        if ((err = minfs_resolve(fs, slash ? dst : "/", dir)) < 0) {
+            fprintf(stderr, "%s: %s\n", dst, minfs_strerror(err));
+            exit(ERROR);
+        }
+        if ((minfs_inode(fs, *dir)->mode & FILE_TYPE) != MASK_DIR) {
+            fprintf(stderr, "%s: %s\n", dst, strerror(ENOTDIR));
+            exit(ERROR);
+        }
+    }
+
+    if (!**name || strlen(*name) > DIR_NAME_SIZE) {
+        fprintf(stderr, "%s: %s\n", *name, strerror(ENAMETOOLONG));
+        exit(ERROR);
+    }
+}
+
+// what name_taken looks for
+struct name_search {
+    const char *name;
+    int found;
+};
+
+static int match_name(const struct minfs_dirent *ent, void *arg) {
+    struct name_search *search = arg;
+
+    if (!strcmp(ent->name, search->name)) {
+        search->found = TRUE;
+        return 1;
+    }
+    return SUCCESS;
+}
+
+//! true if directory dir already has something called name
+static int name_taken(minfs_t *fs, uint32_t dir, const char *name) {
+    struct name_search search;
+    int err;
+
+    search.name = name;
+    search.found = FALSE;
+    if ((err = minfs_readdir(fs, dir, match_name, &search)) < 0) {
+        fprintf(stderr, "%s\n", minfs_strerror(err));
+        exit(ERROR);
+    }
+    return search.found;
+}
+
+int main(int argc, char *argv[])
+{
+    struct put_state st;
+    struct superblock on_disk;
+    struct stat host;
+    struct inode *node;
+    const char *name;
+    uint32_t *zones;
+    uint32_t dir;
+    uint32_t ino;
+    uint64_t count;
+    uint64_t total;
+    int in;
+    int err;
+
+    if (argc < 2)
+    {
+        print_usage(argv);
+        return SUCCESS;
+    }
+
+    parse_cmd_line(argc, argv);
+    if (src_path_string == NULL || dst_path_string == NULL)
+    {
+        print_usage(argv);
+        exit(ERROR);
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.fs = open_filesystem();
+    st.sb = minfs_superblock(st.fs);
+    st.zonesize = minfs_zonesize(st.fs);
+    st.per_table = st.zonesize / IZT_ENTRY_SIZE;
+    if (p_flag)
+    {
+        st.start = (uint64_t)minfs_partition(st.fs)->lFirst * SECTOR_SIZE;
+    }
+
+    // the image has to be a plain one to be written to
+    if ((st.fd = open(image_file, O_RDWR)) < 0)
+    {
+        perror(image_file);
+        exit(ERROR);
+    }
+    if (pread(st.fd, &on_disk, sizeof(on_disk), st.start + BLOCK_SIZE) !=
+        sizeof(on_disk) || memcmp(&on_disk, st.sb, sizeof(on_disk)))
+    {
+        fprintf(stderr, "%s: only uncompressed images can be written\n",
+                image_file);
+        exit(ERROR);
+    }
+
+    if ((in = open(src_path_string, O_RDONLY)) < 0 || fstat(in, &host) < 0)
+    {
+        perror(src_path_string);
+        exit(ERROR);
+    }
+    if (!S_ISREG(host.st_mode))
+    {
+        fprintf(stderr, "%s: not a regular file\n", src_path_string);
+        exit(ERROR);
+    }
+
+    find_destination(st.fs, dst_path_string, src_path_string, &dir, &name);
+    if (name_taken(st.fs, dir, name))
+    {
+        fprintf(stderr, "%s: %s\n", name, strerror(EEXIST));
+        exit(ERROR);
+    }
+
+    total = zones_needed(&st, host.st_size, &count);
+    if ((uint64_t)host.st_size > st.sb->max_file ||
+        count > DIRECT_ZONES + st.per_table +
+                (uint64_t)st.per_table * st.per_table)
+    {
+        fprintf(stderr, "%s: %s\n", src_path_string, strerror(EFBIG));
+        exit(ERROR);
+    }
+
+    load_bitmap(&st, &st.imap, 2, st.sb->i_blocks,
+                (uint64_t)st.sb->ninodes + 1);
+    load_bitmap(&st, &st.zmap, 2 + st.sb->i_blocks, st.sb->z_blocks,
+                (uint64_t)st.sb->zones - st.sb->firstdata + 1);
+
+    // an inode and the zones for it
+    if ((ino = next_bit(&st.imap, 1, FALSE)) >= st.imap.nbits)
+    {
+        fprintf(stderr, "%s: no free inodes\n", image_file);
+        exit(ERROR);
+    }
+    mark_bits(&st.imap, ino, 1);
+
+    if ((zones = malloc(sizeof(uint32_t) * (total + 1))) == NULL)
+    {
+        perror("malloc");
+        exit(ERROR);
+    }
+    if ((err = alloc_zones(&st, total, zones)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", image_file, strerror(-err));
+        exit(ERROR);
+    }
+
+    node = inode_get(&st, ino);
+    memset(node, 0, sizeof(struct inode));
+    node->mode = REGULAR_FILE | (host.st_mode & 07777);
+    node->links = 1;
+    node->uid = host.st_uid;
+    node->gid = host.st_gid;
+    node->size = host.st_size;
+    node->atime = host.st_atime;
+    node->mtime = host.st_mtime;
+    node->ctime = time(NULL);
+
+    // the data goes out now, the metadata only once it is all there
+    if ((err = write_file(&st, in, node, zones, count)) < 0 ||
+        (err = add_entry(&st, dir, name, ino)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", dst_path_string, minfs_strerror(err));
+        exit(ERROR);
+    }
+    meta_flush(&st);
+
+    if (v_flag)
+    {
+        fprintf(stderr, "inode %u, %llu zones from %u\n", ino,
+                (unsigned long long)total, total ? zones[0] : 0);
+    }
+
+    free(zones);
+    close(in);
+    close(st.fd);
+    minfs_close(st.fs);
+    return SUCCESS;
+}
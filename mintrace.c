@@ -0,0 +1,585 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "minfunc.h"
+#include "minfs.h"
+#include "print.h"
+#include "helper.h"
+
+/*
+ * Replays a trace written with -T against caches that dont exist, to see
+ * what one would have done for that run before building it. Every read
+ * in the trace is cut into the zones it covers, and each zone either
+ * hits the simulated cache or misses it and costs a read. With readahead
+ * a miss right after the zone before it (in the same filesystem) reads
+ * the next few zones too in the same I/O, the way the kernel does.
+ *
+ * Every combination of the cache sizes (-c), eviction policies (-e) and
+ * readahead lengths (-r) gets one line: how many zones hit, how many
+ * reads and bytes it would have taken, and how much of what was read
+ * ahead got used before it was thrown out.
+ *
+ * lru throws out what was used longest ago, fifo what went in first, and
+ * random anything (from a fixed seed, so runs compare).
+ */
+
+#define SIZES_DEFAULT "256K,1M,4M,16M,64M"
+#define POLICIES_DEFAULT "lru,fifo,random"
+#define AHEAD_DEFAULT "0,8,32"
+#define MAX_CHOICES 16
+#define MAX_FS 4096
+#define NONE (-1)
+#define RANDOM_SEED 0x9E3779B97F4A7C15ULL
+#define MIB (1024.0 * 1024.0)
+
+#define POLICY_LRU 0
+#define POLICY_FIFO 1
+#define POLICY_RANDOM 2
+
+/* Structures */
+
+// one zone held in the simulated cache
+struct sim_entry {
+    uint64_t key;       // filesystem in the top half, zone in the bottom
+    uint32_t size;
+    int ahead;          // read ahead and not used yet
+    int32_t chain;      // next in the same bucket
+    int32_t newer;      // the use (or insert) list
+    int32_t older;
+    uint32_t slot;      // where it is in sim->slots, for random
+};
+
+// what one simulated cache came to
+struct sim_stats {
+    uint64_t accesses[MINFS_TRACE_TYPES];
+    uint64_t hits[MINFS_TRACE_TYPES];
+    uint64_t ios;
+    uint64_t bytes;
+    uint64_t ahead_read;    // zones read ahead
+    uint64_t ahead_used;    // of those, ones used before going
+};
+
+struct sim {
+    uint64_t capacity;
+    int policy;
+    uint32_t ahead;
+
+    struct sim_entry *entries;
+    uint32_t nentries;
+    int32_t free_list;      // through chain
+    int32_t *buckets;
+    uint64_t mask;
+    int32_t newest;
+    int32_t oldest;
+    uint32_t *slots;        // every entry in use, for random
+    uint32_t nslots;
+    uint64_t held;          // bytes
+    uint64_t rng;
+
+    uint32_t zonesize[MAX_FS];
+    int64_t last[MAX_FS];   // zone each filesystem read last, -1 for none
+    struct sim_stats st;
+};
+
+static const char *type_names[MINFS_TRACE_TYPES] = {
+    "fs", "super", "inodes", "dir", "indirect", "data",
+};
+
+static const char *policy_names[] = { "lru", "fifo", "random" };
+
+/* The simulated cache */
+
+static uint64_t hash_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static uint64_t next_random(struct sim *sim) {
+    sim->rng ^= sim->rng << 13;
+    sim->rng ^= sim->rng >> 7;
+    sim->rng ^= sim->rng << 17;
+    return sim->rng;
+}
+
+static int32_t sim_find(struct sim *sim, uint64_t key) {
+    int32_t i = sim->buckets[hash_key(key) & sim->mask];
+
+    while (i != NONE && sim->entries[i].key != key) {
+        i = sim->entries[i].chain;
+    }
+    return i;
+}
+
+static void unlink_use(struct sim *sim, int32_t i) {
+    struct sim_entry *e = &sim->entries[i];
+
+    if (e->newer != NONE) {
+        sim->entries[e->newer].older = e->older;
+    }
+    else {
+        sim->newest = e->older;
+    }
+    if (e->older != NONE) {
+        sim->entries[e->older].newer = e->newer;
+    }
+    else {
+        sim->oldest = e->newer;
+    }
+}
+
+static void push_use(struct sim *sim, int32_t i) {
+    struct sim_entry *e = &sim->entries[i];
+
+    e->newer = NONE;
+    e->older = sim->newest;
+    if (sim->newest != NONE) {
+        sim->entries[sim->newest].newer = i;
+    }
+    sim->newest = i;
+    if (sim->oldest == NONE) {
+        sim->oldest = i;
+    }
+}
+
+static void sim_evict(struct sim *sim, int32_t i) {
+    struct sim_entry *e = &sim->entries[i];
+    int32_t *link = &sim->buckets[hash_key(e->key) & sim->mask];
+
+    while (*link != i) {
+        link = &sim->entries[*link].chain;
+    }
+    *link = e->chain;
+    unlink_use(sim, i);
+
+    // the last slot takes this ones place
+    sim->slots[e->slot] = sim->slots[--sim->nslots];
+    sim->entries[sim->slots[e->slot]].slot = e->slot;
+
+    sim->held -= e->size;
+    e->chain = sim->free_list;
+    sim->free_list = i;
+}
+
+//! picks what goes next under the policy
+static int32_t sim_victim(struct sim *sim) {
+    if (sim->policy == POLICY_RANDOM) {
+        return sim->slots[next_random(sim) % sim->nslots];
+    }
+    return sim->oldest;
+}
+
+static void sim_insert(struct sim *sim, uint64_t key, uint32_t size,
+                       int ahead) {
+    struct sim_entry *e;
+    uint64_t b;
+    int32_t i;
+
+    // make room, a zone bigger than the whole cache still goes in alone
+    while (sim->nslots && sim->held + size > sim->capacity) {
+        sim_evict(sim, sim_victim(sim));
+    }
+
+    i = sim->free_list;
+    e = &sim->entries[i];
+    sim->free_list = e->chain;
+
+    b = hash_key(key) & sim->mask;
+    e->key = key;
+    e->size = size;
+    e->ahead = ahead;
+    e->chain = sim->buckets[b];
+    sim->buckets[b] = i;
+    push_use(sim, i);
+    e->slot = sim->nslots;
+    sim->slots[sim->nslots++] = i;
+    sim->held += size;
+}
+
+//! one zone of filesystem fs wanted for type
+static void sim_access(struct sim *sim, uint32_t fs, uint32_t zone,
+                       uint8_t type) {
+    uint32_t size = sim->zonesize[fs];
+    uint64_t key = (uint64_t)fs << 32 | zone;
+    int sequential = sim->last[fs] == (int64_t)zone - 1;
+    struct sim_entry *e;
+    uint32_t k;
+    int32_t i;
+
+    sim->st.accesses[type]++;
+    sim->last[fs] = zone;
+
+    if ((i = sim_find(sim, key)) != NONE) {
+        e = &sim->entries[i];
+        sim->st.hits[type]++;
+        if (e->ahead) {
+            e->ahead = FALSE;
+            sim->st.ahead_used++;
+        }
+        if (sim->policy == POLICY_LRU) {
+            unlink_use(sim, i);
+            push_use(sim, i);
+        }
+        return;
+    }
+
+    // a miss is one read, with whatever readahead adds on to it
+    sim->st.ios++;
+    sim->st.bytes += size;
+    sim_insert(sim, key, size, FALSE);
+    if (!sequential) {
+        return;
+    }
+    for (k = 1; k <= sim->ahead && (uint64_t)zone + k <= UINT32_MAX; k++) {
+        if (sim_find(sim, key + k) == NONE) {
+            sim_insert(sim, key + k, size, TRUE);
+            sim->st.bytes += size;
+            sim->st.ahead_read++;
+        }
+    }
+}
+
+//! sets a cache up, big enough for every zone it could ever hold at once
+static void sim_init(struct sim *sim, uint64_t capacity, int policy,
+                     uint32_t ahead, uint64_t distinct, uint32_t min_zone) {
+    uint64_t buckets = 1;
+    uint32_t i;
+
+    memset(sim, 0, sizeof(*sim));
+    sim->capacity = capacity;
+    sim->policy = policy;
+    sim->ahead = ahead;
+    // demand zones are at most the distinct ones, and each can bring in
+    // ahead more behind it
+    sim->nentries = MIN(capacity / min_zone, distinct * (ahead + 1)) + 2;
+    while (buckets < (uint64_t)sim->nentries * 2) {
+        buckets <<= 1;
+    }
+    sim->mask = buckets - 1;
+
+    sim->entries = malloc(sizeof(struct sim_entry) * sim->nentries);
+    sim->slots = malloc(sizeof(uint32_t) * sim->nentries);
+    sim->buckets = malloc(sizeof(int32_t) * buckets);
+    if (!sim->entries || !sim->slots || !sim->buckets) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    memset(sim->buckets, 0xFF, sizeof(int32_t) * buckets);
+    for (i = 0; i < sim->nentries; i++) {
+        sim->entries[i].chain = i + 1 < sim->nentries ? (int32_t)i + 1 : NONE;
+    }
+    for (i = 0; i < MAX_FS; i++) {
+        sim->last[i] = NONE;
+    }
+    sim->free_list = 0;
+    sim->newest = sim->oldest = NONE;
+    sim->rng = RANDOM_SEED;
+}
+
+static void sim_free(struct sim *sim) {
+    free(sim->entries);
+    free(sim->slots);
+    free(sim->buckets);
+}
+
+//! runs the whole trace through one cache
+static void replay(struct sim *sim, const struct minfs_trace_record *recs,
+                   size_t count) {
+    const struct minfs_trace_record *r;
+    uint64_t zones;
+    uint64_t k;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        r = &recs[i];
+        if (r->type == MINFS_TRACE_FS) {
+            sim->zonesize[r->fs] = r->len;
+            continue;
+        }
+        zones = (r->len + sim->zonesize[r->fs] - 1) / sim->zonesize[r->fs];
+        for (k = 0; k < zones && r->zone + k <= UINT32_MAX; k++) {
+            sim_access(sim, r->fs, r->zone + k, r->type);
+        }
+    }
+}
+
+/* Before replaying */
+
+//! checks the trace makes sense (every filesystem said its zone size
+//! first) and counts the distinct zones in it, the most any cache holds
+//! and the misses no cache could avoid
+
+static uint64_t survey(const struct minfs_trace_record *recs, size_t count,
+                       uint32_t *min_zone, uint32_t *nfs) {
+    struct sim all;
+    uint32_t zonesize[MAX_FS];
+    uint64_t zones = 0;
+    uint64_t reads[MINFS_TRACE_TYPES];
+    uint64_t bytes[MINFS_TRACE_TYPES];
+    size_t i;
+    int t;
+
+    memset(zonesize, 0, sizeof(zonesize));
+    memset(reads, 0, sizeof(reads));
+    memset(bytes, 0, sizeof(bytes));
+    *min_zone = UINT32_MAX;
+    *nfs = 0;
+
+    for (i = 0; i < count; i++) {
+        if (recs[i].fs >= MAX_FS) {
+            fprintf(stderr, "more than %d filesystems in the trace\n",
+                    MAX_FS);
+            exit(ERROR);
+        }
+        if (recs[i].type == MINFS_TRACE_FS) {
+            if (!recs[i].len || recs[i].len > UINT32_MAX) {
+                fprintf(stderr, "bad zone size in the trace\n");
+                exit(ERROR);
+            }
+            zonesize[recs[i].fs] = recs[i].len;
+            *min_zone = MIN(*min_zone, (uint32_t)recs[i].len);
+            *nfs = MAX(*nfs, recs[i].fs + 1);
+            continue;
+        }
+        if (!zonesize[recs[i].fs]) {
+            fprintf(stderr, "trace reads a filesystem it never opened\n");
+            exit(ERROR);
+        }
+        reads[recs[i].type]++;
+        bytes[recs[i].type] += recs[i].len;
+        zones += (recs[i].len + zonesize[recs[i].fs] - 1) /
+                 zonesize[recs[i].fs];
+    }
+    if (*min_zone == UINT32_MAX) {
+        *min_zone = BLOCK_SIZE;
+    }
+
+    // a cache that never throws anything out has every distinct zone in
+    // it once, and missed each of them exactly once
+    sim_init(&all, UINT64_MAX, POLICY_FIFO, 0, zones, *min_zone);
+    replay(&all, recs, count);
+
+    printf("%zu records, %u filesystems\n", count, *nfs);
+    for (t = 1; t < MINFS_TRACE_TYPES; t++) {
+        printf("%-9s %10llu reads %12llu bytes %10llu zones\n",
+               type_names[t], (unsigned long long)reads[t],
+               (unsigned long long)bytes[t],
+               (unsigned long long)all.st.accesses[t]);
+    }
+    printf("%llu distinct zones (%.1f MiB), %.2f%% is the best any cache "
+           "could hit\n\n", (unsigned long long)all.st.ios,
+           all.st.bytes / MIB, zones ? 100.0 *
+           (zones - all.st.ios) / zones : 0.0);
+    zones = all.st.ios;
+    sim_free(&all);
+    return zones;
+}
+
+/* The command line */
+
+//! a size like 512K or 16M, 0 if it isnt one
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t n = strtoull(s, &end, 10);
+
+    switch (*end) {
+        case 'K': case 'k':
+            n <<= 10;
+            end++;
+            break;
+        case 'M': case 'm':
+            n <<= 20;
+            end++;
+            break;
+        case 'G': case 'g':
+            n <<= 30;
+            end++;
+            break;
+    }
+    return *end ? 0 : n;
+}
+
+static int parse_policy(const char *s) {
+    int i;
+
+    for (i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0]));
+         i++) {
+        if (!strcmp(s, policy_names[i])) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+//! splits a comma list into out (at most MAX_CHOICES), exiting on a bad
+//! one. kind is 0 for sizes, 1 for policies, 2 for readahead
+static int parse_list(const char *list, int kind, uint64_t *out) {
+    char *copy = strdup(list);
+    char *save = NULL;
+    char *item;
+    char *end;
+    int n = 0;
+
+    if (!copy) {
+        perror("strdup");
+        exit(ERROR);
+    }
+    for (item = strtok_r(copy, ",", &save); item;
+         item = strtok_r(NULL, ",", &save)) {
+        if (n == MAX_CHOICES) {
+            fprintf(stderr, "at most %d of each\n", MAX_CHOICES);
+            exit(ERROR);
+        }
+        if (kind == 0) {
+            out[n] = parse_size(item);
+        }
+        else if (kind == 1) {
+            out[n] = parse_policy(item) + 1;
+        }
+        else {
+            out[n] = strtoull(item, &end, 10) + 1;
+            out[n] = *end || out[n] > UINT16_MAX ? 0 : out[n];
+        }
+        if (!out[n]) {
+            fprintf(stderr, "Bad choice '%s'\n", item);
+            exit(ERROR);
+        }
+        n++;
+    }
+    free(copy);
+    if (!n) {
+        fprintf(stderr, "Empty list '%s'\n", list);
+        exit(ERROR);
+    }
+    return n;
+}
+
+static void size_name(uint64_t size, char *out) {
+    if (size >= (1 << 30) && !(size & ((1 << 30) - 1))) {
+        sprintf(out, "%lluG", (unsigned long long)(size >> 30));
+    }
+    else if (size >= (1 << 20) && !(size & ((1 << 20) - 1))) {
+        sprintf(out, "%lluM", (unsigned long long)(size >> 20));
+    }
+    else if (size >= (1 << 10) && !(size & ((1 << 10) - 1))) {
+        sprintf(out, "%lluK", (unsigned long long)(size >> 10));
+    }
+    else {
+        sprintf(out, "%llu", (unsigned long long)size);
+    }
+}
+
+static void print_result(const struct sim *sim) {
+    uint64_t accesses = 0;
+    uint64_t hits = 0;
+    char size[32];
+    int t;
+
+    for (t = 1; t < MINFS_TRACE_TYPES; t++) {
+        accesses += sim->st.accesses[t];
+        hits += sim->st.hits[t];
+    }
+    size_name(sim->capacity, size);
+    printf("%-7s %7s %5u %10llu %7.2f%% %9llu %9.1f",
+           policy_names[sim->policy], size, sim->ahead,
+           (unsigned long long)accesses,
+           accesses ? 100.0 * hits / accesses : 0.0,
+           (unsigned long long)sim->st.ios, sim->st.bytes / MIB);
+    if (sim->st.ahead_read) {
+        printf(" %9.1f%%", 100.0 * sim->st.ahead_used / sim->st.ahead_read);
+    }
+    else {
+        printf(" %10s", "-");
+    }
+
+    // where the hits were, for -v
+    for (t = 1; t < MINFS_TRACE_TYPES && v_flag; t++) {
+        if (sim->st.accesses[t]) {
+            printf(" %s %.1f%%", type_names[t],
+                   100.0 * sim->st.hits[t] / sim->st.accesses[t]);
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+    struct minfs_trace_record *recs;
+    uint64_t sizes[MAX_CHOICES];
+    uint64_t policies[MAX_CHOICES];
+    uint64_t aheads[MAX_CHOICES];
+    const char *size_list = SIZES_DEFAULT;
+    const char *policy_list = POLICIES_DEFAULT;
+    const char *ahead_list = AHEAD_DEFAULT;
+    int nsizes, npolicies, naheads;
+    uint64_t distinct;
+    uint32_t min_zone;
+    uint32_t nfs;
+    struct sim sim;
+    size_t count;
+    int opt;
+    int err;
+    int p, s, a;
+
+    while ((opt = getopt(argc, argv, "vc:e:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'v':
+                v_flag = TRUE;
+                break;
+            case 'c':
+                size_list = optarg;
+                break;
+            case 'e':
+                policy_list = optarg;
+                break;
+            case 'r':
+                ahead_list = optarg;
+                break;
+            default:
+                print_usage(argv);
+                exit(opt == 'h' ? SUCCESS : ERROR);
+        }
+    }
+    if (optind != argc - 1)
+    {
+        print_usage(argv);
+        exit(ERROR);
+    }
+
+    nsizes = parse_list(size_list, 0, sizes);
+    npolicies = parse_list(policy_list, 1, policies);
+    naheads = parse_list(ahead_list, 2, aheads);
+
+    if ((err = minfs_trace_load(argv[optind], &recs, &count)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind], minfs_strerror(err));
+        exit(ERROR);
+    }
+    distinct = survey(recs, count, &min_zone, &nfs);
+
+    printf("%-7s %7s %5s %10s %8s %9s %9s %10s\n", "policy", "cache",
+           "ahead", "zones", "hits", "reads", "MiB read", "ahead used");
+    for (p = 0; p < npolicies; p++)
+    {
+        for (s = 0; s < nsizes; s++)
+        {
+            for (a = 0; a < naheads; a++)
+            {
+                sim_init(&sim, sizes[s], policies[p] - 1, aheads[a] - 1,
+                         distinct, min_zone);
+                replay(&sim, recs, count);
+                print_result(&sim);
+                sim_free(&sim);
+            }
+        }
+    }
+
+    free(recs);
+    return SUCCESS;
+}
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "helper.h"
+#include "partscan.h"
+
+// how much we pull out of a childs pipe at once
+#define PIPE_CHUNK 4096
+
+// a childs stdout or stderr and the part of a line we are holding onto
+struct child_stream {
+    FILE *dest;         // where the lines end up in this process
+    const char *prefix; // what each line gets tagged with
+    char *line;         // bytes since the last newline
+    size_t len;
+    size_t cap;
+};
+
+//! reads one partition table (the sector at base) into table
+//! returns FALSE if the sector does not have the table signature
+
+static int read_table(minfs_image_t *disk_image, uint64_t base,
+                      struct partition table[PARTITION_COUNT]) {
+    uint8_t sector[SECTOR_SIZE];
+
+    if (minfs_image_read(disk_image, base, SECTOR_SIZE, sector) < 0) {
+        return FALSE;
+    }
+
+    // the same 0x55 0xAA signature minfs_open checks for
+    if (sector[510] != PT_510 || sector[511] != PT_511) {
+        return FALSE;
+    }
+
+    memcpy(table, sector + PARTITION_TABLE_LOCATION,
+           sizeof(struct partition) * PARTITION_COUNT);
+    return TRUE;
+}
+
+//! checks for a minix superblock in the filesystem starting at start
+static int has_superblock(minfs_image_t *disk_image, uint64_t start) {
+    struct superblock sb;
+
+    if (minfs_image_read(disk_image, start + BLOCK_SIZE, sizeof(sb),
+                         &sb) < 0) {
+        return FALSE;
+    }
+    return sb.magic == SUPERBLOCK_MAGIC;
+}
+
+//! adds one filesystem to the list, growing it as it goes
+static void add_location(struct fs_location **found, int *count,
+                         int prim, int sub, struct partition *part) {
+    struct fs_location *loc;
+
+    *found = realloc(*found, sizeof(struct fs_location) * (*count + 1));
+    if (!*found) {
+        perror("realloc");
+        exit(ERROR);
+    }
+
+    loc = &(*found)[(*count)++];
+    loc->prim = prim;
+    loc->sub = sub;
+    loc->part = *part;
+
+    if (sub == NO_PARTITION) {
+        snprintf(loc->prefix, PREFIX_LEN, "p%d", prim);
+    }
+    else {
+        snprintf(loc->prefix, PREFIX_LEN, "p%ds%d", prim, sub);
+    }
+}
+
+//! walks the whole partition tree once (through the image layer, so
+//! compressed images work too): the four primaries and the
+//! subpartition table inside each one. every minix filesystem it finds
+//! goes into found. returns how many there were (0 if no partition table)
+
+int scan_partitions(minfs_image_t *disk_image, struct fs_location **found) {
+    struct partition primary[PARTITION_COUNT];
+    struct partition subs[PARTITION_COUNT];
+    int count = 0;
+    int subs_found;
+    int i, j;
+
+    *found = NULL;
+
+    // no table at the front of the image means nothing to scan
+    if (!read_table(disk_image, 0, primary)) {
+        return 0;
+    }
+
+    for (i = 0; i < PARTITION_COUNT; i++) {
+        if (primary[i].type != FILETYPE_MINIX || primary[i].lFirst == 0) {
+            continue;
+        }
+
+        // a primary either holds a subpartition table or is a filesystem
+        subs_found = 0;
+        if (read_table(disk_image, (uint64_t)primary[i].lFirst * SECTOR_SIZE,
+                       subs)) {
+            for (j = 0; j < PARTITION_COUNT; j++) {
+                if (subs[j].type != FILETYPE_MINIX || subs[j].lFirst == 0) {
+                    continue;
+                }
+                if (has_superblock(disk_image,
+                                   (uint64_t)subs[j].lFirst * SECTOR_SIZE)) {
+                    add_location(found, &count, i, j, &subs[j]);
+                    subs_found++;
+                }
+            }
+        }
+
+        if (!subs_found &&
+            has_superblock(disk_image,
+                           (uint64_t)primary[i].lFirst * SECTOR_SIZE)) {
+            add_location(found, &count, i, NO_PARTITION, &primary[i]);
+        }
+    }
+
+    return count;
+}
+
+//! sets the partition flags to loc, as if it was given with -p and -s
+void select_location(struct fs_location *loc) {
+    p_flag = TRUE;
+    prim_part = loc->prim;
+    s_flag = loc->sub != NO_PARTITION;
+    sub_part = s_flag ? loc->sub : 0;
+}
+
+//! sends every complete line we have from a child out with its prefix
+static void flush_lines(struct child_stream *stream, int at_eof) {
+    char *start = stream->line;
+    char *end = stream->line + stream->len;
+    char *newline;
+
+    while ((newline = memchr(start, '\n', end - start)) != NULL) {
+        fprintf(stream->dest, "%s: ", stream->prefix);
+        fwrite(start, 1, newline - start + 1, stream->dest);
+        start = newline + 1;
+    }
+
+    // a last line without a newline still gets printed when the child ends
+    if (at_eof && start < end) {
+        fprintf(stream->dest, "%s: ", stream->prefix);
+        fwrite(start, 1, end - start, stream->dest);
+        fputc('\n', stream->dest);
+        start = end;
+    }
+
+    stream->len = end - start;
+    memmove(stream->line, start, stream->len);
+    fflush(stream->dest);
+}
+
+//! reads whatever a child wrote, returns FALSE once the pipe is closed
+static int drain_stream(int fd, struct child_stream *stream) {
+    ssize_t got;
+
+    if (stream->len + PIPE_CHUNK > stream->cap) {
+        stream->cap = stream->len + PIPE_CHUNK;
+        stream->line = realloc(stream->line, stream->cap);
+        if (!stream->line) {
+            perror("realloc");
+            exit(ERROR);
+        }
+    }
+
+    got = read(fd, stream->line + stream->len, PIPE_CHUNK);
+    if (got <= 0) {
+        flush_lines(stream, TRUE);
+        return FALSE;
+    }
+
+    stream->len += got;
+    flush_lines(stream, FALSE);
+    return TRUE;
+}
+
+//! runs job on every filesystem at the same time, one child process each
+//! so the jobs can keep printing straight to stdout and stderr.
+//! each childs stdout and stderr come back here and get printed line by
+//! line with that filesystems prefix. returns ERROR if any child failed
+
+int run_on_all_partitions(struct fs_location *locs, int count,
+                          fs_job_fn job) {
+    struct pollfd *fds = calloc(count * 2, sizeof(struct pollfd));
+    struct child_stream *streams = calloc(count * 2,
+                                          sizeof(struct child_stream));
+    pid_t *pids = calloc(count, sizeof(pid_t));
+    int out_pipe[2], err_pipe[2];
+    int open_streams = count * 2;
+    int status;
+    int ret = SUCCESS;
+    int i, k;
+
+    if (!fds || !streams || !pids) {
+        perror("calloc");
+        exit(ERROR);
+    }
+
+    // dont let the children inherit anything we have buffered
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < count; i++) {
+        if (pipe(out_pipe) || pipe(err_pipe)) {
+            perror("pipe");
+            exit(ERROR);
+        }
+
+        if ((pids[i] = fork()) < 0) {
+            perror("fork");
+            exit(ERROR);
+        }
+
+        if (pids[i] == 0) {
+            // the child only needs its own write ends
+            for (k = 0; k < i * 2; k++) {
+                close(fds[k].fd);
+            }
+            close(out_pipe[0]);
+            close(err_pipe[0]);
+            dup2(out_pipe[1], STDOUT_FILENO);
+            dup2(err_pipe[1], STDERR_FILENO);
+            close(out_pipe[1]);
+            close(err_pipe[1]);
+
+            select_location(&locs[i]);
+            job(&locs[i]);
+
+            fflush(stdout);
+            exit(SUCCESS);
+        }
+
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+
+        fds[i * 2].fd = out_pipe[0];
+        fds[i * 2].events = POLLIN;
+        streams[i * 2].dest = stdout;
+        streams[i * 2].prefix = locs[i].prefix;
+
+        fds[i * 2 + 1].fd = err_pipe[0];
+        fds[i * 2 + 1].events = POLLIN;
+        streams[i * 2 + 1].dest = stderr;
+        streams[i * 2 + 1].prefix = locs[i].prefix;
+    }
+
+    // pass output along as it shows up until every pipe is closed
+    while (open_streams > 0) {
+        if (poll(fds, count * 2, -1) < 0) {
+            perror("poll");
+            exit(ERROR);
+        }
+
+        for (k = 0; k < count * 2; k++) {
+            if (fds[k].fd < 0 || !fds[k].revents) {
+                continue;
+            }
+            if (!drain_stream(fds[k].fd, &streams[k])) {
+                close(fds[k].fd);
+                fds[k].fd = -1; // poll skips negative fds
+                open_streams--;
+            }
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != SUCCESS) {
+            ret = ERROR;
+        }
+    }
+
+    for (k = 0; k < count * 2; k++) {
+        free(streams[k].line);
+    }
+    free(streams);
+    free(fds);
+    free(pids);
+    return ret;
+}
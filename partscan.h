@@ -0,0 +1,30 @@
+#ifndef PARTSCAN_H
+#define PARTSCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "minfs.h" //for the partition struct and images
+
+//macros
+#define PARTITION_COUNT 4 // entries in every partition table
+#define NO_PARTITION (-1)
+#define PREFIX_LEN 16
+
+/* Structures */
+struct fs_location {
+    int prim;                   // primary partition number
+    int sub;                    // subpartition number or NO_PARTITION
+    struct partition part;      // the table entry the filesystem is in
+    char prefix[PREFIX_LEN];    // what its output lines get tagged with
+};
+
+// does the work for one filesystem, the partition flags are set for it
+typedef void (*fs_job_fn)(struct fs_location *loc);
+
+//functions
+int scan_partitions(minfs_image_t *disk_image, struct fs_location **found);
+void select_location(struct fs_location *loc);
+int run_on_all_partitions(struct fs_location *locs, int count,
+                          fs_job_fn job);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "pipeline.h"
+
+//! waits for sem, counting it in waits if it had to
+static void wait_counted(sem_t *sem, uint64_t *waits) {
+    if (sem_trywait(sem) == 0) {
+        return;
+    }
+    (*waits)++;
+    while (sem_wait(sem) < 0 && errno == EINTR) {
+    }
+}
+
+//! writes all len bytes, returns negative errno if it couldnt
+static int write_all(int fd, const uint8_t *data, size_t len) {
+    ssize_t put;
+
+    while (len > 0) {
+        if ((put = write(fd, data, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        data += put;
+        len -= put;
+    }
+    return SUCCESS;
+}
+
+//! the writer thread, takes slots off the ring until the empty one that
+//! ends it. after a failed write it keeps emptying slots without writing
+//! them so the reader never waits on it, and finds out from p->err
+
+static void *pipe_writer(void *arg) {
+    struct pipeline *p = arg;
+    struct pipe_slot *slot;
+    int err = SUCCESS;
+    int none = SUCCESS;
+
+    for (;;) {
+        wait_counted(&p->filled, &p->empty);
+        slot = &p->slots[p->tail++ % p->depth];
+        if (!slot->len) {
+            break;
+        }
+
+        if (err == SUCCESS && (err = write_all(p->fd, slot->data,
+                                               slot->len)) < 0) {
+            __atomic_compare_exchange_n(&p->err, &none, err, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        }
+        slot->len = 0;
+        sem_post(&p->free);
+    }
+    return NULL;
+}
+
+//! sets up a ring of depth (at least 1) slots and starts the thread
+//! writing them to fd. returns negative errno if either couldnt be done
+
+int pipeline_start(struct pipeline *p, int fd, uint32_t depth) {
+    uint32_t i;
+    int err;
+
+    memset(p, 0, sizeof(struct pipeline));
+    p->fd = fd;
+    p->depth = depth;
+    if ((p->slots = calloc(p->depth, sizeof(struct pipe_slot))) == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < p->depth; i++) {
+        if ((p->slots[i].data = malloc(PIPE_SLOT_SIZE)) == NULL) {
+            err = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    sem_init(&p->free, 0, p->depth);
+    sem_init(&p->filled, 0, 0);
+    if ((err = pthread_create(&p->writer, NULL, pipe_writer, p)) != 0) {
+        err = -err;
+        sem_destroy(&p->free);
+        sem_destroy(&p->filled);
+        goto fail;
+    }
+    return SUCCESS;
+
+fail:
+    for (i = 0; i < p->depth; i++) {
+        free(p->slots[i].data);
+    }
+    free(p->slots);
+    return err;
+}
+
+//! hands the slot being filled to the writer
+static void pass_slot(struct pipeline *p) {
+    p->filling = NULL;
+    p->head++;
+    sem_post(&p->filled);
+}
+
+//! copies len bytes into the ring (zeros if data is NULL, for a hole),
+//! waiting for the writer when every slot is full. returns the error the
+//! writer ran into, if it did, so the reader can stop
+
+int pipeline_write(struct pipeline *p, const uint8_t *data, size_t len) {
+    size_t chunk;
+    int err;
+
+    if ((err = __atomic_load_n(&p->err, __ATOMIC_ACQUIRE)) < 0) {
+        return err;
+    }
+
+    while (len > 0) {
+        if (!p->filling) {
+            wait_counted(&p->free, &p->full);
+            p->filling = &p->slots[p->head % p->depth];
+        }
+
+        chunk = MIN(len, PIPE_SLOT_SIZE - p->filling->len);
+        if (data) {
+            memcpy(p->filling->data + p->filling->len, data, chunk);
+            data += chunk;
+        }
+        else {
+            memset(p->filling->data + p->filling->len, 0, chunk);
+        }
+        p->filling->len += chunk;
+        len -= chunk;
+
+        if (p->filling->len == PIPE_SLOT_SIZE) {
+            pass_slot(p);
+        }
+    }
+    return SUCCESS;
+}
+
+//! passes on whatever is left, tells the writer it is done and waits for
+//! it. returns the first error a write got, the ring is gone either way
+
+int pipeline_finish(struct pipeline *p) {
+    uint32_t i;
+
+    if (p->filling && p->filling->len) {
+        pass_slot(p);
+    }
+
+    // an empty slot is the end
+    if (!p->filling) {
+        wait_counted(&p->free, &p->full);
+        p->filling = &p->slots[p->head % p->depth];
+    }
+    p->filling->len = 0;
+    pass_slot(p);
+    pthread_join(p->writer, NULL);
+
+    sem_destroy(&p->free);
+    sem_destroy(&p->filled);
+    for (i = 0; i < p->depth; i++) {
+        free(p->slots[i].data);
+    }
+    free(p->slots);
+    return p->err;
+}
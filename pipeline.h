@@ -0,0 +1,53 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/*
+ * Reading a file on one thread and writing it out on another, so a slow
+ * pipe or disk on the other end doesnt stop the image being read and the
+ * image being slow doesnt leave the output idle. The reader fills slots
+ * in a ring and the writer empties them in the same order, and a full
+ * ring is what holds the reader back.
+ *
+ * There is no lock around the ring. Each side has its own index into it
+ * that the other never touches, and two semaphores count the slots that
+ * are free and the ones that are filled, so a side only ever sleeps when
+ * it has nothing to do.
+ */
+
+#define PIPE_DEPTH_DEFAULT 8        // slots in the ring
+#define PIPE_SLOT_SIZE (128 * 1024) // zones are gathered up to this
+
+/* Structures */
+
+// one buffer in the ring, len 0 tells the writer that was the end
+struct pipe_slot {
+    uint8_t *data;
+    size_t len;
+};
+
+struct pipeline {
+    struct pipe_slot *slots;
+    uint32_t depth;
+    uint64_t head;      // next slot to fill, only the reader uses it
+    uint64_t tail;      // next slot to write, only the writer uses it
+    struct pipe_slot *filling;  // the slot the reader has, NULL for none
+    sem_t free;         // slots the reader can fill
+    sem_t filled;       // slots the writer can write
+    int fd;
+    int err;            // the first write that failed, atomic
+    uint64_t full;      // times the reader had to wait for the writer
+    uint64_t empty;     // times the writer had to wait for the reader
+    pthread_t writer;
+};
+
+//functions
+int pipeline_start(struct pipeline *p, int fd, uint32_t depth);
+int pipeline_write(struct pipeline *p, const uint8_t *data, size_t len);
+int pipeline_finish(struct pipeline *p);
+
+#endif
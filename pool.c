@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "pool.h"
+
+//! one thread per cpu unless told otherwise
+int pool_default_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus > 0 ? cpus : 1;
+}
+
+static void *pool_worker(void *arg) {
+    struct pool *pool = arg;
+    struct pool_job *job;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (!pool->head) {
+            break;
+        }
+
+        job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pool->running++;
+
+        // the job runs without the lock so it can submit more
+        pthread_mutex_unlock(&pool->lock);
+        job->fn(job->arg);
+        free(job);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->running--;
+        if (!pool->running && !pool->head) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct pool *pool_create(int nthreads) {
+    struct pool *pool = calloc(1, sizeof(struct pool));
+    int i;
+
+    if (nthreads < 1) {
+        nthreads = pool_default_threads();
+    }
+    if (!pool || (pool->threads = calloc(nthreads, sizeof(pthread_t))) ==
+        NULL) {
+        perror("calloc");
+        exit(ERROR);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool)) {
+            perror("pthread_create");
+            exit(ERROR);
+        }
+    }
+    pool->nthreads = nthreads;
+    return pool;
+}
+
+//! queues fn(arg) to run on whichever worker is free first
+void pool_submit(struct pool *pool, pool_fn fn, void *arg) {
+    struct pool_job *job = malloc(sizeof(struct pool_job));
+
+    if (!job) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = job;
+    }
+    else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+//! waits until there is nothing queued and nothing running
+void pool_wait(struct pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->head || pool->running) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+//! finishes whatever is queued and stops the workers
+void pool_destroy(struct pool *pool) {
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = TRUE;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool);
+}
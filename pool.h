@@ -0,0 +1,40 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+/*
+ * A fixed set of worker threads taking jobs off one queue. Jobs can add
+ * more jobs (a directory job adding one per subdirectory), and
+ * pool_wait returns once the queue is empty and every worker is idle.
+ */
+
+typedef void (*pool_fn)(void *arg);
+
+/* Structures */
+struct pool_job {
+    pool_fn fn;
+    void *arg;
+    struct pool_job *next;
+};
+
+struct pool {
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // a job was added or the pool is stopping
+    pthread_cond_t idle;    // the last running job finished
+    struct pool_job *head;
+    struct pool_job *tail;
+    int running;            // jobs taken off the queue but not done
+    int stopping;
+};
+
+//functions
+int pool_default_threads(void);
+struct pool *pool_create(int nthreads);
+void pool_submit(struct pool *pool, pool_fn fn, void *arg);
+void pool_wait(struct pool *pool);
+void pool_destroy(struct pool *pool);
+
+#endif
@@ -8,26 +8,195 @@
 
 #include "print.h"
 #include "helper.h"
+#include "pipeline.h"
 
 //! prints out the usage statement for the program
 void print_usage(char *argv[])
 {
+    // minbench makes its own images, none of the image options apply
+    if (!strcmp(argv[0], "./minbench"))
+    {
+        fprintf(stderr, "usage: minbench [ -j ] [ -t millis ] ");
+        fprintf(stderr, "[ routine ... ]\n");
+        fprintf(stderr, "times each library routine (or the ones whose ");
+        fprintf(stderr, "names start with a routine)\n");
+        fprintf(stderr, "on images built in memory with 1K and 4K zones\n");
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "-j         --- print the results as JSON\n");
+        fprintf(stderr, "-t millis  --- run each routine at least this ");
+        fprintf(stderr, "long (default: 200)\n");
+        return;
+    }
+    // mintrace only reads a trace, none of the image options apply
+    if (!strcmp(argv[0], "./mintrace"))
+    {
+        fprintf(stderr, "usage: mintrace [ -v ] [ -c sizes ] ");
+        fprintf(stderr, "[ -e policies ] [ -r zones ] tracefile\n");
+        fprintf(stderr, "replays a trace written with -T against ");
+        fprintf(stderr, "every mix of the caches below\n");
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "-c sizes    --- cache sizes, K M or G ");
+        fprintf(stderr, "(default: 256K,1M,4M,16M,64M)\n");
+        fprintf(stderr, "-e policies --- lru, fifo or random ");
+        fprintf(stderr, "(default: all three)\n");
+        fprintf(stderr, "-r zones    --- zones read ahead after a ");
+        fprintf(stderr, "sequential miss (default: 0,8,32)\n");
+        fprintf(stderr, "-v          --- hits for each kind of read too\n");
+        return;
+    }
     if (!strcmp(argv[0], "./minls"))
     {
-        fprintf(stderr, "usage: minls [ -v ] [ -p num [ -s num ] ] imagefile");
+        fprintf(stderr, "usage: minls [ -v ] [ -a | -p num [ -s num ] ] ");
+        fprintf(stderr, "[ -l limit [ -C cursor ] ] imagefile ");
         fprintf(stderr, "[path]\n");
     }
     else if (!strcmp(argv[0], "./minget"))
     {
-        fprintf(stderr, "usage: minget [ -v ] [ -p part [ -s subpart ] ]");
-        fprintf(stderr, " imagefile srcpath [ dstpath ]");
+        fprintf(stderr, "usage: minget [ -v ] [ -a | -p part [ -s subpart ] ]");
+        fprintf(stderr, " [ -d | -e ]");
+        fprintf(stderr, " [ -r [ -m manifest ] ]");
+        fprintf(stderr, " [ -H hash [ -n ] | -x tar|cpio | -b ]");
+        fprintf(stderr, " [ -D depth ]");
+        fprintf(stderr, " imagefile srcpath");
+        fprintf(stderr, " [ dstpath ]\n");
+    }
+    else if (!strcmp(argv[0], "./minfind"))
+    {
+        fprintf(stderr, "usage: minfind [ -v ] [ -p part [ -s subpart ] ]");
+        fprintf(stderr, " imagefile [ path ] [ expression ]\n");
+        fprintf(stderr, "expression: -type fdlcbps, -size [+-]N[ckMG], ");
+        fprintf(stderr, "-mtime/-ctime [+-]days,\n");
+        fprintf(stderr, "  -newermt/-newerct date, -uid/-gid/-links ");
+        fprintf(stderr, "[+-]N, -perm [-/]octal (all must match)\n");
+    }
+    else if (!strcmp(argv[0], "./mindiff"))
+    {
+        fprintf(stderr, "usage: mindiff [ -v ] [ -p part [ -s subpart ] ]");
+        fprintf(stderr, " [ -c ] [ -H hash ] image1 image2 [ path ]\n");
+    }
+    else if (!strcmp(argv[0], "./mingrep"))
+    {
+        fprintf(stderr, "usage: mingrep [ -v ] [ -p part [ -s subpart ] ]");
+        fprintf(stderr, " [ -j threads ] pattern imagefile [ path ]\n");
+        fprintf(stderr, "prints path:offset for every place pattern is ");
+        fprintf(stderr, "found, one fixed string per line of pattern\n");
+    }
+    else if (!strcmp(argv[0], "./mindu"))
+    {
+        fprintf(stderr, "usage: mindu [ -v ] [ -a | -p part [ -s subpart ] ]");
+        fprintf(stderr, " [ -j threads ] imagefile [ path ]\n");
+    }
+    else if (!strcmp(argv[0], "./minfrag"))
+    {
+        fprintf(stderr, "usage: minfrag [ -v ]");
+        fprintf(stderr, " [ -a | -p part [ -s subpart ] ]");
+        fprintf(stderr, " imagefile [ path ]\n");
+        fprintf(stderr, "prints how many extents each file is in, and ");
+        fprintf(stderr, "totals and histograms for a directory\n");
+    }
+    else if (!strcmp(argv[0], "./minpack"))
+    {
+        fprintf(stderr, "usage: minpack [ -v ] [ -p part [ -s subpart ] ]");
+        fprintf(stderr, " imagefile newimage\n");
+        fprintf(stderr, "writes the filesystem to newimage with every ");
+        fprintf(stderr, "file in one run of zones\n");
+    }
+    else if (!strcmp(argv[0], "./minput"))
+    {
+        fprintf(stderr, "usage: minput [ -v ] [ -p part [ -s subpart ] ]");
+        fprintf(stderr, " imagefile hostfile dstpath\n");
+        fprintf(stderr, "copies hostfile into the image as dstpath (or ");
+        fprintf(stderr, "into it, if it is a directory)\n");
+    }
+    else if (!strcmp(argv[0], "./mincatalog"))
+    {
+        fprintf(stderr, "usage: mincatalog [ -v ] [ -p part [ -s subpart ] ]");
+        fprintf(stderr, " [ -j threads ] [ -M mib ]\n");
+        fprintf(stderr, "                  lookup|ls|get imagelist ");
+        fprintf(stderr, "[ path ] [ dstdir ]\n");
+        fprintf(stderr, "asks every image in imagelist (one a line, - for ");
+        fprintf(stderr, "stdin) about path, lines are tagged\n");
+        fprintf(stderr, "with the image. get puts each ones copy in ");
+        fprintf(stderr, "dstdir/imagename\n");
     }
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "-p part    --- select partition for filesystem ");
     fprintf(stderr, "(default: none)\n");
     fprintf(stderr, "-s sub     --- select subpartition for filesystem ");
     fprintf(stderr, "(default: none)\n");
+    if (strcmp(argv[0], "./mindiff") && strcmp(argv[0], "./minfind") &&
+        strcmp(argv[0], "./mingrep") && strcmp(argv[0], "./minpack") &&
+        strcmp(argv[0], "./minput") && strcmp(argv[0], "./mincatalog"))
+    {
+        fprintf(stderr, "-a         --- every minix filesystem on the disk, ");
+        fprintf(stderr, "output tagged pN or pNsM\n");
+    }
     fprintf(stderr, "-v verbose --- increase verbosity level\n");
+    if (!strcmp(argv[0], "./minfrag"))
+    {
+        fprintf(stderr, "           --- and print every files extent map\n");
+    }
+    fprintf(stderr, "-d         --- read the image with O_DIRECT, around ");
+    fprintf(stderr, "the page cache\n");
+    fprintf(stderr, "-e         --- drop file data from the page cache ");
+    fprintf(stderr, "once it has been read\n");
+    fprintf(stderr, "-T file    --- record every zone read in file, ");
+    fprintf(stderr, "for mintrace\n");
+    if (!strcmp(argv[0], "./minget"))
+    {
+        fprintf(stderr, "-H hash    --- hash the file while reading it ");
+        fprintf(stderr, "(xxh64 or sha256)\n");
+        fprintf(stderr, "-n         --- with -H, only print the hash\n");
+        fprintf(stderr, "-r         --- extract everything under srcpath ");
+        fprintf(stderr, "into dstpath, or with -H hash it\n");
+        fprintf(stderr, "               (files with several names are ");
+        fprintf(stderr, "only read once)\n");
+        fprintf(stderr, "-m file    --- with -r, only extract what ");
+        fprintf(stderr, "changed since file was written,\n");
+        fprintf(stderr, "               then write it again (-H hashes ");
+        fprintf(stderr, "go in it too)\n");
+        fprintf(stderr, "-x format  --- stream srcpath and everything ");
+        fprintf(stderr, "under it as a tar or cpio archive\n");
+        fprintf(stderr, "-b         --- time reading srcpath through the ");
+        fprintf(stderr, "page cache and with O_DIRECT\n");
+        fprintf(stderr, "-D depth   --- buffers the file is written out ");
+        fprintf(stderr, "through on its own thread\n");
+        fprintf(stderr, "               (default: %d, 0 writes it ",
+                PIPE_DEPTH_DEFAULT);
+        fprintf(stderr, "as it is read)\n");
+    }
+    if (!strcmp(argv[0], "./mindiff"))
+    {
+        fprintf(stderr, "-c         --- compare file data even when the ");
+        fprintf(stderr, "inodes and zones match\n");
+        fprintf(stderr, "-H hash    --- hash used to compare files ");
+        fprintf(stderr, "(default: xxh64)\n");
+    }
+    if (!strcmp(argv[0], "./minls"))
+    {
+        fprintf(stderr, "-l limit   --- list at most limit entries, then ");
+        fprintf(stderr, "print a cursor for the rest to stderr\n");
+        fprintf(stderr, "-C cursor  --- carry on from where a cursor ");
+        fprintf(stderr, "says, without reading what came before\n");
+    }
+    if (!strcmp(argv[0], "./mindu"))
+    {
+        fprintf(stderr, "-j threads --- directories read at once ");
+        fprintf(stderr, "(default: one per cpu)\n");
+    }
+    if (!strcmp(argv[0], "./mingrep"))
+    {
+        fprintf(stderr, "-j threads --- files searched at once ");
+        fprintf(stderr, "(default: one per cpu)\n");
+    }
+    if (!strcmp(argv[0], "./mincatalog"))
+    {
+        fprintf(stderr, "-j threads --- images open at once ");
+        fprintf(stderr, "(default: one per cpu)\n");
+        fprintf(stderr, "-M mib     --- most decompressed data the ");
+        fprintf(stderr, "compressed images hold between them\n");
+        fprintf(stderr, "               (default: %d)\n", CACHE_DEFAULT_MB);
+    }
 }
 
 //! prints out all the info about a partition for the verbose flag
@@ -56,7 +225,7 @@ void print_super_block(struct superblock sb)
     fprintf(stderr, "  z_blocks       %d\n", sb.z_blocks);
     fprintf(stderr, "  firstdata      %d\n", sb.firstdata);
     fprintf(stderr, "  log_zone_size  %d (zone size: %d)\n",
-            sb.log_zone_size, zonesize);
+            sb.log_zone_size, sb.blocksize << sb.log_zone_size);
     fprintf(stderr, "  max_file       %d\n", sb.max_file);
     fprintf(stderr, "  magic          0x%04x\n", sb.magic);
     fprintf(stderr, "  zones          %d\n", sb.zones);
@@ -65,7 +234,7 @@ void print_super_block(struct superblock sb)
 }
 
 //! prints out all inode info
-void print_inode(struct inode * node)
+void print_inode(const struct inode * node)
 {
     int i;
     fprintf(stderr, "File inode:\n");
@@ -92,11 +261,11 @@ void print_inode(struct inode * node)
 }
 
 //! prints the file details
-void print_file(struct inode *node, char *name) {
+void print_file(const struct inode *node, const char *name) {
     printf("%-10s " " %8d %s", get_mode(node->mode), node->size, name);
 }
 
-void print_single_file_contents(struct inode *node)
+void print_single_file_contents(const struct inode *node)
 {
     printf("%s%10d ", get_mode(node->mode), node->size);
 }
@@ -109,23 +278,34 @@ char *get_time(uint32_t time)
     return ctime(&t);
 }
 
-//! makes the permissions string
+//! writes the permissions string into out (11 bytes), for threads that
+//! cant use request_arena
+
+void format_mode(uint16_t mode, char *out)
+{
+    out[0] = GET_PERM(mode, MASK_DIR, 'd');
+    out[1] = GET_PERM(mode, MASK_O_R, 'r');
+    out[2] = GET_PERM(mode, MASK_O_W, 'w');
+    out[3] = GET_PERM(mode, MASK_O_X, 'x');
+    out[4] = GET_PERM(mode, MASK_G_R, 'r');
+    out[5] = GET_PERM(mode, MASK_G_W, 'w');
+    out[6] = GET_PERM(mode, MASK_G_X, 'x');
+    out[7] = GET_PERM(mode, MASK_OT_R, 'r');
+    out[8] = GET_PERM(mode, MASK_OT_W, 'w');
+    out[9] = GET_PERM(mode, MASK_OT_X, 'x');
+    out[10] = '\0';
+}
+
+//! makes the permissions string, it lasts until request_arena is reset
 char *get_mode(uint16_t mode)
 {
-    char* permissions = (char *) malloc(sizeof(char) * 11);
-    permissions[0] = GET_PERM(mode, MASK_DIR, 'd');
-    permissions[1] = GET_PERM(mode, MASK_O_R, 'r');
-    permissions[2] = GET_PERM(mode, MASK_O_W, 'w');
-    permissions[3] = GET_PERM(mode, MASK_O_X, 'x');
-    permissions[4] = GET_PERM(mode, MASK_G_R, 'r');
-    permissions[5] = GET_PERM(mode, MASK_G_W, 'w');
-    permissions[6] = GET_PERM(mode, MASK_G_X, 'x');
-    permissions[7] = GET_PERM(mode, MASK_OT_R, 'r');
-    permissions[8] = GET_PERM(mode, MASK_OT_W, 'w');
-    permissions[9] = GET_PERM(mode, MASK_OT_X, 'x');
-
-    permissions[10] = '\0';
+    char* permissions = arena_alloc(&request_arena, sizeof(char) * 11);
 
+    if (!permissions) {
+        perror("malloc");
+        exit(ERROR);
+    }
+    format_mode(mode, permissions);
     return permissions;
 }
 
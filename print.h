@@ -5,11 +5,6 @@
 #include "minfunc.h" //for the structs
 
 //macros
-#define FILE_TYPE 0170000
-#define SYM_LINK_TYPE 0120000
-#define REGULAR_FILE 0100000
-
-#define MASK_DIR  0040000
 #define MASK_O_R  0000400
 #define MASK_O_W  0000200
 #define MASK_O_X  0000100
@@ -27,11 +22,12 @@
 void print_partition(struct partition part);
 void print_super_block(struct superblock sb);
 void print_usage(char *argv[]);
-void print_inode(struct inode *node);
-void print_file(struct inode *node, char *name);
-void print_single_file_contents(struct inode *node);
+void print_inode(const struct inode *node);
+void print_file(const struct inode *node, const char *name);
+void print_single_file_contents(const struct inode *node);
 char *get_time(uint32_t time);
 char *get_mode(uint16_t mode);
+void format_mode(uint16_t mode, char *out);
 
 void print_path();
 